@@ -0,0 +1,260 @@
+/**
+ * batch.c
+ * Headless batch mode
+ * - The script is memory-mapped and its lines are parsed in place
+ * - All commands are applied as one transaction: dependents are not
+ *   updated after each command but recalculated once, in topological
+ *   order, when the script ends
+ * - Nothing is rendered; only the final result is written, either the
+ *   whole sheet as CSV (streamed by export.c) or the values of selected
+ *   cells
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "init.h"
+#include "io.h"
+#include "process.h"
+#include "label.h"
+#include "export.h"
+#include "batch.h"
+
+// Output options
+const char *batch_export = NULL;
+bool batch_formulas = false;
+
+/**
+ * Cell or rectangle selected for output (0-based, inclusive)
+ */
+typedef struct Selection {
+    int r1, c1;
+    int r2, c2;
+} Selection;
+
+/**
+ * Parses a comma-separated list of cells and ranges, e.g. "A1,B2:C9"
+ * @param count Pointer to store the number of entries
+ * @return The entries, or NULL if the list is empty or invalid
+ */
+static Selection *parse_selection(const char *list, int *count) {
+    int capacity = 1;
+    for (const char *p = list; *p; p++) {
+        if (*p == ',') capacity++;
+    }
+    Selection *entries = (Selection *)malloc(capacity * sizeof(Selection));
+    *count = 0;
+
+    const char *start = list;
+    while (true) {
+        const char *end = strchr(start, ',');
+        if (end == NULL) end = start + strlen(start);
+
+        char item[MAX_RANGE_LEN];
+        size_t len = (size_t)(end - start);
+        if (len == 0 || len >= sizeof(item)) break;
+        memcpy(item, start, len);
+        item[len] = '\0';
+
+        Selection *entry = &entries[*count];
+        char *colon = strchr(item, ':');
+        if (colon == NULL) {
+            if (!validate_cell(item)) break;
+            cell_to_rc(item, &entry->r1, &entry->c1);
+            entry->r2 = entry->r1;
+            entry->c2 = entry->c1;
+        } else {
+            if (!validate_range(item)) break;
+            *colon = '\0';
+            cell_to_rc(item, &entry->r1, &entry->c1);
+            cell_to_rc(colon + 1, &entry->r2, &entry->c2);
+        }
+        entry->r1--;
+        entry->c1--;
+        entry->r2--;
+        entry->c2--;
+        (*count)++;
+
+        if (*end == '\0') return entries;
+        start = end + 1;
+    }
+
+    free(entries);
+    return NULL;
+}
+
+/**
+ * Writes one cell value the way the sheet shows it
+ */
+static void write_value(FILE *out, int value) {
+    if (value == ERROR_VALUE) {
+        fputs("ERR", out);
+    } else {
+        fprintf(out, "%d", value);
+    }
+}
+
+/**
+ * Writes "cell,value" for every selected cell, in row-major order per entry
+ */
+static void write_selection(FILE *out, const Selection *entries, int count) {
+    for (int i = 0; i < count; i++) {
+        for (int r = entries[i].r1; r <= entries[i].r2; r++) {
+            for (int c = entries[i].c1; c <= entries[i].c2; c++) {
+                fprintf(out, "%s%d,", column_label(c + 1, NULL), r + 1);
+                write_value(out, CELL(r, c));
+                fputc('\n', out);
+            }
+        }
+    }
+}
+
+/**
+ * Applies one script line, with the same checks as the interactive loop
+ * Display commands (scrolling, output control) have no effect here
+ * @return false once the script asks to quit
+ */
+static bool apply_line(char *line, int number) {
+    ParsedCommand result;
+    input_parser(line, &result);
+    if (strcmp(line, "q") == 0) return false;
+
+    strcpy(status, "ok");
+    switch (result.type) {
+        case CMD_SCROLL:
+        case CMD_SCROLL_DIR:
+        case CMD_VIEWPORT:
+        case CMD_CONTROL:
+            return true;
+        case CMD_SLEEP:
+            process_command(&result);
+            return true;
+        case CMD_INVALID:
+            strcpy(status, "unrecognized cmd");
+            break;
+        case CMD_SET_CELL:
+            if (!is_numeric_value(&result)) {
+                strcpy(status, "unrecognized cmd");
+                break;
+            }
+            handle_dependencies(&result);
+            break;
+        case CMD_FUNCTION:
+            if (!is_valid_range(&result)) {
+                strcpy(status, "Invalid range");
+                break;
+            }
+            handle_dependencies(&result);
+            break;
+        default:
+            handle_dependencies(&result);
+            break;
+    }
+
+    if (strcmp(status, "ok") != 0) {
+        fprintf(stderr, "line %d: %s\n", number, status);
+    }
+    return true;
+}
+
+/**
+ * Runs a script without the interactive interface
+ * @param script Path of the command file
+ * @param cells Cells and ranges to print, or NULL to dump the whole sheet
+ *              (unless it is exported to a file)
+ * @param out Stream the result is written to
+ * @return Process exit status
+ */
+int run_batch(const char *script, const char *cells, FILE *out) {
+    Selection *entries = NULL;
+    int entry_count = 0;
+    if (cells != NULL) {
+        entries = parse_selection(cells, &entry_count);
+        if (entries == NULL) {
+            fprintf(stderr, "Invalid cell list: %s\n", cells);
+            return 1;
+        }
+    }
+
+    int fd = open(script, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(script);
+        if (fd >= 0) close(fd);
+        free(entries);
+        return 1;
+    }
+
+    // A private writable mapping lets the parser terminate lines in place
+    // without touching the file
+    size_t size = (size_t)st.st_size;
+    char *text = NULL;
+    if (size > 0) {
+        text = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            perror(script);
+            close(fd);
+            free(entries);
+            return 1;
+        }
+        madvise(text, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    output_enabled = false;
+    defer_recalc = true;
+
+    char *line = text;
+    char *end = text + size;
+    int number = 0;
+    while (line < end) {
+        char *newline = (char *)memchr(line, '\n', (size_t)(end - line));
+        char *line_end = newline != NULL ? newline : end;
+        number++;
+
+        // Long lines are cut like the interactive reader does
+        if (line_end - line > MAX_INPUT_LEN - 1) {
+            line_end = line + MAX_INPUT_LEN - 1;
+        }
+
+        bool more;
+        if (line_end < end) {
+            *line_end = '\0';
+            more = apply_line(line, number);
+        } else {
+            // Last line without a newline: there is no byte to terminate it in
+            char input[MAX_INPUT_LEN];
+            memcpy(input, line, (size_t)(line_end - line));
+            input[line_end - line] = '\0';
+            more = apply_line(input, number);
+        }
+        if (!more || newline == NULL) break;
+        line = newline + 1;
+    }
+
+    defer_recalc = false;
+    recalc_deferred();
+
+    if (text != NULL) munmap(text, size);
+
+    int code = 0;
+    if (batch_export != NULL &&
+        !export_file(batch_export, 0, 0, MAXROW - 1, MAXCOL - 1, batch_formulas)) {
+        perror(batch_export);
+        code = 1;
+    }
+    if (entries != NULL) {
+        write_selection(out, entries, entry_count);
+    } else if (batch_export == NULL) {
+        // Buffered output goes first, then the sheet is streamed past stdio
+        fflush(out);
+        export_stream(fileno(out), ',', 0, 0, MAXROW - 1, MAXCOL - 1, batch_formulas);
+    }
+    fflush(out);
+    free(entries);
+    return code;
+}
@@ -0,0 +1,22 @@
+/**
+ * batch.h
+ * Headless batch mode for the spreadsheet
+ * Runs a command file as one transaction with deferred recalculation and
+ * writes only the final values
+ */
+
+#ifndef __BATCH__
+#define __BATCH__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Output options
+extern const char *batch_export;    // File the final sheet is exported to (--export), or NULL
+extern bool batch_formulas;         // Sheet output shows formula text (--formulas)
+
+// Run a script and write the whole sheet as CSV, or "cell,value" lines for the
+// comma-separated cells and ranges in cells (NULL for the whole sheet)
+int run_batch(const char *script, const char *cells, FILE *out);
+
+#endif
@@ -2,38 +2,92 @@
 #include "io.h"
 #include "process.h"
 #include "dependent.h"
+#include "range.h"
+#include "formula.h"
+#include "storage.h"
 #include <stdlib.h>
 #include "stack.h"
 #include <stdio.h>
+#include <string.h>
 
 
 Parent ***Parent_lst;
 Child ***Child_lst;
 
+/**
+ * Mark left on a cell by a walk of the dependency graph
+ * A cell counts as visited when its mark is the current walk's number, so
+ * a walk touches only the cells it reaches instead of clearing a grid
+ */
+typedef struct Visit {
+    unsigned int walk;          // Number of the last walk that reached the cell
+    int parent_r, parent_c;     // Cell it was reached from in that walk (topo_sort)
+} Visit;
+
+static Visit *visits = NULL;    // MAXROW x MAXCOL marks, allocated on first use
+static unsigned int walk = 0;   // Number of the current walk
+
+// Rows in which some list was ever started; freeing skips the others, so
+// tearing down a large, mostly empty sheet does not read every list head
+static bool *parent_rows = NULL;
+static bool *child_rows = NULL;
+
+/**
+ * Starts a new walk of the dependency graph
+ */
+static void begin_walk() {
+    if (visits == NULL) {
+        visits = (Visit *)table_alloc(TABLE_VISITS, sizeof(Visit));
+        walk = 0;
+    }
+    if (++walk == 0) {
+        // The counter wrapped: old marks could be mistaken for new ones
+        memset(visits, 0, (size_t)MAXROW * MAXCOL * sizeof(Visit));
+        walk = 1;
+    }
+}
+
+/**
+ * Returns the mark of cell (r, c)
+ */
+static inline Visit *visit(int r, int c) {
+    return &visits[(size_t)r * MAXCOL + c];
+}
+
 /** 
  * Function to create Parent_lst (initialize all elements to NULL)
  */
 void make_parent_list() {
+    // All list heads come from one zeroed table (NULL everywhere)
+    Parent **heads = (Parent **)table_alloc(TABLE_PARENTS, sizeof(Parent *));
     Parent_lst = (Parent ***)malloc(MAXROW * sizeof(Parent **));
     for (int i = 0; i < MAXROW; i++) {
-        Parent_lst[i] = (Parent **)malloc(MAXCOL * sizeof(Parent *));
-        for (int j = 0; j < MAXCOL; j++) {
-            Parent_lst[i][j] = NULL;  // Initialize all parent lists to NULL
-        }
+        Parent_lst[i] = heads + (size_t)i * MAXCOL;
     }
+    parent_rows = (bool *)calloc(MAXROW, sizeof(bool));
 }
 
 /** 
  * Function to create Child_lst (initialize all elements to NULL)
 */
 void make_child_list() {
+    // All list heads come from one zeroed table (NULL everywhere)
+    Child **heads = (Child **)table_alloc(TABLE_CHILDREN, sizeof(Child *));
     Child_lst = (Child ***)malloc(MAXROW * sizeof(Child **));
     for (int i = 0; i < MAXROW; i++) {
-        Child_lst[i] = (Child **)malloc(MAXCOL * sizeof(Child *));
-        for (int j = 0; j < MAXCOL; j++) {
-            Child_lst[i][j] = NULL;  // Initialize all child lists to NULL
-        }
+        Child_lst[i] = heads + (size_t)i * MAXCOL;
     }
+    child_rows = (bool *)calloc(MAXROW, sizeof(bool));
+    make_range_table();  // Range edges live in the child lists
+    make_formula_table();  // Compiled formulas live as long as their edges
+}
+
+/**
+ * Checks whether any cell of row r may have parents
+ * Rows for which this is false hold no formula and can be skipped
+ */
+bool row_has_parents(int r) {
+    return parent_rows[r];
 }
 
 /**
@@ -41,6 +95,7 @@ void make_child_list() {
  */
 void free_parent_list() {
     for (int i = 0; i < MAXROW; i++) {
+        if (!parent_rows[i]) continue;
         for (int j = 0; j < MAXCOL; j++) {
             Parent *curr = Parent_lst[i][j];
             while (curr != NULL) {
@@ -49,9 +104,10 @@ void free_parent_list() {
                 free(temp);
             }
         }
-        free(Parent_lst[i]);  // Free row pointers
     }
-    free(Parent_lst);  // Free the entire list
+    table_free(TABLE_PARENTS, Parent_lst[0], sizeof(Parent *));  // Free the list heads
+    free(Parent_lst);  // Free the row pointers
+    free(parent_rows);
 }
 
 /**
@@ -59,6 +115,7 @@ void free_parent_list() {
  */
 void free_child_list() {
     for (int i = 0; i < MAXROW; i++) {
+        if (!child_rows[i]) continue;
         for (int j = 0; j < MAXCOL; j++) {
             Child *curr = Child_lst[i][j];
             while (curr != NULL) {
@@ -67,9 +124,14 @@ void free_child_list() {
                 free(temp);
             }
         }
-        free(Child_lst[i]);  // Free row pointers
     }
-    free(Child_lst);  // Free the entire list
+    table_free(TABLE_CHILDREN, Child_lst[0], sizeof(Child *));  // Free the list heads
+    free(Child_lst);  // Free the row pointers
+    free(child_rows);
+    table_free(TABLE_VISITS, visits, sizeof(Visit));  // Walk marks are sized for this sheet
+    visits = NULL;
+    free_range_table();  // Interned ranges share the lifetime of their edges
+    free_formula_table();  // Compiled formulas are owned by their cells
 }
 
 /**
@@ -85,8 +147,10 @@ void assign_parent(int r1, int c1, int r2, int c2, ParsedCommand formula) {
     newParent->r = act_r1;
     newParent->c = act_c1;
     newParent->formula = formula;
+    newParent->range = NULL;
     newParent->next = Parent_lst[act_r2][act_c2];  
     Parent_lst[act_r2][act_c2] = newParent;
+    parent_rows[act_r2] = true;
 }
 
 /**
@@ -131,8 +195,10 @@ void assign_child(int r1, int c1, int r2, int c2, ParsedCommand formula) {
     newChild->r = act_r2;
     newChild->c = act_c2;
     newChild->formula = formula;
+    newChild->range = NULL;
     newChild->next = Child_lst[act_r1][act_c1];  
     Child_lst[act_r1][act_c1] = newChild;
+    child_rows[act_r1] = true;
 }
 
 /**
@@ -165,16 +231,76 @@ void remove_child(int r1, int c1, int r2, int c2) {
     }
 }
 
+/**
+ * Function to record that cell (r, c) subscribes to an interned range
+ */
+void assign_range_parent(int r, int c, RangeEntry *range, ParsedCommand formula) {
+    Parent *newParent = (Parent *)malloc(sizeof(Parent));
+    newParent->r = -1;
+    newParent->c = -1;
+    newParent->formula = formula;
+    newParent->range = range;
+    newParent->next = Parent_lst[r][c];
+    Parent_lst[r][c] = newParent;
+    parent_rows[r] = true;
+}
+
+/**
+ * Function to add the single edge from cell (r, c) to an interned range
+ */
+void assign_range_child(int r, int c, RangeEntry *range) {
+    Child *newChild = (Child *)malloc(sizeof(Child));
+    newChild->r = -1;
+    newChild->c = -1;
+    memset(&newChild->formula, 0, sizeof(ParsedCommand));
+    newChild->range = range;
+    newChild->next = Child_lst[r][c];
+    Child_lst[r][c] = newChild;
+    child_rows[r] = true;
+}
+
+/**
+ * Function to remove the edge from cell (r, c) to an interned range
+ */
+void remove_range_child(int r, int c, RangeEntry *range) {
+    Child **link = &Child_lst[r][c];
+    while (*link != NULL) {
+        if ((*link)->range == range) {
+            Child *temp = *link;
+            *link = temp->next;
+            free(temp);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+/**
+ * Function to remove every dependency of cell (r, c)
+ * Cell parents lose their child edge, range subscriptions are released
+ */
+void clear_parents(int r, int c) {
+    while (Parent_lst[r][c] != NULL) {
+        Parent *head = Parent_lst[r][c];
+        Parent_lst[r][c] = head->next;
+        if (head->range != NULL) {
+            range_unsubscribe(head->range, r, c);
+        } else {
+            remove_child(head->r, head->c, r, c);
+        }
+        free(head);
+    }
+}
 
 /**
  * Function to perform BFS/DFS from a root node to discover relevant nodes and count in-degrees.
  */
-void mark_dfs(int r, int c, int **visited, bool *cycle) {
+void mark_dfs(int r, int c, bool *cycle) {
     if (r < 0 || r >= MAXROW || c < 0 || c >= MAXCOL)
         return;
 
-    if(!visited[r][c]) {
-        visited[r][c] = true;
+    if(visit(r, c)->walk != walk) {
+        visit(r, c)->walk = walk;
     } else {
         *cycle = true; 
         return;
@@ -182,34 +308,23 @@ void mark_dfs(int r, int c, int **visited, bool *cycle) {
 
     Child *child = Child_lst[r][c];
     while (child != NULL) {
-        mark_dfs(child->r, child->c, visited, cycle);
+        if (child->range != NULL) {
+            // A range edge stands for every cell subscribed to the range
+            for (Subscriber *sub = child->range->subs; sub != NULL; sub = sub->next) {
+                mark_dfs(sub->r, sub->c, cycle);
+            }
+        } else {
+            mark_dfs(child->r, child->c, cycle);
+        }
         child = child->next;
     }
 }
 
 
 bool detect_cycle(int root_r, int root_c) {
-    int **visited;
-    visited = (int **)malloc(MAXROW * sizeof(int *));
-    for (int i = 0; i < MAXROW; i++) {
-        visited[i] = (int *)malloc(MAXCOL * sizeof(int));
-    }
-
-    for (int i = 0; i < MAXROW; i++) {
-        for (int j = 0; j < MAXCOL; j++) {
-            visited[i][j] = false;
-        }
-    }
-
+    begin_walk();
     bool cycle = false;
-    mark_dfs(root_r, root_c, visited, &cycle);
-
-    // Free memory
-    for (int i = 0; i < MAXROW; i++) {
-        free(visited[i]);
-    }
-    free(visited);
-
+    mark_dfs(root_r, root_c, &cycle);
     return cycle;
 }
 
@@ -236,6 +351,19 @@ AdjNode *build_main_list(int **visited) {
     return head;
 }
 
+static void link_adj(AdjNode *current, int r, int c) {
+    AdjNode *node = (AdjNode *)malloc(sizeof(AdjNode));
+    node->r = r;
+    node->c = c;
+    node->next = NULL;
+    if (current->next == NULL)
+        current->next = node;
+    else {
+        node->next = current->next;
+        current->next = node;
+    }
+}
+
 void link_children(AdjNode *head) {
     AdjNode *current = head;
 
@@ -245,15 +373,12 @@ void link_children(AdjNode *head) {
 
         Child *child = Child_lst[r][c];
         while (child != NULL) {
-            AdjNode *node = (AdjNode *)malloc(sizeof(AdjNode));
-            node->r = child->r;
-            node->c = child->c;
-            node->next = NULL;
-            if (current->next == NULL)
-                current->next = node;
-            else {
-                node->next = current->next;
-                current->next = node;
+            if (child->range != NULL) {
+                for (Subscriber *sub = child->range->subs; sub != NULL; sub = sub->next) {
+                    link_adj(current, sub->r, sub->c);
+                }
+            } else {
+                link_adj(current, child->r, child->c);
             }
             child = child->next;
         }
@@ -274,15 +399,24 @@ void print_adjlst(AdjNode *Lst) {
     }
 }
 
-void topo_sort_dfs(int r, int c, int **visited, StackNode **parentMap) {
-    if (visited[r][c]) return;
-    visited[r][c] = true;
+void topo_sort_dfs(int r, int c) {
+    if (visit(r, c)->walk == walk) return;
+    visit(r, c)->walk = walk;
 
     Child *child = Child_lst[r][c];
     while (child != NULL) {
-        if (!visited[child->r][child->c]) {
-            parentMap[child->r][child->c] = (StackNode){.r = r, .c = c, .next = NULL};  // Store parent with all fields
-            topo_sort_dfs(child->r, child->c, visited, parentMap);
+        if (child->range != NULL) {
+            for (Subscriber *sub = child->range->subs; sub != NULL; sub = sub->next) {
+                if (visit(sub->r, sub->c)->walk != walk) {
+                    visit(sub->r, sub->c)->parent_r = r;
+                    visit(sub->r, sub->c)->parent_c = c;
+                    topo_sort_dfs(sub->r, sub->c);
+                }
+            }
+        } else if (visit(child->r, child->c)->walk != walk) {
+            visit(child->r, child->c)->parent_r = r;  // Store parent
+            visit(child->r, child->c)->parent_c = c;
+            topo_sort_dfs(child->r, child->c);
         }
         child = child->next;
     }
@@ -291,20 +425,10 @@ void topo_sort_dfs(int r, int c, int **visited, StackNode **parentMap) {
 }
 
 void topo_sort(int root_r, int root_c, ParsedCommand *result) {
-    int **visited = (int **)malloc(MAXROW * sizeof(int *));
-    StackNode **parentMap = (StackNode **)malloc(MAXROW * sizeof(StackNode *));  // Parent tracker
-
-    for (int i = 0; i < MAXROW; i++) {
-        visited[i] = (int *)malloc(MAXCOL * sizeof(int));
-        parentMap[i] = (StackNode *)malloc(MAXCOL * sizeof(StackNode));
-
-        for (int j = 0; j < MAXCOL; j++) {
-            visited[i][j] = false;
-            parentMap[i][j] = (StackNode){.r = -1, .c = -1, .next = NULL};  // Default invalid parent with all fields
-        }
-    }
-
-    topo_sort_dfs(root_r, root_c, visited, parentMap);
+    begin_walk();
+    visit(root_r, root_c)->parent_r = -1;  // The root has no parent
+    visit(root_r, root_c)->parent_c = -1;
+    topo_sort_dfs(root_r, root_c);
 
     // printf("\nTopological Order with Formulas:\n");
 
@@ -332,7 +456,8 @@ void topo_sort(int root_r, int root_c, ParsedCommand *result) {
         StackNode nextNode = pop();
 
         // Get the parent of nextNode
-        StackNode parent = parentMap[nextNode.r][nextNode.c];
+        StackNode parent = {.r = visit(nextNode.r, nextNode.c)->parent_r,
+                            .c = visit(nextNode.r, nextNode.c)->parent_c, .next = NULL};
 
         // Find the formula linking parent to nextNode
         ParsedCommand formula;
@@ -357,12 +482,4 @@ void topo_sort(int root_r, int root_c, ParsedCommand *result) {
         }
     }
     // printf("\n");
-
-    // Free memory
-    for (int i = 0; i < MAXROW; i++) {
-        free(visited[i]);
-        free(parentMap[i]);
-    }
-    free(visited);
-    free(parentMap);
 }
\ No newline at end of file
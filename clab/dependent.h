@@ -11,6 +11,8 @@
 #ifndef __DEPEND__ 
     #define __DEPEND__
 
+struct RangeEntry;              // Interned range expression (range.h)
+
 /**
  * Parent node structure
  * Represents a cell that another cell depends on
@@ -20,6 +22,7 @@ typedef struct Parent {
     int c;                      // Column coordinate
     struct Parent *next;        // Next parent in list
     ParsedCommand formula;      // Formula that created the dependency
+    struct RangeEntry *range;   // Interned range this cell subscribes to (NULL for cell parents)
 } Parent;
 
 /**
@@ -31,6 +34,7 @@ typedef struct Child {
     int c;                      // Column coordinate
     struct Child *next;         // Next child in list
     ParsedCommand formula;      // Formula that created the dependency
+    struct RangeEntry *range;   // Interned range covering this cell (NULL for cell children)
 } Child;
 
 /**
@@ -57,12 +61,17 @@ void make_parent_list();        // Initialize parent list structure
 void make_child_list();         // Initialize child list structure
 void free_parent_list();        // Clean up parent list memory
 void free_child_list();         // Clean up child list memory
+bool row_has_parents(int r);    // Whether some cell of a row may hold a formula
 
 // Dependency management functions
 void assign_parent(int r1, int c1, int r2, int c2, ParsedCommand formula);  // Add parent dependency
 void remove_parent(int r1, int c1, int r2, int c2);                         // Remove parent dependency
 void assign_child(int r1, int c1, int r2, int c2, ParsedCommand formula);   // Add child dependency
 void remove_child(int r1, int c1, int r2, int c2);                         // Remove child dependency
+void assign_range_parent(int r, int c, struct RangeEntry *range, ParsedCommand formula);  // Subscribe cell to a range
+void assign_range_child(int r, int c, struct RangeEntry *range);            // Add range edge to a cell
+void remove_range_child(int r, int c, struct RangeEntry *range);            // Remove range edge from a cell
+void clear_parents(int r, int c);                                          // Remove all dependencies of a cell
 
 // Dependency analysis functions
 bool detect_cycle(int root_r, int root_c);                                 // Check for circular dependencies
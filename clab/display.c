@@ -1,14 +1,23 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <limits.h>  // For INT_MIN
+#include <signal.h>
+#include <sys/ioctl.h>
 #include "init.h"
 #include "display.h"
 #include "io.h"  // For output_enabled
+#include "timer.h"  // For pending SLEEP cells
+#include "label.h"
 
 int curr_org_r = 1;
 int curr_org_c = 1;
 int displayr = 10;
 int displayc = 10;
 int cellwidth = 8;
+bool differential_output = false;
 
 int pending_scroll_row = 0;
 int pending_scroll_col = 0;
@@ -18,19 +27,11 @@ bool accumulating_scrolls = false;
 
 void int_to_alpha(int x, char* alpha) {
     if (x > MAXCOL) return;
-    int i = MAXCOLWIDTH - 1;
-    alpha[i + 1] = '\0';
-
-    while (x != 0) {
-        alpha[i] = (char)('A' - 1 + ((x % 26) == 0 ? 26 : (x % 26)));
-        x -= ((x % 26) == 0 ? 26 : (x % 26));
-        x /= 26;
-        i--;
-    }
-    while (i >= 0) {
-        alpha[i] = ' ';
-        i--;
-    }
+    int length = 0;
+    const char *label = column_label(x, &length);
+    memset(alpha, ' ', MAXCOLWIDTH - length);
+    if (label != NULL) memcpy(alpha + MAXCOLWIDTH - length, label, length);
+    alpha[MAXCOLWIDTH] = '\0';
 }
 
 void apply_pending_scroll() {
@@ -41,33 +42,385 @@ void apply_pending_scroll() {
     }
 }
 
-void display_sheet() {
-    if (!output_enabled) return;
+// Frame buffer reused by every redraw, grown when the viewport needs more
+static char *frame = NULL;
+static size_t frame_capacity = 0;
 
-    apply_pending_scroll();  // Apply pending scrolls if any
+// Widest text an int can print as ("-2147483648")
+#define INT_TEXT_LEN 11
+
+/**
+ * Writes text right-aligned (or left-aligned) in a field of the given width
+ * Like printf("%*s"), text longer than the field is not cut
+ */
+static char *put_text(char *p, const char *text, int len, int width, bool left) {
+    int pad = width > len ? width - len : 0;
+    if (!left) {
+        memset(p, ' ', pad);
+        p += pad;
+    }
+    memcpy(p, text, len);
+    p += len;
+    if (left) {
+        memset(p, ' ', pad);
+        p += pad;
+    }
+    return p;
+}
+
+/**
+ * Writes an integer the way printf("%*d") (or "%-*d") does
+ */
+static char *put_int(char *p, int value, int width, bool left) {
+    char digits[INT_TEXT_LEN];
+    char *d = digits + INT_TEXT_LEN;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        *--d = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) *--d = '-';
+    return put_text(p, d, (int)(digits + INT_TEXT_LEN - d), width, left);
+}
+
+/**
+ * Makes room for a frame of the given size in the frame buffer
+ */
+static char *frame_reserve(size_t needed) {
+    if (needed > frame_capacity) {
+        frame = (char *)realloc(frame, needed);
+        frame_capacity = needed;
+    }
+    return frame;
+}
+
+// Viewport last drawn on the terminal, kept for differential redraws
+#define SHOWN_NUMBER 0
+#define SHOWN_ERROR 1
+#define SHOWN_PENDING 2
+static int *shown_values = NULL;          // Value of each viewport cell, row by row
+static unsigned char *shown_states = NULL;  // SHOWN_* of each viewport cell
+static int *shown_widths = NULL;          // Width of each viewport column
+static int shown_capacity = 0;
+static int shown_col_capacity = 0;
+static int shown_org_r, shown_org_c;      // Viewport origin
+static int shown_rows, shown_cols;        // Viewport size in cells
+static int shown_width;                   // Width of the row label column
+static bool shown_valid = false;          // The terminal still shows that frame
+static volatile sig_atomic_t terminal_resized = 0;
+
+// Viewport being drawn: measured once, then written or compared
+static int *view_values = NULL;
+static unsigned char *view_states = NULL;
+static int *view_widths = NULL;
+static int view_capacity = 0;
+static int view_col_capacity = 0;
+
+// The viewport follows the terminal size unless a size was set by command
+static bool viewport_auto = false;
+static int terminal_columns = 0;          // Width of the terminal in auto mode (0 if unknown)
+
+/**
+ * Reads how viewport cell (r, c) (0-based, sheet coordinates) is shown
+ */
+static unsigned char cell_state(int r, int c, int *value) {
+    *value = CELL(r, c);
+    if (timer_pending(r, c)) return SHOWN_PENDING;
+    if (*value == INT_MIN || *value == ERROR_VALUE) return SHOWN_ERROR;
+    return SHOWN_NUMBER;
+}
+
+/**
+ * Number of characters a cell is shown with, without formatting it
+ */
+static int cell_text_len(unsigned char state, int value) {
+    if (state == SHOWN_PENDING) return 4;
+    if (state == SHOWN_ERROR) return 3;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    int len = value < 0 ? 2 : 1;
+    while (magnitude >= 10) {
+        magnitude /= 10;
+        len++;
+    }
+    return len;
+}
 
+/**
+ * Writes one cell as it is shown in the frame
+ */
+static char *put_cell(char *p, unsigned char state, int value, int width) {
+    if (state == SHOWN_PENDING) return put_text(p, "PEND", 4, width, false);
+    if (state == SHOWN_ERROR) return put_text(p, "ERR", 3, width, false);
+    return put_int(p, value, width, false);
+}
+
+/**
+ * Makes room for count cells (values and states) in a pair of arrays
+ */
+static void reserve_cells(int **values, unsigned char **states, int *capacity, int count) {
+    if (count > *capacity) {
+        *capacity = count;
+        *values = (int *)realloc(*values, (size_t)count * sizeof(int));
+        *states = (unsigned char *)realloc(*states, (size_t)count);
+    }
+}
+
+/**
+ * Makes room for count column widths
+ */
+static void reserve_widths(int **widths, int *capacity, int count) {
+    if (count > *capacity) {
+        *capacity = count;
+        *widths = (int *)realloc(*widths, (size_t)count * sizeof(int));
+    }
+}
+
+/**
+ * Sizes the viewport to the terminal: one line for the header and one for
+ * the prompt, and as many columns of cellwidth as fit beside the row labels
+ * Leaves the viewport alone if the terminal size is unknown
+ */
+static void fit_terminal() {
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) < 0 || size.ws_row == 0 || size.ws_col == 0) {
+        terminal_columns = 0;
+        return;
+    }
+    int width = cellwidth > MAXCOLWIDTH ? cellwidth : MAXCOLWIDTH;
+    displayr = size.ws_row > 3 ? size.ws_row - 2 : 1;
+    displayc = size.ws_col > cellwidth + width ? (size.ws_col - cellwidth) / width : 1;
+    terminal_columns = size.ws_col;
+}
+
+/**
+ * Reads the cells of the viewport and the width of each column
+ * - A column is cellwidth wide, or one more than its widest value so that
+ *   values never run into each other
+ * - When the viewport follows the terminal, columns that would not fit on
+ *   a line are left out
+ * @param rows Pointer to store the number of rows drawn
+ * @param cols Pointer to store the number of columns drawn
+ * @return Width of a line of the frame, newline excluded
+ */
+static int measure_viewport(int *rows, int *cols) {
     int max_display_r = (curr_org_r + displayr - 1 > MAXROW) ? (MAXROW - curr_org_r + 1) : displayr;
     int max_display_c = (curr_org_c + displayc - 1 > MAXCOL) ? (MAXCOL - curr_org_c + 1) : displayc;
-    
-    printf("%*s", cellwidth, "");
-    for (int i = 0; i < max_display_c; i++) {
-        char temp[MAXCOLWIDTH + 1] = "   ";
-        int_to_alpha(curr_org_c + i, temp);
-        printf("%*s", cellwidth, temp);
-    }
-    printf("\n");
 
+    reserve_cells(&view_values, &view_states, &view_capacity, max_display_r * max_display_c);
+    reserve_widths(&view_widths, &view_col_capacity, max_display_c);
+
+    // Column labels need MAXCOLWIDTH characters even if cells are narrower
+    int min_width = cellwidth > MAXCOLWIDTH ? cellwidth : MAXCOLWIDTH;
+    for (int i = 0; i < max_display_c; i++) view_widths[i] = min_width;
     for (int j = 0; j < max_display_r; j++) {
-        printf("%-*d", cellwidth, curr_org_r + j);
         for (int i = 0; i < max_display_c; i++) {
-            int value = sheet[curr_org_r + j - 1][curr_org_c + i - 1];
-            if (value == INT_MIN || value == ERROR_VALUE) {
-                printf("%*s", cellwidth, "ERR");
-            } else {
-                printf("%*d", cellwidth, value);
+            int index = j * max_display_c + i;
+            view_states[index] = cell_state(curr_org_r + j - 1, curr_org_c + i - 1, &view_values[index]);
+            int len = cell_text_len(view_states[index], view_values[index]);
+            if (len >= view_widths[i]) view_widths[i] = len + 1;
+        }
+    }
+
+    int line = cellwidth;
+    int fitted = 0;
+    while (fitted < max_display_c) {
+        if (terminal_columns > 0 && fitted > 0 && line + view_widths[fitted] > terminal_columns) break;
+        line += view_widths[fitted];
+        fitted++;
+    }
+
+    // Dropped columns leave the row stride of the measured cells unchanged
+    if (fitted < max_display_c) {
+        for (int j = 1; j < max_display_r; j++) {
+            memmove(&view_values[j * fitted], &view_values[j * max_display_c], fitted * sizeof(int));
+            memmove(&view_states[j * fitted], &view_states[j * max_display_c], fitted);
+        }
+    }
+
+    *rows = max_display_r;
+    *cols = fitted;
+    return line;
+}
+
+/**
+ * Builds the frame of the measured viewport in the frame buffer, after an
+ * optional prefix, and records what it shows for later differential redraws
+ * @param length Pointer to store the number of bytes in the frame
+ */
+static const char *build_frame(const char *prefix, int rows, int cols, int line, size_t *length) {
+    // The row labels are at most INT_TEXT_LEN wide unless cells are wider
+    size_t label_field = (size_t)(cellwidth > INT_TEXT_LEN ? cellwidth : INT_TEXT_LEN);
+    size_t prefix_len = strlen(prefix);
+    char *p = frame_reserve(prefix_len + (size_t)(rows + 1) * ((size_t)line + label_field + 1));
+
+    memcpy(p, prefix, prefix_len);
+    p += prefix_len;
+    p = put_text(p, "", 0, cellwidth, false);
+    for (int i = 0; i < cols; i++) {
+        int label_len;
+        const char *label = column_label(curr_org_c + i, &label_len);
+        p = put_text(p, label, label_len, view_widths[i], false);
+    }
+    *p++ = '\n';
+
+    for (int j = 0; j < rows; j++) {
+        p = put_int(p, curr_org_r + j, cellwidth, true);
+        for (int i = 0; i < cols; i++) {
+            p = put_cell(p, view_states[j * cols + i], view_values[j * cols + i], view_widths[i]);
+        }
+        *p++ = '\n';
+    }
+
+    // Remember the frame so later updates can rewrite single cells
+    reserve_cells(&shown_values, &shown_states, &shown_capacity, rows * cols);
+    reserve_widths(&shown_widths, &shown_col_capacity, cols);
+    memcpy(shown_values, view_values, (size_t)rows * cols * sizeof(int));
+    memcpy(shown_states, view_states, (size_t)rows * cols);
+    memcpy(shown_widths, view_widths, (size_t)cols * sizeof(int));
+    shown_org_r = curr_org_r;
+    shown_org_c = curr_org_c;
+    shown_rows = rows;
+    shown_cols = cols;
+    shown_width = cellwidth;
+    shown_valid = true;
+    terminal_resized = 0;
+
+    *length = (size_t)(p - frame);
+    return frame;
+}
+
+/**
+ * Builds the frame of the current viewport in the frame buffer
+ * @param length Pointer to store the number of bytes in the frame
+ * @return The frame (valid until the next call)
+ */
+const char *render_frame(size_t *length) {
+    int rows, cols;
+    int line = measure_viewport(&rows, &cols);
+    return build_frame("", rows, cols, line, length);
+}
+
+/**
+ * Builds the bytes that bring the terminal up to date with the viewport
+ * - Only cells whose shown text changed are rewritten, each after an ANSI
+ *   cursor move, and the cursor is left on the prompt line
+ * - After a scroll, a resize or a change of any column width, the screen
+ *   is cleared and the whole frame is drawn
+ * @param length Pointer to store the number of bytes
+ * @return The bytes (valid until the next call)
+ */
+const char *render_update(size_t *length) {
+    if (terminal_resized && viewport_auto) fit_terminal();
+
+    int rows, cols;
+    int line = measure_viewport(&rows, &cols);
+    bool same_layout = shown_valid && !terminal_resized && shown_org_r == curr_org_r &&
+                       shown_org_c == curr_org_c && shown_rows == rows && shown_cols == cols &&
+                       shown_width == cellwidth;
+    for (int i = 0; same_layout && i < cols; i++) {
+        if (shown_widths[i] != view_widths[i]) same_layout = false;
+    }
+    if (!same_layout) {
+        return build_frame("\x1b[H\x1b[2J", rows, cols, line, length);
+    }
+
+    // A cursor move is at most 16 bytes ("\x1b[ROW;COLUMNH")
+    size_t field = INT_TEXT_LEN + 1;
+    for (int i = 0; i < cols; i++) {
+        if ((size_t)view_widths[i] > field) field = (size_t)view_widths[i];
+    }
+    char *p = frame_reserve((size_t)rows * cols * (field + 16) + 32);
+
+    for (int j = 0; j < rows; j++) {
+        int column = cellwidth + 1;   // Screen column of the cell, 1-based
+        for (int i = 0; i < cols; i++) {
+            int index = j * cols + i;
+            int width = view_widths[i];
+            int start_column = column;
+            column += width;
+
+            unsigned char state = view_states[index];
+            int value = view_values[index];
+            if (state == shown_states[index] && (state != SHOWN_NUMBER || value == shown_values[index])) {
+                continue;
             }
+
+            // Row 1 of the screen is the header
+            p = put_text(p, "\x1b[", 2, 0, false);
+            p = put_int(p, j + 2, 0, false);
+            *p++ = ';';
+            p = put_int(p, start_column, 0, false);
+            *p++ = 'H';
+            p = put_cell(p, state, value, width);
+            shown_values[index] = value;
+            shown_states[index] = state;
         }
-        printf("\n");
+    }
+
+    // Back to the prompt line below the frame, clearing the echoed command
+    p = put_text(p, "\x1b[", 2, 0, false);
+    p = put_int(p, rows + 2, 0, false);
+    p = put_text(p, ";1H\x1b[J", 6, 0, false);
+
+    *length = (size_t)(p - frame);
+    return frame;
+}
+
+/**
+ * Forces the next differential redraw to draw the whole frame
+ * Called when the terminal no longer shows the last frame where it was
+ */
+void display_invalidate() {
+    shown_valid = false;
+}
+
+/**
+ * SIGWINCH handler: the terminal was resized
+ */
+static void terminal_resize_handler(int sig) {
+    (void)sig;
+    terminal_resized = 1;
+}
+
+/**
+ * Enables differential redraws when stdout is a terminal, and sizes the
+ * viewport to it
+ * Output to files and pipes keeps the plain, scrolling 10x10 frames
+ */
+void display_init_terminal() {
+    differential_output = isatty(STDOUT_FILENO);
+    if (differential_output) {
+        viewport_auto = true;
+        fit_terminal();
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = terminal_resize_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &action, NULL);
+    }
+}
+
+void display_sheet() {
+    if (!output_enabled) return;
+
+    apply_pending_scroll();  // Apply pending scrolls if any
+
+    size_t length;
+    const char *text = differential_output ? render_update(&length) : render_frame(&length);
+
+    // Anything still buffered by stdio (the prompt) goes out first, then the
+    // whole frame in one write
+    fflush(stdout);
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, text, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        text += written;
+        length -= (size_t)written;
     }
 }
 
@@ -83,6 +436,23 @@ void set_org(int r, int c) {
     curr_org_c = (c < 1) ? 1 : (c > MAXCOL ? MAXCOL : c);
 }
 
+/**
+ * Sets the number of rows and columns shown
+ * @param rows Rows in the viewport, or 0 to follow the terminal size
+ * @param cols Columns in the viewport (ignored when following the terminal)
+ */
+void set_viewport(int rows, int cols) {
+    if (rows == 0) {
+        viewport_auto = true;
+        fit_terminal();
+        return;
+    }
+    viewport_auto = false;
+    terminal_columns = 0;
+    displayr = rows;
+    displayc = cols;
+}
+
 void scroll(int dr, int dc) {
     set_org(curr_org_r + dr, curr_org_c + dc);
 }
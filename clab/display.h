@@ -4,6 +4,8 @@
  * Handles screen output, scrolling, and viewport management
  */
 
+#include <stddef.h>
+#include <stdbool.h>
 #include "init.h"
 
 #ifndef __DISPLAY_FUNCS__
@@ -12,12 +14,17 @@
     // Navigation and display functions
     void scroll(int dr, int dy);              // Scroll by delta row/col
     void display_sheet();                     // Display current viewport
+    const char *render_frame(size_t *length); // Build the viewport text in the frame buffer
+    const char *render_update(size_t *length); // Build the ANSI update of the terminal (differential mode)
+    void display_invalidate();                // Redraw the whole frame next time (differential mode)
+    void display_init_terminal();             // Use differential redraws if stdout is a terminal
     void int_to_alpha(int x, char* alpha);    // Convert column number to letters
     void w();                                 // Scroll up
     void a();                                 // Scroll left
     void s();                                 // Scroll down
     void d();                                 // Scroll right
     void set_org(int r, int c);              // Set viewport origin
+    void set_viewport(int rows, int cols);    // Set viewport size (0 rows: follow the terminal)
     void disable_output();                    // Disable screen updates
     void enable_output();                     // Enable screen updates
 
@@ -28,6 +35,7 @@
 
     // Display configuration
     #define DEFAULT_SCROLL 10  // Number of cells to scroll by default
+    #define VIEWPORT_MAX 999   // Most rows or columns the viewport command accepts
 
     // Display state variables
     extern int cellwidth;      // Width of each cell in characters
@@ -35,5 +43,6 @@
     extern int displayc;       // Number of columns in viewport
     extern int curr_org_r;     // Current viewport origin row
     extern int curr_org_c;     // Current viewport origin column
+    extern bool differential_output;  // Redraw only changed cells with ANSI cursor moves
 
 #endif
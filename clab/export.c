@@ -0,0 +1,229 @@
+/**
+ * export.c
+ * CSV/TSV export of the spreadsheet
+ * - The rectangle is walked in bands of EXPORT_TILE_ROWS rows; each band
+ *   is first cut into tiles that are checked for emptiness in storage
+ *   order, so the check is a plain memory scan in either layout
+ * - An empty tile (all zeros, and no formulas when formulas are shown)
+ *   is emitted by copying a prepared run of zeros
+ * - Other cells are rendered with a two-digits-at-a-time integer writer
+ * - Output accumulates in one large buffer flushed with write(2)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "init.h"
+#include "io.h"
+#include "dependent.h"
+#include "storage.h"
+#include "export.h"
+
+// Longest text a single cell can render to: quotes, '=' and the formula
+// with every character doubled
+#define EXPORT_CELL_MAX (2 * MAX_EXPR_LEN + 4)
+
+/**
+ * Output buffer in front of a file descriptor
+ */
+typedef struct Writer {
+    int fd;
+    char *data;
+    size_t used;
+    bool failed;                // A write error occurred; later output is dropped
+} Writer;
+
+// "00" to "99", so each division renders two digits
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * Writes out everything buffered so far
+ */
+static void flush_writer(Writer *writer) {
+    const char *p = writer->data;
+    size_t left = writer->used;
+    while (left > 0 && !writer->failed) {
+        ssize_t n = write(writer->fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            writer->failed = true;
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    writer->used = 0;
+}
+
+/**
+ * Makes room for at least size more bytes
+ * @return Where they can be written
+ */
+static char *reserve(Writer *writer, size_t size) {
+    if (writer->used + size > EXPORT_BUFFER_SIZE) flush_writer(writer);
+    return writer->data + writer->used;
+}
+
+/**
+ * Renders one value the way the sheet shows it ("ERR" for errors)
+ * @return One past the last character written
+ */
+static char *render_value(char *p, int value) {
+    if (value == ERROR_VALUE) {
+        memcpy(p, "ERR", 3);
+        return p + 3;
+    }
+
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    if (value < 0) *p++ = '-';
+
+    char digits[10];
+    char *d = digits + sizeof(digits);
+    while (magnitude >= 100) {
+        unsigned int pair = (magnitude % 100) * 2;
+        magnitude /= 100;
+        d -= 2;
+        memcpy(d, digit_pairs + pair, 2);
+    }
+    if (magnitude >= 10) {
+        d -= 2;
+        memcpy(d, digit_pairs + magnitude * 2, 2);
+    } else {
+        *--d = (char)('0' + magnitude);
+    }
+
+    size_t length = (size_t)(digits + sizeof(digits) - d);
+    memcpy(p, d, length);
+    return p + length;
+}
+
+/**
+ * Renders "=formula", quoted when the text contains the separator
+ * @return One past the last character written
+ */
+static char *render_formula(char *p, const char *text, char separator) {
+    size_t length = strlen(text);
+    bool quote = memchr(text, separator, length) != NULL || memchr(text, '"', length) != NULL;
+    if (quote) *p++ = '"';
+    *p++ = '=';
+    for (size_t i = 0; i < length; i++) {
+        // Quotes inside a quoted field are doubled
+        if (text[i] == '"') *p++ = '"';
+        *p++ = text[i];
+    }
+    if (quote) *p++ = '"';
+    return p;
+}
+
+/**
+ * Checks whether the tile (r1, c1)..(r2, c2) has nothing but zeros
+ * (and, when formulas are shown, no formula cells)
+ */
+static bool tile_empty(int r1, int c1, int r2, int c2, bool formulas) {
+    CellSpan span = cell_span(r1, c1, r2, c2);
+    int *line;
+    while ((line = span_next(&span)) != NULL) {
+        for (int i = 0; i < span.length; i++) {
+            if (line[i] != 0) return false;
+        }
+    }
+    if (formulas) {
+        for (int r = r1; r <= r2; r++) {
+            for (int c = c1; c <= c2; c++) {
+                if (Parent_lst[r][c] != NULL) return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes the rectangle (r1, c1)..(r2, c2), 0-based, one line per row
+ * @param separator Field separator (',' or '\t')
+ * @param formulas Show "=formula" instead of the value of formula cells
+ * @return false on a write error
+ */
+bool export_stream(int fd, char separator, int r1, int c1, int r2, int c2, bool formulas) {
+    Writer writer = { fd, (char *)malloc(EXPORT_BUFFER_SIZE), 0, false };
+
+    // Separator-prefixed zeros for whole empty tiles: ",0,0,0..."
+    char zeros[2 * EXPORT_TILE_COLS];
+    for (int i = 0; i < EXPORT_TILE_COLS; i++) {
+        zeros[2 * i] = separator;
+        zeros[2 * i + 1] = '0';
+    }
+
+    int tiles = (c2 - c1) / EXPORT_TILE_COLS + 1;
+    bool *empty = (bool *)malloc(tiles * sizeof(bool));
+
+    for (int band = r1; band <= r2 && !writer.failed; band += EXPORT_TILE_ROWS) {
+        int band_end = band + EXPORT_TILE_ROWS - 1 < r2 ? band + EXPORT_TILE_ROWS - 1 : r2;
+        for (int t = 0; t < tiles; t++) {
+            int first = c1 + t * EXPORT_TILE_COLS;
+            int last = first + EXPORT_TILE_COLS - 1 < c2 ? first + EXPORT_TILE_COLS - 1 : c2;
+            empty[t] = tile_empty(band, first, band_end, last, formulas);
+        }
+        // Read the next band ahead while this one is written
+        if (band_end < r2) {
+            int next_end = band_end + EXPORT_TILE_ROWS < r2 ? band_end + EXPORT_TILE_ROWS : r2;
+            sheet_advise(band_end + 1, c1, next_end, c2);
+        }
+
+        for (int r = band; r <= band_end; r++) {
+            for (int t = 0; t < tiles; t++) {
+                int first = c1 + t * EXPORT_TILE_COLS;
+                int last = first + EXPORT_TILE_COLS - 1 < c2 ? first + EXPORT_TILE_COLS - 1 : c2;
+
+                if (empty[t]) {
+                    // The row's first cell has no separator in front of it
+                    size_t skip = first == c1 ? 1 : 0;
+                    size_t length = (size_t)(last - first + 1) * 2 - skip;
+                    memcpy(reserve(&writer, length), zeros + skip, length);
+                    writer.used += length;
+                    continue;
+                }
+
+                for (int c = first; c <= last; c++) {
+                    char *p = reserve(&writer, EXPORT_CELL_MAX + 1);
+                    char *start = p;
+                    if (c > c1) *p++ = separator;
+                    if (formulas && Parent_lst[r][c] != NULL) {
+                        p = render_formula(p, Parent_lst[r][c]->formula.expression, separator);
+                    } else {
+                        p = render_value(p, CELL(r, c));
+                    }
+                    writer.used += (size_t)(p - start);
+                }
+            }
+            *reserve(&writer, 1) = '\n';
+            writer.used++;
+        }
+    }
+    flush_writer(&writer);
+
+    free(empty);
+    free(writer.data);
+    return !writer.failed;
+}
+
+/**
+ * Writes the rectangle (r1, c1)..(r2, c2), 0-based, to a file
+ * The file is tab-separated if its name ends in ".tsv", comma-separated
+ * otherwise
+ * @return false if the file cannot be written
+ */
+bool export_file(const char *path, int r1, int c1, int r2, int c2, bool formulas) {
+    size_t length = strlen(path);
+    char separator = length >= 4 && strcmp(path + length - 4, ".tsv") == 0 ? '\t' : ',';
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool written = export_stream(fd, separator, r1, c1, r2, c2, formulas);
+    if (close(fd) < 0) written = false;
+    return written;
+}
@@ -0,0 +1,26 @@
+/**
+ * export.h
+ * CSV/TSV export of the spreadsheet (export FILE [RANGE], --export)
+ * Rows are rendered into a large buffer that is written out as it fills,
+ * and runs of empty cells are copied instead of formatted
+ */
+
+#ifndef __EXPORT__
+#define __EXPORT__
+
+#include <stdbool.h>
+
+// Size of the output buffer, in bytes
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+// Tiles of this many rows by columns are checked for emptiness at once
+#define EXPORT_TILE_ROWS 16
+#define EXPORT_TILE_COLS 256
+
+// Writes (r1, c1)..(r2, c2), 0-based, to fd; formula cells show "=formula" if formulas is set
+bool export_stream(int fd, char separator, int r1, int c1, int r2, int c2, bool formulas);
+
+// Writes (r1, c1)..(r2, c2) to a file, tab-separated if its name ends in .tsv
+bool export_file(const char *path, int r1, int c1, int r2, int c2, bool formulas);
+
+#endif
@@ -0,0 +1,499 @@
+/**
+ * formula.c
+ * Compiler for general formula expressions
+ * - Recursive descent over the grammar
+ *     expr    := term (('+' | '-') term)*
+ *     term    := unary (('*' | '/') unary)*
+ *     unary   := ('-' | '+') unary | primary
+ *     primary := number | cell | '(' expr ')' | FUNC '(' range ')'
+ *              | FUNC '(' expr (',' expr)* ')'
+ *   where FUNC is one of MIN, MAX, SUM, AVG, STDEV; the functions answered
+ *   from a range's sorted index (MEDIAN, PERCENTILE, RANK, COUNTIF, SUMIF)
+ *   and SLEEP are only accepted as a whole formula, so they are rejected here
+ * - Emits stack bytecode while parsing, tracking the stack depth needed
+ * - Folds operators and function calls whose operands are all literals
+ *   as they are emitted
+ * - Programs of a plain shape are lowered to the simple commands, which
+ *   have specialized evaluators
+ * - Every cell owns at most one program, found through a hash table
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "init.h"
+#include "io.h"
+#include "process.h"
+#include "formula.h"
+#include "label.h"
+
+/**
+ * Compiler state for one formula
+ */
+typedef struct Compiler {
+    const char *p;              // Next character to read
+    const char *end;            // End of the formula text
+    Instr code[MAX_INPUT_LEN];  // Instructions emitted so far
+    int length;                 // Number of instructions emitted
+    int depth;                  // Stack depth after the emitted instructions
+    int max_depth;              // Deepest stack seen
+    bool error;                 // Syntax or range error
+} Compiler;
+
+/**
+ * Functions allowed inside expressions
+ */
+static const struct {
+    const char *name;
+    int func;
+} expression_functions[] = {
+    {"MIN", FUNC_MIN}, {"MAX", FUNC_MAX}, {"SUM", FUNC_SUM},
+    {"AVG", FUNC_AVG}, {"STDEV", FUNC_STDEV}
+};
+
+static void compile_expr(Compiler *comp);
+
+/**
+ * Skips whitespace between tokens
+ */
+static void skip_space(Compiler *comp) {
+    while (comp->p < comp->end && isspace((unsigned char)*comp->p)) comp->p++;
+}
+
+/**
+ * Consumes the given character if it is the next token
+ */
+static bool accept(Compiler *comp, char c) {
+    skip_space(comp);
+    if (comp->p < comp->end && *comp->p == c) {
+        comp->p++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Appends an instruction and records its effect on the stack depth
+ * @param effect Net number of values the instruction pushes
+ */
+static Instr *emit(Compiler *comp, OpCode op, int effect) {
+    if (comp->length == MAX_INPUT_LEN) {
+        comp->error = true;
+        return &comp->code[0];
+    }
+    Instr *ins = &comp->code[comp->length++];
+    memset(ins, 0, sizeof(Instr));
+    ins->op = (unsigned char)op;
+
+    comp->depth += effect;
+    if (comp->depth > comp->max_depth) comp->max_depth = comp->depth;
+    if (comp->max_depth > FORMULA_MAX_DEPTH) comp->error = true;
+    return ins;
+}
+
+/**
+ * Reads a cell reference (1-3 letters and a row number within the sheet)
+ * @param row Pointer to store the row (0-based)
+ * @param col Pointer to store the column (0-based)
+ * @return true if a cell was read, false otherwise (nothing is consumed)
+ */
+static bool lex_cell(Compiler *comp, int *row, int *col) {
+    skip_space(comp);
+    const char *p;
+    int c = column_number(comp->p, comp->end, &p);
+    if (c == 0) return false;
+
+    long r = 0;
+    const char *digits = p;
+    while (p < comp->end && isdigit((unsigned char)*p)) {
+        if (r <= MAXROW) r = r * 10 + (*p - '0');
+        p++;
+    }
+    if (p == digits || (p < comp->end && isalnum((unsigned char)*p))) return false;
+    if (r < 1 || r > MAXROW || c > MAXCOL) return false;
+
+    *row = (int)r - 1;
+    *col = c - 1;
+    comp->p = p;
+    return true;
+}
+
+/**
+ * Folds the call just emitted if all of its arguments are literals
+ * A call that evaluates to ERROR_VALUE is left for the interpreter, which
+ * makes the whole formula an error
+ * @param first Index of the first instruction of the arguments
+ */
+static void fold_call(Compiler *comp, int first, int argc) {
+    if (comp->error || comp->length != first + argc + 1) return;
+    int values[MAX_INPUT_LEN];
+    for (int i = 0; i < argc; i++) {
+        if (comp->code[first + i].op != OP_CONST) return;
+        values[i] = comp->code[first + i].a;
+    }
+    int value = call_function(comp->code[comp->length - 1].func, values, argc);
+    if (value == ERROR_VALUE) return;
+
+    // One literal in place of the arguments and the call: the net effect
+    // on the stack is the same
+    comp->code[first].a = value;
+    comp->length = first + 1;
+}
+
+/**
+ * Compiles the arguments of a function call, after its '('
+ * A single range argument becomes OP_RANGE, a list of expressions OP_CALL
+ */
+static void compile_call(Compiler *comp, int func) {
+    // Range argument: FUNC(A1:B9)
+    const char *saved = comp->p;
+    int r1, c1, r2, c2;
+    if (lex_cell(comp, &r1, &c1) && accept(comp, ':')) {
+        if (!lex_cell(comp, &r2, &c2) || r1 > r2 || c1 > c2 || !accept(comp, ')')) {
+            comp->error = true;
+            return;
+        }
+        Instr *ins = emit(comp, OP_RANGE, 1);
+        ins->func = (unsigned char)func;
+        ins->a = r1;
+        ins->b = c1;
+        ins->c = r2;
+        ins->d = c2;
+        return;
+    }
+    comp->p = saved;
+
+    // Scalar arguments: FUNC(expr, expr, ...)
+    int first = comp->length;
+    int argc = 0;
+    do {
+        compile_expr(comp);
+        if (comp->error) return;
+        argc++;
+    } while (accept(comp, ','));
+    if (!accept(comp, ')') || argc > USHRT_MAX) {
+        comp->error = true;
+        return;
+    }
+    Instr *ins = emit(comp, OP_CALL, 1 - argc);
+    ins->func = (unsigned char)func;
+    ins->argc = (unsigned short)argc;
+    fold_call(comp, first, argc);
+}
+
+/**
+ * Compiles a number, a cell, a parenthesized expression or a function call
+ */
+static void compile_primary(Compiler *comp) {
+    skip_space(comp);
+    if (comp->p == comp->end) {
+        comp->error = true;
+        return;
+    }
+
+    // Number
+    if (isdigit((unsigned char)*comp->p)) {
+        long value = 0;
+        while (comp->p < comp->end && isdigit((unsigned char)*comp->p)) {
+            value = value * 10 + (*comp->p++ - '0');
+            if (value > INT_MAX) {
+                comp->error = true;
+                return;
+            }
+        }
+        emit(comp, OP_CONST, 1)->a = (int)value;
+        return;
+    }
+
+    // Parenthesized expression
+    if (accept(comp, '(')) {
+        compile_expr(comp);
+        if (!accept(comp, ')')) comp->error = true;
+        return;
+    }
+
+    // Function call
+    const char *name = comp->p;
+    while (comp->p < comp->end && isupper((unsigned char)*comp->p)) comp->p++;
+    if (comp->p < comp->end && *comp->p == '(') {
+        for (size_t i = 0; i < sizeof(expression_functions) / sizeof(expression_functions[0]); i++) {
+            const char *fname = expression_functions[i].name;
+            if ((size_t)(comp->p - name) == strlen(fname) && memcmp(name, fname, comp->p - name) == 0) {
+                comp->p++;
+                compile_call(comp, expression_functions[i].func);
+                return;
+            }
+        }
+        comp->error = true;
+        return;
+    }
+    comp->p = name;
+
+    // Cell reference
+    int row, col;
+    if (!lex_cell(comp, &row, &col)) {
+        comp->error = true;
+        return;
+    }
+    Instr *ins = emit(comp, OP_CELL, 1);
+    ins->a = row;
+    ins->b = col;
+}
+
+/**
+ * Folds the operator just emitted if all of its operands are literals
+ * @param first Index of the first instruction of the operands
+ * @param operands Number of operands (1 for OP_NEG, 2 for the others)
+ */
+static void fold_constant(Compiler *comp, int first, int operands) {
+    if (comp->error || comp->length != first + operands + 1) return;
+    Instr *x = &comp->code[first];
+    Instr *y = &comp->code[first + 1];
+    for (int i = 0; i < operands; i++) {
+        if (comp->code[first + i].op != OP_CONST) return;
+    }
+
+    switch (comp->code[comp->length - 1].op) {
+        case OP_NEG: x->a = WRAP_NEG(x->a); break;
+        case OP_ADD: x->a = WRAP_ADD(x->a, y->a); break;
+        case OP_SUB: x->a = WRAP_SUB(x->a, y->a); break;
+        case OP_MUL: x->a = WRAP_MUL(x->a, y->a); break;
+        case OP_DIV:
+            if (y->a == 0) return;  // Left for the interpreter to report
+            x->a = WRAP_DIV(x->a, y->a);
+            break;
+        default: return;
+    }
+    // The literal left in place has the same net effect on the stack
+    comp->length = first + 1;
+}
+
+/**
+ * Compiles a signed primary
+ */
+static void compile_unary(Compiler *comp) {
+    int first = comp->length;
+    if (accept(comp, '-')) {
+        compile_unary(comp);
+        emit(comp, OP_NEG, 0);
+        fold_constant(comp, first, 1);
+    } else if (accept(comp, '+')) {
+        compile_unary(comp);
+    } else {
+        compile_primary(comp);
+    }
+}
+
+/**
+ * Compiles a product or quotient
+ */
+static void compile_term(Compiler *comp) {
+    int first = comp->length;
+    compile_unary(comp);
+    while (!comp->error) {
+        if (accept(comp, '*')) {
+            compile_unary(comp);
+            emit(comp, OP_MUL, -1);
+        } else if (accept(comp, '/')) {
+            compile_unary(comp);
+            emit(comp, OP_DIV, -1);
+        } else {
+            break;
+        }
+        fold_constant(comp, first, 2);
+    }
+}
+
+/**
+ * Compiles a sum or difference
+ */
+static void compile_expr(Compiler *comp) {
+    int first = comp->length;
+    compile_term(comp);
+    while (!comp->error) {
+        if (accept(comp, '+')) {
+            compile_term(comp);
+            emit(comp, OP_ADD, -1);
+        } else if (accept(comp, '-')) {
+            compile_term(comp);
+            emit(comp, OP_SUB, -1);
+        } else {
+            break;
+        }
+        fold_constant(comp, first, 2);
+    }
+}
+
+/**
+ * Compiles the formula text [start, end)
+ * @return The program, or NULL if the text is not a valid expression
+ */
+Program *formula_compile(const char *start, const char *end) {
+    Compiler *comp = (Compiler *)malloc(sizeof(Compiler));
+    comp->p = start;
+    comp->end = end;
+    comp->length = 0;
+    comp->depth = 0;
+    comp->max_depth = 0;
+    comp->error = false;
+
+    compile_expr(comp);
+    skip_space(comp);
+    if (comp->error || comp->p != comp->end) {
+        free(comp);
+        return NULL;
+    }
+
+    Program *program = (Program *)malloc(sizeof(Program) + comp->length * sizeof(Instr));
+    program->length = comp->length;
+    program->depth = comp->max_depth;
+    memcpy(program->code, comp->code, comp->length * sizeof(Instr));
+    free(comp);
+    return program;
+}
+
+/**
+ * Reads a plain operand (literal or cell) of a lowered command
+ */
+static bool lower_operand(const Instr *ins, Operand *operand) {
+    if (ins->op == OP_CONST) {
+        operand->row = 0;
+        operand->col = 0;
+        operand->value = ins->a;
+        return true;
+    }
+    if (ins->op == OP_CELL) {
+        operand->row = ins->a + 1;
+        operand->col = ins->b + 1;
+        operand->value = 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Rewrites a program of a plain shape as the equivalent simple command
+ * - A single literal or cell becomes an assignment
+ * - Two plain operands and one operator become an arithmetic command
+ * @param result Command to fill in (its target is kept)
+ * @return true if the command was rewritten and the program is not needed
+ */
+bool formula_lower(const Program *program, ParsedCommand *result) {
+    static const char operators[] = {
+        [OP_ADD] = '+', [OP_SUB] = '-', [OP_MUL] = '*', [OP_DIV] = '/'
+    };
+
+    if (program->length == 1 && lower_operand(&program->code[0], &result->op2)) {
+        result->type = CMD_SET_CELL;
+        return true;
+    }
+    if (program->length == 3 && program->code[2].op >= OP_ADD &&
+        lower_operand(&program->code[0], &result->op2) &&
+        lower_operand(&program->code[1], &result->op3)) {
+        result->type = CMD_ARITHMETIC;
+        result->operator = operators[program->code[2].op];
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Frees a program that is not bound to a cell
+ */
+void formula_free(Program *program) {
+    free(program);
+}
+
+/**
+ * Program owned by a cell
+ */
+typedef struct FormulaEntry {
+    int r, c;                   // Cell coordinates
+    Program *program;           // Compiled formula of the cell
+    struct FormulaEntry *next;  // Next entry in the same bucket
+} FormulaEntry;
+
+static FormulaEntry *formula_table[FORMULA_BUCKETS];
+
+/**
+ * Hashes a cell into a bucket index
+ */
+static unsigned int formula_hash(int r, int c) {
+    return ((unsigned int)r * 2654435761u ^ (unsigned int)c * 40503u) % FORMULA_BUCKETS;
+}
+
+/**
+ * Function to create the program table (initialize all buckets to NULL)
+ */
+void make_formula_table() {
+    for (int i = 0; i < FORMULA_BUCKETS; i++) {
+        formula_table[i] = NULL;
+    }
+}
+
+/**
+ * Function to free every program and its table entry
+ */
+void free_formula_table() {
+    for (int i = 0; i < FORMULA_BUCKETS; i++) {
+        while (formula_table[i] != NULL) {
+            FormulaEntry *entry = formula_table[i];
+            formula_table[i] = entry->next;
+            free(entry->program);
+            free(entry);
+        }
+    }
+}
+
+/**
+ * Makes cell (r, c) the owner of a program
+ * The previous program of the cell is freed unless it is the same one
+ */
+void formula_bind(int r, int c, Program *program) {
+    FormulaEntry **bucket = &formula_table[formula_hash(r, c)];
+    for (FormulaEntry *entry = *bucket; entry != NULL; entry = entry->next) {
+        if (entry->r == r && entry->c == c) {
+            if (entry->program != program) {
+                free(entry->program);
+                entry->program = program;
+            }
+            return;
+        }
+    }
+
+    FormulaEntry *entry = (FormulaEntry *)malloc(sizeof(FormulaEntry));
+    entry->r = r;
+    entry->c = c;
+    entry->program = program;
+    entry->next = *bucket;
+    *bucket = entry;
+}
+
+/**
+ * Finds the program a cell owns
+ * @return The program, or NULL if the cell holds no compiled expression
+ */
+const Program *formula_owned(int r, int c) {
+    for (FormulaEntry *entry = formula_table[formula_hash(r, c)]; entry != NULL; entry = entry->next) {
+        if (entry->r == r && entry->c == c) return entry->program;
+    }
+    return NULL;
+}
+
+/**
+ * Frees the program of a cell whose formula is being replaced
+ */
+void formula_release(int r, int c) {
+    FormulaEntry **link = &formula_table[formula_hash(r, c)];
+    while (*link != NULL) {
+        if ((*link)->r == r && (*link)->c == c) {
+            FormulaEntry *entry = *link;
+            *link = entry->next;
+            free(entry->program);
+            free(entry);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
@@ -0,0 +1,71 @@
+/**
+ * formula.h
+ * Compiled formulas for the spreadsheet
+ * General expressions such as (A1+B1)*2-SUM(C1:C9)/MAX(D1,3) are compiled
+ * once into stack bytecode and evaluated by the interpreter in process.c
+ */
+
+#ifndef __FORMULA__
+#define __FORMULA__
+
+#include <stdbool.h>
+#include "io.h"
+
+// Deepest evaluation stack a compiled formula may need
+#define FORMULA_MAX_DEPTH 64
+
+// Number of hash buckets used to find the program of a cell
+#define FORMULA_BUCKETS 4096
+
+/**
+ * Bytecode operations
+ * Operands are pushed on the evaluation stack and operators replace the
+ * values on top of it with their result
+ */
+typedef enum {
+    OP_CONST,       // Push literal a
+    OP_CELL,        // Push the value of cell (a, b)
+    OP_RANGE,       // Push function func over the rectangle (a, b)-(c, d)
+    OP_CALL,        // Replace the top argc values by function func of them
+    OP_NEG,         // Negate the top value
+    OP_ADD,         // Replace the top two values by their sum
+    OP_SUB,         // ... difference
+    OP_MUL,         // ... product
+    OP_DIV          // ... quotient (ERROR_VALUE when dividing by zero)
+} OpCode;
+
+/**
+ * One bytecode instruction
+ */
+typedef struct Instr {
+    unsigned char op;           // OpCode
+    unsigned char func;         // FUNC_* applied by OP_RANGE and OP_CALL
+    unsigned short argc;        // Number of values taken by OP_CALL
+    int a, b;                   // Literal (a), or cell / range start (row a, column b), 0-based
+    int c, d;                   // Range end (row c, column d), 0-based
+} Instr;
+
+/**
+ * Compiled formula
+ */
+typedef struct Program {
+    int length;                 // Number of instructions
+    int depth;                  // Stack slots needed to evaluate
+    Instr code[];               // Instructions in evaluation order
+} Program;
+
+// Compilation functions
+Program *formula_compile(const char *start, const char *end);  // Compile [start, end), NULL on error
+void formula_free(Program *program);                           // Free a program no cell owns
+bool formula_lower(const Program *program, ParsedCommand *result);  // Rewrite a plain program as a simple command
+
+// Table management functions
+void make_formula_table();      // Initialize the program table
+void free_formula_table();      // Free every program
+
+// Ownership functions
+void formula_bind(int r, int c, Program *program);  // Cell (r, c) takes ownership, replacing its old program
+void formula_release(int r, int c);                 // Drop the program of a cell, if any
+const Program *formula_owned(int r, int c);         // Program of a cell, NULL if it has none
+
+#endif
@@ -0,0 +1,262 @@
+/**
+ * import.c
+ * CSV import into the spreadsheet
+ * - The file is memory-mapped and cut at line boundaries into chunks
+ * - A first parallel pass counts the lines of every chunk, so each chunk
+ *   knows the sheet row it starts at
+ * - A second parallel pass parses the fields of every chunk straight into
+ *   the sheet; chunks own disjoint rows, so no locking is needed
+ * - The shared state (formulas, dependency lists, range indexes) is then
+ *   fixed up serially and dependents are recalculated in a single wave
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "init.h"
+#include "process.h"
+#include "dependent.h"
+#include "range.h"
+#include "formula.h"
+#include "timer.h"
+#include "pool.h"
+#include "import.h"
+
+/**
+ * Part of the file parsed by one task, with the cells it wrote
+ */
+typedef struct ImportChunk {
+    const char *start;          // First byte (start of a line)
+    const char *end;            // One past the last byte (after a newline, or end of file)
+    int lines;                  // Newlines in [start, end)
+    int first_row;              // Sheet row of the first line, 0-based
+    int count;                  // Cells written
+    int capacity;               // Allocated entries in rows/cols/old
+    int *rows, *cols;           // Cells written, in file order
+    int *old;                   // Value of each cell before the import
+} ImportChunk;
+
+/**
+ * Work shared by the tasks of one import
+ */
+typedef struct ImportJob {
+    ImportChunk *chunks;
+    int col;                    // Sheet column of the first field, 0-based
+    char separator;             // Field separator
+} ImportJob;
+
+/**
+ * Parses one field as an integer
+ * Surrounding blanks and quotes are ignored and "ERR" reads back the
+ * error value written by the batch output and by export
+ * @return false if the field is empty, not an integer or out of range
+ */
+static bool parse_field(const char *start, const char *end, int *value) {
+    while (start < end && (*start == ' ' || *start == '\t')) start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    if (end - start >= 2 && *start == '"' && end[-1] == '"') {
+        start++;
+        end--;
+    }
+    if (start == end) return false;
+
+    if (end - start == 3 && memcmp(start, "ERR", 3) == 0) {
+        *value = ERROR_VALUE;
+        return true;
+    }
+
+    bool negative = false;
+    if (*start == '-' || *start == '+') {
+        negative = *start == '-';
+        start++;
+        if (start == end) return false;
+    }
+
+    // Ten digits are enough for any int; more can only overflow
+    if (end - start > 10) return false;
+    long long number = 0;
+    for (const char *p = start; p < end; p++) {
+        unsigned digit = (unsigned)(*p - '0');
+        if (digit > 9) return false;
+        number = number * 10 + digit;
+    }
+    if (negative) number = -number;
+    if (number < INT_MIN || number > INT_MAX) return false;
+    *value = (int)number;
+    return true;
+}
+
+/**
+ * Remembers a cell written by a chunk and the value it replaced
+ */
+static void record_write(ImportChunk *chunk, int r, int c, int old_value) {
+    if (chunk->count == chunk->capacity) {
+        chunk->capacity = chunk->capacity == 0 ? 256 : chunk->capacity * 2;
+        chunk->rows = (int *)realloc(chunk->rows, chunk->capacity * sizeof(int));
+        chunk->cols = (int *)realloc(chunk->cols, chunk->capacity * sizeof(int));
+        chunk->old = (int *)realloc(chunk->old, chunk->capacity * sizeof(int));
+    }
+    chunk->rows[chunk->count] = r;
+    chunk->cols[chunk->count] = c;
+    chunk->old[chunk->count] = old_value;
+    chunk->count++;
+}
+
+/**
+ * Pool task: counts the lines of chunk index
+ */
+static void count_lines(void *arg, int index) {
+    ImportChunk *chunk = &((ImportJob *)arg)->chunks[index];
+    int lines = 0;
+    const char *p = chunk->start;
+    while (p < chunk->end) {
+        const char *newline = (const char *)memchr(p, '\n', (size_t)(chunk->end - p));
+        if (newline == NULL) break;
+        lines++;
+        p = newline + 1;
+    }
+    chunk->lines = lines;
+}
+
+/**
+ * Pool task: parses chunk index into the sheet
+ * Empty and non-numeric fields leave their cell alone; rows and columns
+ * past the edge of the sheet are dropped
+ */
+static void parse_chunk(void *arg, int index) {
+    ImportJob *job = (ImportJob *)arg;
+    ImportChunk *chunk = &job->chunks[index];
+
+    int r = chunk->first_row;
+    const char *line = chunk->start;
+    while (line < chunk->end && r < MAXROW) {
+        const char *newline = (const char *)memchr(line, '\n', (size_t)(chunk->end - line));
+        const char *line_end = newline != NULL ? newline : chunk->end;
+
+        const char *field = line;
+        int c = job->col;
+        while (c < MAXCOL) {
+            const char *delimiter = (const char *)memchr(field, job->separator, (size_t)(line_end - field));
+            const char *field_end = delimiter != NULL ? delimiter : line_end;
+            int value;
+            if (parse_field(field, field_end, &value)) {
+                record_write(chunk, r, c, CELL(r, c));
+                CELL(r, c) = value;
+            }
+            if (delimiter == NULL) break;
+            field = delimiter + 1;
+            c++;
+        }
+
+        if (newline == NULL) break;
+        line = newline + 1;
+        r++;
+    }
+}
+
+/**
+ * Cuts [text, text + size) into count chunks that start at line boundaries
+ */
+static void split_chunks(const char *text, size_t size, ImportChunk *chunks, int count) {
+    const char *end = text + size;
+    const char *start = text;
+    for (int i = 0; i < count; i++) {
+        const char *stop = end;
+        if (i < count - 1) {
+            stop = text + size / count * (size_t)(i + 1);
+            if (stop < start) stop = start;
+            const char *newline = (const char *)memchr(stop, '\n', (size_t)(end - stop));
+            stop = newline != NULL ? newline + 1 : end;
+        }
+        memset(&chunks[i], 0, sizeof(ImportChunk));
+        chunks[i].start = start;
+        chunks[i].end = stop;
+        start = stop;
+    }
+}
+
+/**
+ * Copies a CSV file into the sheet, one line per row from the anchor
+ * A file whose name ends in ".tsv" is read as tab-separated
+ * Imported cells lose any formula they had, as with an assignment, and
+ * everything downstream of the cells that changed is recalculated once
+ * @param row Sheet row of the first line, 0-based
+ * @param col Sheet column of the first field, 0-based
+ * @return false if the file cannot be read
+ */
+bool import_csv(const char *path, int row, int col) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    const char *text = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) return false;
+    madvise((void *)text, size, MADV_SEQUENTIAL);
+
+    int count = 1;
+    if (pool_threads > 1 && size >= 2 * (size_t)IMPORT_MIN_CHUNK) {
+        count = pool_threads * IMPORT_CHUNKS_PER_THREAD;
+        if ((size_t)count > size / IMPORT_MIN_CHUNK) count = (int)(size / IMPORT_MIN_CHUNK);
+    }
+
+    ImportJob job;
+    job.chunks = (ImportChunk *)malloc(count * sizeof(ImportChunk));
+    job.col = col;
+    size_t length = strlen(path);
+    job.separator = length >= 4 && strcmp(path + length - 4, ".tsv") == 0 ? '\t' : ',';
+    split_chunks(text, size, job.chunks, count);
+
+    pool_run(count_lines, &job, count);
+    long long first_row = row;
+    for (int i = 0; i < count; i++) {
+        job.chunks[i].first_row = first_row < MAXROW ? (int)first_row : MAXROW;
+        first_row += job.chunks[i].lines;
+    }
+    pool_run(parse_chunk, &job, count);
+    munmap((void *)text, size);
+
+    // Drop the formulas of the imported cells and bring the range indexes
+    // up to date, then recalculate from the cells whose value changed
+    int total = 0;
+    for (int i = 0; i < count; i++) total += job.chunks[i].count;
+    int *changed_rows = (int *)malloc((total > 0 ? total : 1) * sizeof(int));
+    int *changed_cols = (int *)malloc((total > 0 ? total : 1) * sizeof(int));
+    int changed = 0;
+    for (int i = 0; i < count; i++) {
+        ImportChunk *chunk = &job.chunks[i];
+        for (int k = 0; k < chunk->count; k++) {
+            int r = chunk->rows[k];
+            int c = chunk->cols[k];
+            timer_cancel(r, c);
+            formula_release(r, c);
+            clear_parents(r, c);
+            if (CELL(r, c) == chunk->old[k]) continue;
+            range_cell_written(r, c, chunk->old[k], CELL(r, c));
+            changed_rows[changed] = r;
+            changed_cols[changed] = c;
+            changed++;
+        }
+        free(chunk->rows);
+        free(chunk->cols);
+        free(chunk->old);
+    }
+    free(job.chunks);
+
+    recalc_cells(changed, changed_rows, changed_cols);
+    free(changed_rows);
+    free(changed_cols);
+    return true;
+}
@@ -0,0 +1,22 @@
+/**
+ * import.h
+ * CSV import into the spreadsheet (import FILE CELL)
+ * The file is memory-mapped and cut into row chunks that are parsed in
+ * parallel straight into the sheet; dependents are recalculated once
+ */
+
+#ifndef __IMPORT__
+#define __IMPORT__
+
+#include <stdbool.h>
+
+// Files smaller than this are parsed in a single chunk
+#define IMPORT_MIN_CHUNK 65536
+
+// Chunks handed to each pool thread, to even out uneven rows
+#define IMPORT_CHUNKS_PER_THREAD 4
+
+// Copies the CSV file into the sheet with its first field at (row, col), 0-based
+bool import_csv(const char *path, int row, int col);
+
+#endif
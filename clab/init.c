@@ -3,11 +3,18 @@
 #include <string.h>
 #include <time.h>   
 #include <unistd.h>   
+#include <limits.h>
 #include "init.h"
 #include "display.h"
 #include "io.h"
 #include "process.h"
 #include "dependent.h"
+#include "pool.h"
+#include "storage.h"
+#include "timer.h"
+#include "batch.h"
+#include "journal.h"
+#include "snapshot.h"
 #include <stdbool.h>
 
  int MAXROW;
@@ -18,20 +25,124 @@ int** sheet;
 // Make status variable global and accessible from other files
 char status[20] = "ok";
 
+// Frame held back by render_sheet() while more commands were queued
+static bool frame_pending = false;
+
+/**
+ * Redraws the sheet after a command
+ * If more input is already queued (a piped script) the frame is held back,
+ * so a burst of commands is rendered once, when the queue drains
+ */
+static void render_sheet() {
+    if (input_queued()) {
+        frame_pending = true;
+        return;
+    }
+    frame_pending = false;
+    display_sheet();
+}
+
+/**
+ * Draws the frame held back by render_sheet(), if any, followed by the
+ * last prompt, so the screen ends as if every frame had been drawn
+ */
+static void flush_frame(const char *prompt) {
+    if (frame_pending) {
+        frame_pending = false;
+        display_sheet();
+        if (output_enabled) {
+            fputs(prompt, stdout);
+            fflush(stdout);
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
-    // Check for correct number of arguments
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <number of rows> <number of columns>\n", argv[0]);
+    // Parse options that precede the sheet dimensions
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *batch_script = NULL;
+    const char *batch_cells = NULL;
+    const char *open_file = NULL;
+    const char *journal_file = NULL;
+    bool fsync_valid = true;
+    int arg = 1;
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            threads = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "--parallel-min") == 0 && arg + 1 < argc) {
+            parallel_min_cells = atol(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc) {
+            batch_script = argv[arg + 1];
+        } else if (strcmp(argv[arg], "--cells") == 0 && arg + 1 < argc) {
+            batch_cells = argv[arg + 1];
+        } else if (strcmp(argv[arg], "--export") == 0 && arg + 1 < argc) {
+            batch_export = argv[arg + 1];
+        } else if (strcmp(argv[arg], "--formulas") == 0) {
+            batch_formulas = true;
+            arg += 1;
+            continue;
+        } else if (strcmp(argv[arg], "--journal") == 0 && arg + 1 < argc) {
+            journal_file = argv[arg + 1];
+        } else if (strcmp(argv[arg], "--fsync") == 0 && arg + 1 < argc) {
+            // "always", "batch", or an interval in milliseconds
+            if (strcmp(argv[arg + 1], "always") == 0) {
+                journal_policy = JOURNAL_SYNC_ALWAYS;
+            } else if (strcmp(argv[arg + 1], "batch") == 0) {
+                journal_policy = JOURNAL_SYNC_BATCH;
+            } else {
+                journal_policy = JOURNAL_SYNC_INTERVAL;
+                journal_interval_ms = atol(argv[arg + 1]);
+                fsync_valid = journal_interval_ms > 0;
+            }
+        } else if (strcmp(argv[arg], "--backing") == 0 && arg + 1 < argc) {
+            sheet_backing = argv[arg + 1];
+        } else if (strcmp(argv[arg], "--backing-index") == 0) {
+            sheet_backing_index = true;
+            arg += 1;
+            continue;
+        } else if (strcmp(argv[arg], "--open") == 0 && arg + 1 < argc) {
+            open_file = argv[arg + 1];
+        } else if (strcmp(argv[arg], "--virtual-clock") == 0) {
+            virtual_clock = true;
+            arg += 1;
+            continue;
+        } else {
+            break;
+        }
+        arg += 2;
+    }
+
+    // Check for correct number of arguments (a snapshot brings its own size)
+    bool sized_by_file = open_file != NULL && argc == arg;
+    if ((argc - arg != 2 && !sized_by_file) || threads < 1 || parallel_min_cells < 1 ||
+        ((batch_cells != NULL || batch_export != NULL || batch_formulas) && batch_script == NULL) ||
+        (journal_file != NULL && batch_script != NULL) || !fsync_valid ||
+        (sheet_backing_index && sheet_backing == NULL)) {
+        fprintf(stderr, "Usage: %s [--threads N] [--parallel-min CELLS] [--virtual-clock] [--batch SCRIPT [--cells LIST] [--export FILE] [--formulas]] [--open FILE] [--journal FILE [--fsync always|batch|MS]] [--backing FILE [--backing-index]] <number of rows> <number of columns>\n", argv[0]);
         return 1;
     }
 
     // Parse command line arguments for display size
-    int input_rows = atoi(argv[1]);
-    int input_cols = atoi(argv[2]);
+    int input_rows, input_cols;
+    if (sized_by_file) {
+        if (!snapshot_dimensions(open_file, &input_rows, &input_cols)) {
+            fprintf(stderr, "Cannot open %s: not a spreadsheet snapshot\n", open_file);
+            return 1;
+        }
+    } else {
+        input_rows = atoi(argv[arg]);
+        input_cols = atoi(argv[arg + 1]);
+    }
 
-    // Validate the parsed integers
-    if (input_rows <= 0 || input_rows > 999 || input_cols <= 0 || input_cols > 18278) {
-        fprintf(stderr, "Invalid dimensions. Please enter values from 1 to %d for rows and 1 to %d for columns.\n", 999, 18278);
+    // Validate the parsed integers (a backed grid may have more rows, as
+    // long as cell counts still fit an int)
+    int max_rows = sheet_backing != NULL ? BACKED_MAX_ROWS : 999;
+    if (input_rows <= 0 || input_rows > max_rows || input_cols <= 0 || input_cols > 18278) {
+        fprintf(stderr, "Invalid dimensions. Please enter values from 1 to %d for rows and 1 to %d for columns.\n", max_rows, 18278);
+        return 1;
+    }
+    if ((long long)input_rows * input_cols > INT_MAX) {
+        fprintf(stderr, "Invalid dimensions. A sheet may have at most %d cells.\n", INT_MAX);
         return 1;
     }
 
@@ -39,51 +150,108 @@ int main(int argc, char *argv[]) {
     MAXROW = input_rows;
     MAXCOL = input_cols;
 
-    // Allocate memory for row pointers
-    sheet = (int **)malloc(MAXROW * sizeof(int *));
-    if (sheet == NULL) {
-        printf("Memory allocation failed!\n");
+    // Allocate the grid with every cell initialized to 0
+    if (!sheet_alloc()) {
+        if (sheet_backing != NULL) {
+            perror(sheet_backing);
+        } else {
+            printf("Memory allocation failed!\n");
+        }
         return 1;
     }
+    make_parent_list();
+    make_child_list();
+    pool_init(threads);
 
-    // Allocate memory for each row
-    for (int i = 0; i < MAXROW; i++) {
-        sheet[i] = (int *)malloc(MAXCOL * sizeof(int));
-        if (sheet[i] == NULL) {
-            printf("Memory allocation failed!\n");
-            // Free previously allocated memory
-            for (int j = 0; j < i; j++) {
-                free(sheet[j]);
-            }
-            free(sheet);
-            return 1;
-        }
+    // Start from a saved sheet
+    if (open_file != NULL && !snapshot_load(open_file)) {
+        fprintf(stderr, "Cannot open %s: not a snapshot of a %dx%d sheet\n", open_file, MAXROW, MAXCOL);
+        free_parent_list();
+        free_child_list();
+        sheet_free();
+        pool_shutdown();
+        return 1;
     }
 
-    // Initialize all elements to 0
-    for (int i = 0; i < MAXROW; i++) {
-        for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
-        }
+    // Headless run: apply the script and print only the final values
+    if (batch_script != NULL) {
+        setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+        int code = run_batch(batch_script, batch_cells, stdout);
+        snapshot_bgsave_poll(true);  // Let a background save finish
+        free_parent_list();
+        free_child_list();
+        sheet_free();
+        pool_shutdown();
+        timer_clear();
+        return code;
     }
-    make_parent_list();
-    make_child_list();
+
+    // Bring the sheet back to where the journal left off
+    if (journal_file != NULL && !journal_open(journal_file)) {
+        fprintf(stderr, "Cannot open journal %s: not a journal of a %dx%d sheet, or a file it loads has changed\n",
+                journal_file, MAXROW, MAXCOL);
+        free_parent_list();
+        free_child_list();
+        sheet_free();
+        pool_shutdown();
+        timer_clear();
+        return 1;
+    }
+
+    // SLEEP cells complete in the background while the prompt stays live.
+    // On the virtual clock SLEEP completes at once, as if it had blocked
+    sleep_async = !virtual_clock;
 
     // Display initial empty sheet
+    display_init_terminal();
     display_sheet();
 
     // Variables for input, execution time, and command processing
-    char input[MAX_INPUT_LEN];
+    char *input;
+    char prompt[64];
     double execution_time = 0.0;
     ParsedCommand result;
-    time_t start, end;  // Changed to time_t for wall clock time
+    long long start, end;  // Clock time in milliseconds (simulated with --virtual-clock)
 
     while (1) {
+        // Complete SLEEP cells whose deadline has already passed
+        timer_expire();
+
         // Print prompt with current status
-        printf("[%.1f] (%s) > ", execution_time, status);
+        snprintf(prompt, sizeof(prompt), "[%.1f] (%s) > ", execution_time, status);
+        fputs(prompt, stdout);
+        fflush(stdout);
+
+        // While waiting for input, fire timers as they come due and redraw
+        // (lines already buffered are not visible to poll(), so check them first)
+        while (timer_count() > 0 && !input_ready() && !timer_wait_input(STDIN_FILENO)) {
+            if (timer_expire() > 0 && output_enabled) {
+                printf("\n");
+                display_sheet();
+                printf("[%.1f] (%s) > ", execution_time, status);
+                fflush(stdout);
+            }
+        }
 
-        // Get user input
-        input_reader(input);
+        // Commit the journal before waiting for the next batch of input
+        if (!input_ready()) {
+            journal_commit();
+        }
+
+        // Get user input; the end of input acts as quit
+        input = input_next_line();
+        if (input == NULL) {
+            // Let pending SLEEP cells finish, as they would have if the
+            // input had kept coming, and show their values in the last frame
+            bool fired = false;
+            while (timer_count() > 0) {
+                timer_wait_input(-1);
+                if (timer_expire() > 0) fired = true;
+            }
+            if (fired) frame_pending = true;
+            flush_frame(prompt);
+            break;
+        }
         input_parser(input, &result);
 
         // Reset status to "ok" at the beginning of each command cycle
@@ -92,26 +260,30 @@ int main(int argc, char *argv[]) {
 
         // Check for quit command
         if (strcmp(input, "q") == 0) {
+            flush_frame(prompt);
             break;
         }
 
         // Process the input with timing
-        start = time(NULL);  // Start timing
+        start = timer_now();  // Start timing
         
         // Handle control commands (disable_output, enable_output)
         if (result.type == CMD_CONTROL) {
             strcpy(status, "ok");  // Set status to "ok" for control commands
+
+            // Show the last frame before output is switched on or off
+            flush_frame(prompt);
             
             // Process the command
             process_command(&result);
             
-            end = time(NULL);
-            execution_time = difftime(end, start);
+            end = timer_now();
+            execution_time = (end - start) / 1000.0;
             
             // Special handling for enable_output command
             if (strcmp(result.control_cmd, "enable_output") == 0) {
                 if (!was_disabled) {  // If output wasn't previously disabled
-                    display_sheet();
+                    render_sheet();
                 }
                 was_disabled = false;  // Reset the flag
             }
@@ -119,15 +291,21 @@ int main(int argc, char *argv[]) {
             continue;
         }
         
-        // Reset status for valid scroll commands
-        if (result.type == CMD_SCROLL_DIR || result.type == CMD_SCROLL) {
+        // Reset status for valid scroll, viewport, file and sleep commands
+        if (result.type == CMD_SCROLL_DIR || result.type == CMD_SCROLL || result.type == CMD_VIEWPORT ||
+            result.type == CMD_FILE || is_sleep_command(&result)) {
             strcpy(status, "ok");
             process_command(&result);
-            end = time(NULL);
-            execution_time = difftime(end, start);
+            // Loading and importing change the sheet, so they are journaled
+            if (result.type == CMD_FILE && strcmp(status, "ok") == 0 &&
+                (strcmp(result.control_cmd, "load") == 0 || strcmp(result.control_cmd, "import") == 0)) {
+                journal_append_file(input, result.expression);
+            }
+            end = timer_now();
+            execution_time = (end - start) / 1000.0;
             // Display sheet after scroll commands if output is enabled
             if (output_enabled) {
-                display_sheet();
+                render_sheet();
             }
             continue;
         }
@@ -139,7 +317,7 @@ int main(int argc, char *argv[]) {
             execution_time = 0.0;
             // Display sheet even for unrecognized commands
             if (output_enabled) {
-                display_sheet();
+                render_sheet();
             }
             continue;
         }
@@ -151,7 +329,7 @@ int main(int argc, char *argv[]) {
                 execution_time = 0.0;
                 // Display sheet even for invalid ranges
                 if (output_enabled) {
-                    display_sheet();
+                    render_sheet();
                 }
                 continue;
             }
@@ -160,6 +338,9 @@ int main(int argc, char *argv[]) {
         // Process command
         bool dpcorrect = handle_dependencies(&result);
         if(dpcorrect) {
+            // Record the command once it has been applied, so a command that
+            // fails midway never reaches the journal
+            journal_append(input);
             // Only show topology for non-sleep functions
             if (result.func != FUNC_SLEEP) {
                 topo_sort(result.op1.row-1, result.op1.col-1, &result);
@@ -170,8 +351,8 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        end = time(NULL);  // End timing
-        execution_time = difftime(end, start);  // Get difference in seconds
+        end = timer_now();  // End timing
+        execution_time = (end - start) / 1000.0;  // Get difference in seconds
 
         // Process other commands and display sheet if output is enabled
         // Skip processing if it's already been handled by handle_dependencies
@@ -180,16 +361,17 @@ int main(int argc, char *argv[]) {
         }
         
         if (output_enabled) {
-            display_sheet();
+            render_sheet();
         }
     }
 
-    // Free allocated memory
-    for (int i = 0; i < MAXROW; i++) {
-        free(sheet[i]); // Free each row
-    }
-    free(sheet); // Free the row pointers
+    // Let a background save finish, then free allocated memory
+    snapshot_bgsave_poll(true);
+    journal_close();
     free_parent_list();
     free_child_list();
+    sheet_free();
+    pool_shutdown();
+    timer_clear();
     return 0;
 }
\ No newline at end of file
@@ -7,7 +7,8 @@
 #ifndef __INIT__
 #define __INIT__
 
-// Maximum number of rows in the spreadsheet (1-999)
+// Maximum number of rows in the spreadsheet (1-999, up to BACKED_MAX_ROWS
+// when the grid lives in a backing file)
 extern int MAXROW;
 
 // Maximum number of columns in the spreadsheet (A-ZZZ, converts to 18278)
@@ -19,10 +20,27 @@ extern int MAXCOL;
 // Special value to represent calculation errors or invalid operations
 #define ERROR_VALUE -999999
 
+// Cell arithmetic: wraps around on overflow instead of being undefined,
+// and INT_MIN / -1 wraps to INT_MIN instead of trapping (divisors of zero
+// are checked by the caller)
+#define WRAP_ADD(x, y) ((int)((unsigned int)(x) + (unsigned int)(y)))
+#define WRAP_SUB(x, y) ((int)((unsigned int)(x) - (unsigned int)(y)))
+#define WRAP_MUL(x, y) ((int)((unsigned int)(x) * (unsigned int)(y)))
+#define WRAP_NEG(x) ((int)(0u - (unsigned int)(x)))
+#define WRAP_DIV(x, y) ((y) == -1 ? WRAP_NEG(x) : (x) / (y))
+
 // Global 2D array representing the spreadsheet
 // Each cell contains an integer value
 extern int** sheet;
 
+// Access to cell (r, c), 0-based, in the compiled storage layout
+// Row-major by default; built with LAYOUT=colmajor each column is contiguous
+#ifdef SHEET_COLUMN_MAJOR
+#define CELL(r, c) (sheet[(c)][(r)])
+#else
+#define CELL(r, c) (sheet[(r)][(c)])
+#endif
+
 // Global status variable
 extern char status[20];
 
@@ -4,9 +4,15 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
 #include "io.h"
 #include "init.h"
 #include "display.h"
+#include "formula.h"
+#include "label.h"
 
 // Global flags for output control and viewport position
 bool output_enabled = true;
@@ -22,20 +28,117 @@ void set_test_mode(bool mode) {
 }
 
 /**
- * Removes leading and trailing whitespace from a string
- * @param str Input string to trim
- * @return Pointer to the trimmed string
+ * Checks whether a character is one of the arithmetic operators
  */
-static char* trim_whitespace(char *str) {
-    char *end;
-    // Skip leading whitespace
-    while(isspace((unsigned char)*str)) str++;
-    if(*str == 0) return str;
-    // Find end of string and move backwards past whitespace
-    end = str + strlen(str) - 1;
-    while(end > str && isspace((unsigned char)*end)) end--;
-    *(end+1) = 0;
-    return str;
+static inline bool is_operator(char c) {
+    return c == '+' || c == '-' || c == '*' || c == '/';
+}
+
+/**
+ * Narrows [*start, *end) to exclude leading and trailing whitespace
+ */
+static void trim_span(const char **start, const char **end) {
+    while(*start < *end && isspace((unsigned char)**start)) (*start)++;
+    while(*end > *start && isspace((unsigned char)*(*end - 1))) (*end)--;
+}
+
+/**
+ * Checks whether [start, end) is exactly the given word
+ */
+static bool span_equals(const char *start, const char *end, const char *word) {
+    size_t len = strlen(word);
+    return (size_t)(end - start) == len && memcmp(start, word, len) == 0;
+}
+
+/**
+ * Copies [start, end) into a fixed-size field, truncating like strncpy
+ */
+static void copy_span(char *dst, size_t size, const char *start, const char *end) {
+    size_t len = end - start;
+    if(len > size - 1) len = size - 1;
+    memcpy(dst, start, len);
+    dst[len] = '\0';
+}
+
+/**
+ * Reads an integer the way atoi does (leading spaces, sign, digits),
+ * without needing the span to be terminated
+ */
+static int span_atoi(const char *start, const char *end) {
+    const char *p = start;
+    while(p < end && isspace((unsigned char)*p)) p++;
+    bool negative = false;
+    if(p < end && (*p == '+' || *p == '-')) negative = *p++ == '-';
+    long value = 0;
+    while(p < end && isdigit((unsigned char)*p)) {
+        if(value < INT_MAX) value = value * 10 + (*p - '0');
+        p++;
+    }
+    if(value > INT_MAX) value = INT_MAX;
+    return (int)(negative ? -value : value);
+}
+
+/**
+ * Checks whether all of [start, end) is an integer (as strtol would accept it)
+ * @param value Pointer to store the integer
+ */
+static bool span_number(const char *start, const char *end, int *value) {
+    if(start == end) {
+        *value = 0;
+        return true;
+    }
+    const char *p = start;
+    while(p < end && isspace((unsigned char)*p)) p++;
+    if(p < end && (*p == '+' || *p == '-')) p++;
+    const char *digits = p;
+    while(p < end && isdigit((unsigned char)*p)) p++;
+    if(p == digits || p != end) return false;
+    *value = span_atoi(start, end);
+    return true;
+}
+
+/**
+ * Validates a cell reference in [start, end) and converts it in the same pass
+ * The reference is 1-3 column letters followed by a row number within the sheet
+ * @param row Pointer to store row number (may be NULL)
+ * @param col Pointer to store column number (may be NULL)
+ * @return true if valid, false otherwise
+ */
+static bool parse_cell(const char *start, const char *end, int *row, int *col) {
+    long len = end - start;
+    if(len < 2 || len > MAX_CELL_LEN - 1) return false;
+
+    // Column letters
+    const char *p;
+    int c = column_number(start, end, &p);
+    if(c == 0) return false;
+
+    // Row number
+    int r = span_atoi(p, end);
+    if(r < 1 || r > MAXROW || c > MAXCOL) return false;
+
+    if(row) *row = r;
+    if(col) *col = c;
+    return true;
+}
+
+/**
+ * Validates a range reference in [start, end) such as "A1:B2"
+ * @param op2 Operand to store the top-left cell (may be NULL)
+ * @param op3 Operand to store the bottom-right cell (may be NULL)
+ * @return true if valid, false otherwise
+ */
+static bool parse_range(const char *start, const char *end, Operand *op2, Operand *op3) {
+    const char *colon = memchr(start, ':', end - start);
+    if(!colon || colon == start || colon == end - 1) return false;
+
+    int r1, c1, r2, c2;
+    if(!parse_cell(start, colon, &r1, &c1) || !parse_cell(colon + 1, end, &r2, &c2)) {
+        return false;
+    }
+    if(op2) { op2->row = r1; op2->col = c1; }
+    if(op3) { op3->row = r2; op3->col = c2; }
+    return true;
 }
 
 /**
@@ -44,19 +147,7 @@ static char* trim_whitespace(char *str) {
  * @return true if valid, false otherwise
  */
 bool validate_cell(const char *cell) {
-    int len = strlen(cell);
-    if(len < 2 || len > 6) return false;
-    
-    // Find position where letters end and numbers begin
-    int split_pos = 0;
-    while(isalpha(cell[split_pos])) split_pos++;
-    if(split_pos == 0 || split_pos > 3) return false;
-    
-    // Validate row number
-    char row_str[4];
-    strncpy(row_str, cell + split_pos, 3);
-    int row = atoi(row_str);
-    return row >= 1 && row <= MAXROW;
+    return parse_cell(cell, cell + strlen(cell), NULL, NULL);
 }
 
 /**
@@ -65,16 +156,31 @@ bool validate_cell(const char *cell) {
  * @return true if valid, false otherwise
  */
 bool validate_range(const char *range) {
-    char *colon = strchr(range, ':');
-    if(!colon || colon == range || colon == range + strlen(range) - 1) return false;
-    
-    // Split range into start and end cells
-    char start[MAX_CELL_LEN], end[MAX_CELL_LEN];
-    strncpy(start, range, colon - range);
-    start[colon - range] = '\0';
-    strcpy(end, colon + 1);
-    
-    return validate_cell(start) && validate_cell(end);
+    return parse_range(range, range + strlen(range), NULL, NULL);
+}
+
+/**
+ * Supported functions and their types
+ */
+static const struct {
+    const char *name;
+    FunctionType func;
+} functions[] = {
+    {"MIN", FUNC_MIN}, {"MAX", FUNC_MAX}, {"AVG", FUNC_AVG}, {"SUM", FUNC_SUM},
+    {"STDEV", FUNC_STDEV}, {"SLEEP", FUNC_SLEEP}, {"MEDIAN", FUNC_MEDIAN},
+    {"PERCENTILE", FUNC_PERCENTILE}, {"RANK", FUNC_RANK},
+    {"COUNTIF", FUNC_COUNTIF}, {"SUMIF", FUNC_SUMIF}
+};
+
+/**
+ * Looks up the function named by [start, end)
+ * @return The function type, or FUNC_NONE if unsupported
+ */
+static FunctionType lookup_function(const char *start, const char *end) {
+    for(size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if(span_equals(start, end, functions[i].name)) return functions[i].func;
+    }
+    return FUNC_NONE;
 }
 
 /**
@@ -83,11 +189,28 @@ bool validate_range(const char *range) {
  * @return true if valid, false otherwise
  */
 bool validate_function(const char *func) {
-    const char *valid_funcs[] = {"MIN", "MAX", "AVG", "SUM", "STDEV", "SLEEP"};
-    for(int i = 0; i < 6; i++) {
-        if(strcmp(func, valid_funcs[i]) == 0) return true;
-    }
-    return false;
+    return lookup_function(func, func + strlen(func)) != FUNC_NONE;
+}
+
+/**
+ * Parses a condition such as ">100", "<=5", "<>0" or "7" (equality)
+ * @param start Start of the condition
+ * @param end End of the condition
+ * @param predicate Pointer to store the comparison
+ * @param value Pointer to store the value compared against
+ * @return true if valid, false otherwise
+ */
+static bool parse_predicate(const char *start, const char *end, PredicateType *predicate, int *value) {
+    const char *p = start;
+    if(end - p >= 2 && p[0] == '<' && p[1] == '=') { *predicate = PRED_LE; p += 2; }
+    else if(end - p >= 2 && p[0] == '>' && p[1] == '=') { *predicate = PRED_GE; p += 2; }
+    else if(end - p >= 2 && p[0] == '<' && p[1] == '>') { *predicate = PRED_NE; p += 2; }
+    else if(p < end && *p == '<') { *predicate = PRED_LT; p++; }
+    else if(p < end && *p == '>') { *predicate = PRED_GT; p++; }
+    else if(p < end && *p == '=') { *predicate = PRED_EQ; p++; }
+    else { *predicate = PRED_EQ; }
+
+    return p < end && span_number(p, end, value);
 }
 
 /**
@@ -97,39 +220,282 @@ bool validate_function(const char *func) {
  * @param col Pointer to store column number
  */
 void cell_to_rc(const char *cell, int *row, int *col) {
-    int c = 0, r = 0, i = 0;
+    const char *end = cell + strlen(cell);
+    const char *digits;
     // Convert column letters to number
-    while(isalpha(cell[i])) {
-        c = c * 26 + (toupper(cell[i]) - 'A' + 1);
-        i++;
-    }
+    *col = column_number(cell, end, &digits);
     // Convert row string to number
-    r = atoi(cell + i);
-    *col = c;
-    *row = r;
+    *row = span_atoi(digits, end);
+}
+
+// Standard input is read in large chunks and split into lines in place
+static char input_buffer[INPUT_BUFFER_SIZE];
+static size_t input_start = 0;      // First byte not handed out yet
+static size_t input_end = 0;        // End of the bytes read so far
+static bool input_eof = false;      // read() reported end of input
+static bool input_skipping = false; // Dropping the rest of an over-long line
+static char long_line[MAX_INPUT_LEN];
+
+/**
+ * Reads more of stdin into the buffer, after the unread bytes
+ * @return false at end of input
+ */
+static bool fill_input() {
+    if (input_eof) return false;
+
+    // Only a partial line (shorter than MAX_INPUT_LEN) is ever moved
+    size_t unread = input_end - input_start;
+    memmove(input_buffer, input_buffer + input_start, unread);
+    input_start = 0;
+    input_end = unread;
+
+    while (true) {
+        ssize_t count = read(STDIN_FILENO, input_buffer + input_end, INPUT_BUFFER_SIZE - 1 - input_end);
+        if (count > 0) {
+            input_end += (size_t)count;
+            return true;
+        }
+        if (count < 0 && errno == EINTR) continue;
+        input_eof = true;
+        return false;
+    }
+}
+
+/**
+ * Returns the next line of stdin, without its newline
+ * - The line is terminated in place inside the input buffer and stays
+ *   valid until the next call
+ * - Lines longer than MAX_INPUT_LEN - 1 characters are cut there and the
+ *   rest of the line is discarded
+ * @return The line, or NULL at end of input
+ */
+char *input_next_line() {
+    while (true) {
+        char *line = input_buffer + input_start;
+        size_t unread = input_end - input_start;
+        char *newline = (char *)memchr(line, '\n', unread);
+
+        if (input_skipping) {
+            if (newline != NULL) {
+                input_start += (size_t)(newline - line) + 1;
+                input_skipping = false;
+            } else {
+                input_start = input_end;
+                if (!fill_input()) return NULL;
+            }
+            continue;
+        }
+
+        if (newline != NULL && newline - line <= MAX_INPUT_LEN - 1) {
+            *newline = '\0';
+            input_start += (size_t)(newline - line) + 1;
+            return line;
+        }
+
+        if (unread >= MAX_INPUT_LEN - 1) {
+            // Over-long line: keep its start and drop the rest
+            memcpy(long_line, line, MAX_INPUT_LEN - 1);
+            long_line[MAX_INPUT_LEN - 1] = '\0';
+            input_start += MAX_INPUT_LEN - 1;
+            input_skipping = true;
+            return long_line;
+        }
+
+        if (!fill_input()) {
+            // Last line without a newline (there is room after it)
+            if (input_start == input_end) return NULL;
+            line = input_buffer + input_start;
+            input_buffer[input_end] = '\0';
+            input_start = input_end;
+            return line;
+        }
+    }
+}
+
+/**
+ * Checks if a whole line can be read without waiting
+ */
+bool input_ready() {
+    if (input_eof) return true;
+    char *line = input_buffer + input_start;
+    size_t unread = input_end - input_start;
+    return unread >= MAX_INPUT_LEN - 1 || memchr(line, '\n', unread) != NULL;
+}
+
+/**
+ * Checks if more input has already arrived, buffered or not yet read
+ */
+bool input_queued() {
+    if (input_start != input_end || input_ready()) return true;
+    struct pollfd request;
+    request.fd = STDIN_FILENO;
+    request.events = POLLIN;
+    request.revents = 0;
+    return poll(&request, 1, 0) > 0;
 }
 
 /**
  * Reads user input from stdin
- * @param inp Buffer to store input
+ * @param inp Buffer to store input (empty at end of input)
  */
 void input_reader(char *inp) {
-    memset(inp, 0, MAX_INPUT_LEN);
-    if(!fgets(inp, MAX_INPUT_LEN, stdin)) {
+    char *line = input_next_line();
+    if (line == NULL) {
         inp[0] = '\0';
         return;
     }
-    inp[strcspn(inp, "\n")] = '\0';
-    
-    // Clear input buffer if line too long
-    if(strlen(inp) == MAX_INPUT_LEN - 1) {
-        int c;
-        while((c = getchar()) != '\n' && c != EOF);
+    strcpy(inp, line);
+}
+
+/**
+ * Parses the function call of a formula, e.g. SUM(A1:B2) or COUNTIF(A1:A9,>5)
+ * @param expr Start of the formula
+ * @param open Position of the first '('
+ * @param close Position of the first ')'
+ * @param result Command being filled
+ * @return false if the command is invalid and parsing must stop
+ */
+static bool parse_function(const char *expr, const char *open, const char *close, ParsedCommand *result) {
+    FunctionType func = lookup_function(expr, open);
+    if(func == FUNC_NONE) {
+        result->error_code = 1; // Invalid function
+        return true;
+    }
+    result->type = CMD_FUNCTION;
+    result->func = func;
+
+    if(func == FUNC_SLEEP) {
+        // Sleep argument is a cell or a value
+        if(!parse_cell(open + 1, close, &result->op2.row, &result->op2.col)) {
+            result->op2.value = span_atoi(open + 1, close);
+        }
+        return true;
+    }
+
+    // PERCENTILE(range,p) and RANK(range,value) take an integer after the range,
+    // COUNTIF(range,cond) and SUMIF(range,cond) a condition such as >100
+    const char *range_end = close;
+    bool conditional = func == FUNC_COUNTIF || func == FUNC_SUMIF;
+    if(func == FUNC_PERCENTILE || func == FUNC_RANK || conditional) {
+        const char *comma = memchr(open + 1, ',', close - open - 1);
+        if(comma == NULL || close - comma - 1 >= MAX_ARG_LEN) {
+            result->type = CMD_INVALID;
+            return false;
+        }
+        const char *arg = comma + 1, *arg_end = close;
+        trim_span(&arg, &arg_end);
+        bool valid = conditional
+            ? parse_predicate(arg, arg_end, &result->predicate, &result->func_arg)
+            : arg < arg_end && span_number(arg, arg_end, &result->func_arg);
+        if(!valid) {
+            result->type = CMD_INVALID;
+            return false;
+        }
+        range_end = comma;
+    }
+
+    copy_span(result->range, sizeof(result->range), open + 1, range_end);
+    if(!parse_range(open + 1, range_end, &result->op2, &result->op3)) {
+        result->error_code = 2; // Invalid range
+    }
+    return true;
+}
+
+/**
+ * Parses an arithmetic formula such as A1+B1, or a plain value or reference
+ * @param expr Start of the formula
+ * @param end End of the formula
+ * @param result Command being filled
+ * @return false if the command is invalid and parsing must stop
+ */
+static bool parse_arithmetic(const char *expr, const char *end, ParsedCommand *result) {
+    // First operand runs up to the operator
+    const char *op = expr;
+    while(op < end && !is_operator(*op)) op++;
+
+    // Second operand is the next word after the operator
+    const char *rhs = op + 1;
+    while(rhs < end && isspace((unsigned char)*rhs)) rhs++;
+    const char *rhs_end = rhs;
+    while(rhs_end < end && !isspace((unsigned char)*rhs_end)) rhs_end++;
+
+    if(op > expr && op < end) result->operator = *op;
+
+    if(op == expr || op == end || rhs == rhs_end) {
+        // Handle simple cell assignment
+        result->type = CMD_SET_CELL;
+        if(!parse_cell(expr, end, &result->op2.row, &result->op2.col)) {
+            result->op2.value = span_atoi(expr, end);
+        }
+        return true;
+    }
+
+    // Each operand is a cell or an integer
+    Operand lhs_operand = {0, 0, 0}, rhs_operand = {0, 0, 0};
+    if((!parse_cell(expr, op, &lhs_operand.row, &lhs_operand.col) &&
+        !span_number(expr, op, &lhs_operand.value)) ||
+       (!parse_cell(rhs, rhs_end, &rhs_operand.row, &rhs_operand.col) &&
+        !span_number(rhs, rhs_end, &rhs_operand.value))) {
+        return false;
+    }
+    result->type = CMD_ARITHMETIC;
+    result->op2 = lhs_operand;
+    result->op3 = rhs_operand;
+    return true;
+}
+
+/**
+ * Checks whether [start, end) is exactly one integer or one cell reference
+ * (surrounding whitespace allowed)
+ */
+static bool is_plain_operand(const char *start, const char *end) {
+    trim_span(&start, &end);
+    const char *p = start;
+    if(p < end && (*p == '+' || *p == '-')) {
+        p++;
+    } else {
+        while(p < end && isalpha((unsigned char)*p)) p++;
+    }
+    const char *digits = p;
+    while(p < end && isdigit((unsigned char)*p)) p++;
+    return p > digits && p == end;
+}
+
+/**
+ * Checks whether a parsed formula is one of the simple forms that cover
+ * the whole text: a value or reference, a single binary operation, or a
+ * single function call over a range (MIN(A1,3) is left to the compiler)
+ * @param valid Whether the simple parse succeeded
+ * @param close Position of the first ')' (NULL if none)
+ */
+static bool is_simple_formula(const ParsedCommand *result, bool valid,
+                              const char *expr, const char *end, const char *close) {
+    if(!valid) return false;
+    switch(result->type) {
+        case CMD_SET_CELL:
+            return expr == end || is_plain_operand(expr, end);
+        case CMD_ARITHMETIC: {
+            const char *op = expr;
+            while(op < end && !is_operator(*op)) op++;
+            return is_plain_operand(expr, op) && is_plain_operand(op + 1, end);
+        }
+        case CMD_FUNCTION:
+            // A list of values instead of a range for MIN, MAX, SUM, AVG or STDEV
+            if(result->error_code == 2 && result->func >= FUNC_MIN && result->func <= FUNC_STDEV &&
+               strchr(result->range, ':') == NULL) {
+                return false;
+            }
+            return close == end - 1;
+        default:
+            return false;
     }
 }
 
 /**
  * Parses input string into a ParsedCommand structure
+ * The line is scanned once in place: cell references and integers are
+ * converted as they are read, and only the short text fields of the
+ * result are copied out of the buffer
  * @param inp Input string to parse
  * @param result Pointer to ParsedCommand structure to fill
  */
@@ -137,166 +503,183 @@ void input_parser(char *inp, ParsedCommand *result) {
     // Initialize result structure
     memset(result, 0, sizeof(ParsedCommand));
     result->type = CMD_INVALID;
-    result->error_code = 0;
-    result->operator = '\0';
-    
-    char *trimmed = trim_whitespace(inp);
-    if(strlen(trimmed) == 0) return;
 
-    strncpy(result->command, trimmed, MAX_EXPR_LEN - 1);
+    const char *start = inp;
+    const char *end = inp + strlen(inp);
+    trim_span(&start, &end);
+    inp[end - inp] = '\0';
+    if(start == end) return;
 
     // Handle control commands (q, disable_output, enable_output)
-    if(strcmp(trimmed, "q") == 0 ||
-       strcmp(trimmed, "disable_output") == 0 || 
-       strcmp(trimmed, "enable_output") == 0) {
+    if(span_equals(start, end, "q") ||
+       span_equals(start, end, "disable_output") ||
+       span_equals(start, end, "enable_output")) {
         result->type = CMD_CONTROL;
-        strncpy(result->control_cmd, trimmed, sizeof(result->control_cmd)-1);
+        copy_span(result->control_cmd, sizeof(result->control_cmd), start, end);
         return;
     }
 
     // Handle scroll_to command
-    if(strncmp(trimmed, "scroll_to ", 10) == 0) {
-        char *cell = trim_whitespace(trimmed + 10);
-        if(validate_cell(cell)) {
+    if(end - start >= 10 && memcmp(start, "scroll_to ", 10) == 0) {
+        const char *cell = start + 10, *cell_end = end;
+        trim_span(&cell, &cell_end);
+        if(parse_cell(cell, cell_end, &result->op1.row, &result->op1.col)) {
             result->type = CMD_SCROLL;
-            strncpy(result->scroll_target, cell, sizeof(result->scroll_target)-1);
-            cell_to_rc(cell, &result->op1.row, &result->op1.col);
+            copy_span(result->scroll_target, sizeof(result->scroll_target), cell, cell_end);
+        }
+        return;
+    }
+
+    // Handle file commands: "save FILE", "load FILE", "bgsave FILE" (the path
+    // goes in expression) and "bgsave_status"
+    if(span_equals(start, end, "bgsave_status")) {
+        result->type = CMD_FILE;
+        copy_span(result->control_cmd, sizeof(result->control_cmd), start, end);
+        return;
+    }
+    const char *verb_end = start;
+    while(verb_end < end && !isspace((unsigned char)*verb_end)) verb_end++;
+    if(span_equals(start, verb_end, "save") || span_equals(start, verb_end, "load") ||
+       span_equals(start, verb_end, "bgsave")) {
+        const char *path = verb_end, *path_end = end;
+        trim_span(&path, &path_end);
+        if(path < path_end && path_end - path < MAX_EXPR_LEN) {
+            result->type = CMD_FILE;
+            copy_span(result->control_cmd, sizeof(result->control_cmd), start, verb_end);
+            copy_span(result->expression, sizeof(result->expression), path, path_end);
+        }
+        return;
+    }
+
+    // Handle import command: "import FILE CELL" (the anchor cell goes in op1)
+    if(span_equals(start, verb_end, "import")) {
+        const char *path = verb_end, *cell_end = end;
+        trim_span(&path, &cell_end);
+        const char *cell = cell_end;
+        while(cell > path && !isspace((unsigned char)cell[-1])) cell--;
+        const char *path_end = cell;
+        trim_span(&path, &path_end);
+        if(path < path_end && path_end - path < MAX_EXPR_LEN &&
+           parse_cell(cell, cell_end, &result->op1.row, &result->op1.col)) {
+            result->type = CMD_FILE;
+            copy_span(result->control_cmd, sizeof(result->control_cmd), start, verb_end);
+            copy_span(result->expression, sizeof(result->expression), path, path_end);
+        }
+        return;
+    }
+
+    // Handle export commands: "export FILE [RANGE]", "export_formulas FILE [RANGE]"
+    // (the path goes in expression, the range in op2/op3)
+    if(span_equals(start, verb_end, "export") || span_equals(start, verb_end, "export_formulas")) {
+        const char *path = verb_end, *path_end = end;
+        trim_span(&path, &path_end);
+        const char *range = path_end;
+        while(range > path && !isspace((unsigned char)range[-1])) range--;
+        if(range > path && parse_range(range, path_end, &result->op2, &result->op3)) {
+            path_end = range;
+            trim_span(&path, &path_end);
+        }
+        if(path < path_end && path_end - path < MAX_EXPR_LEN) {
+            result->type = CMD_FILE;
+            copy_span(result->control_cmd, sizeof(result->control_cmd), start, verb_end);
+            copy_span(result->expression, sizeof(result->expression), path, path_end);
+        }
+        return;
+    }
+
+    // Handle viewport command: "viewport ROWS COLS" or "viewport auto"
+    if(end - start >= 9 && memcmp(start, "viewport ", 9) == 0) {
+        const char *args = start + 9, *args_end = end;
+        trim_span(&args, &args_end);
+        if(span_equals(args, args_end, "auto")) {
+            result->type = CMD_VIEWPORT;
+            return;
+        }
+        const char *space = args;
+        while(space < args_end && !isspace((unsigned char)*space)) space++;
+        const char *cols = space;
+        trim_span(&cols, &args_end);
+        int r, c;
+        if(space < args_end && span_number(args, space, &r) && span_number(cols, args_end, &c) &&
+           r >= 1 && r <= VIEWPORT_MAX && c >= 1 && c <= VIEWPORT_MAX) {
+            result->type = CMD_VIEWPORT;
+            result->op1.row = r;
+            result->op1.col = c;
         }
         return;
     }
 
     // Handle scroll commands (w,a,s,d)
-    if(strlen(trimmed) == 1 && strchr("wasd", tolower(*trimmed))) {
+    if(end - start == 1 && strchr("wasd", tolower((unsigned char)*start))) {
         result->type = CMD_SCROLL_DIR;
-        result->scroll_direction = tolower(*trimmed);
+        result->scroll_direction = tolower((unsigned char)*start);
         return;
     }
 
     // Handle cell assignments and functions
-    char *equals = strchr(trimmed, '=');
+    const char *equals = memchr(start, '=', end - start);
     if(equals) {
-        *equals = '\0';
-        char *cell_part = trim_whitespace(trimmed);
-        char *expr_part = trim_whitespace(equals + 1);
-        
-        if(validate_cell(cell_part)) {
-            strncpy(result->cell, cell_part, sizeof(result->cell)-1);
-            cell_to_rc(cell_part, &result->op1.row, &result->op1.col);
-            
-            // Parse functions (MIN, MAX, AVG, SUM, STDEV, SLEEP)
-            char *func_start = strchr(expr_part, '(');
-            char *func_end = strchr(expr_part, ')');
-            if(func_start && func_end) {
-                char func_name[10];
-                sscanf(expr_part, "%[^(]", func_name);
-                
-                if(validate_function(func_name)) {
-                    result->type = CMD_FUNCTION;
-                    if(strcmp(func_name, "SLEEP") == 0) {
-                        result->func = FUNC_SLEEP;
-                        // Parse sleep argument (cell or value)
-                        char arg[MAX_CELL_LEN];
-                        sscanf(func_start + 1, "%[^)]", arg);
-                        if (validate_cell(arg)) {
-                            cell_to_rc(arg, &result->op2.row, &result->op2.col);
-                            result->op2.value = 0;
-                        } else {
-                            result->op2.value = atoi(arg);
-                            result->op2.row = 0;
-                            result->op2.col = 0;
-                        }
-                        strncpy(result->expression, expr_part, sizeof(result->expression)-1);
-                    } else {
-                        // Handle other functions
-                        if(strcmp(func_name, "MIN") == 0) {
-                            result->func = FUNC_MIN;
-                        }
-                        else if(strcmp(func_name, "MAX") == 0) {
-                            result->func = FUNC_MAX;
-                        }
-                        else if(strcmp(func_name, "SUM") == 0) {
-                            result->func = FUNC_SUM;
-                        }
-                        else if(strcmp(func_name, "AVG") == 0) {
-                            result->func = FUNC_AVG;
-                        }
-                        else if(strcmp(func_name, "STDEV") == 0) {
-                            result->func = FUNC_STDEV;
-                        }
-                        
-                        // Parse range argument
-                        char *range_start = func_start + 1;
-                        char *range_end = func_end;
-                        strncpy(result->range, range_start, range_end - range_start);
-                        result->range[range_end - range_start] = '\0';
-                        
-                        if(validate_range(result->range)) {
-                            char start_cell[MAX_CELL_LEN], end_cell[MAX_CELL_LEN];
-                            sscanf(result->range, "%[^:]:%s", start_cell, end_cell);
-                            cell_to_rc(start_cell, &result->op2.row, &result->op2.col);
-                            cell_to_rc(end_cell, &result->op3.row, &result->op3.col);
-                        } else {
-                            result->error_code = 2; // Invalid range
-                        }
-                    }
-                } else {
-                    result->error_code = 1; // Invalid function
-                }
-            } else {
-                // Handle arithmetic expressions (e.g., A1+B1)
-                char op1[MAX_CELL_LEN], op2[MAX_CELL_LEN];
-                if(sscanf(expr_part, "%[^+-*/]%c%s", op1, &result->operator, op2) == 3) {
-                    result->type = CMD_ARITHMETIC;
-                    
-                    // Validate both operands
-                    bool op1_valid = validate_cell(op1) || is_number(op1);
-                    bool op2_valid = validate_cell(op2) || is_number(op2);
-                    
-                    if (!op1_valid || !op2_valid) {
-                        result->type = CMD_INVALID;
-                        return;
-                    }
+        const char *cell = start, *cell_end = equals;
+        const char *expr = equals + 1, *expr_end = end;
+        trim_span(&cell, &cell_end);
+        trim_span(&expr, &expr_end);
 
-                    if(validate_cell(op1)) {
-                        cell_to_rc(op1, &result->op2.row, &result->op2.col);
-                    } else {
-                        result->op2.value = atoi(op1);
-                    }
-                    if(validate_cell(op2)) {
-                        cell_to_rc(op2, &result->op3.row, &result->op3.col);
-                    } else {
-                        result->op3.value = atoi(op2);
+        if(!parse_cell(cell, cell_end, &result->op1.row, &result->op1.col)) return;
+        copy_span(result->cell, sizeof(result->cell), cell, cell_end);
+
+        // Parse functions (MIN, MAX, AVG, SUM, STDEV, SLEEP, MEDIAN, PERCENTILE, RANK, COUNTIF, SUMIF)
+        const char *open = memchr(expr, '(', expr_end - expr);
+        const char *close = memchr(expr, ')', expr_end - expr);
+        bool valid = (open && close)
+            ? parse_function(expr, open, close, result)
+            : parse_arithmetic(expr, expr_end, result);
+
+        // Anything beyond the single-operator and single-function forms is
+        // compiled as a general expression, or rejected if it is not one
+        if(!is_simple_formula(result, valid, expr, expr_end, close)) {
+            Program *program = formula_compile(expr, expr_end);
+            if(program) {
+                Operand target = result->op1;
+                memset(result, 0, sizeof(ParsedCommand));
+                result->op1 = target;
+                copy_span(result->cell, sizeof(result->cell), cell, cell_end);
+                if(formula_lower(program, result)) {
+                    // Folded down to an assignment or a single operator
+                    formula_free(program);
+                    if(result->type == CMD_SET_CELL && result->op2.row == 0) {
+                        // A constant is stored like a typed number
+                        snprintf(result->expression, sizeof(result->expression), "%d", result->op2.value);
+                        return;
                     }
                 } else {
-                    // Handle simple cell assignment
-                    result->type = CMD_SET_CELL;
-                    if(validate_cell(expr_part)) {
-                        cell_to_rc(expr_part, &result->op2.row, &result->op2.col);
-                    } else {
-                        result->op2.value = atoi(expr_part);
-                    }
+                    result->type = CMD_EXPRESSION;
+                    result->program = program;
                 }
+                valid = true;
+            } else {
+                // The simple parse covered only part of the text
+                result->type = CMD_INVALID;
+                valid = false;
             }
-            strncpy(result->expression, expr_part, sizeof(result->expression)-1);
+        }
+        if(valid) {
+            copy_span(result->expression, sizeof(result->expression), expr, expr_end);
         }
         return;
     }
 
     // Handle standalone SLEEP function
-    if(strncmp(trimmed, "SLEEP(", 6) == 0) {
+    if(end - start >= 6 && memcmp(start, "SLEEP(", 6) == 0) {
         result->type = CMD_FUNCTION;
         result->func = FUNC_SLEEP;
-        sscanf(trimmed, "SLEEP(%d)", &result->sleep_duration);
+        result->sleep_duration = span_atoi(start + 6, end);
         return;
     }
 
     // Handle simple sleep command
-    if (strncasecmp(trimmed, "sleep", 5) == 0) {
+    if(end - start >= 5 && strncasecmp(start, "sleep", 5) == 0) {
         result->type = CMD_SLEEP;
-        char* duration_str = trimmed + 5;  // Skip "sleep"
-        while (*duration_str && isspace(*duration_str)) duration_str++;  // Skip whitespace
-        result->sleep_duration = atoi(duration_str);
-        strncpy(result->command, trimmed, MAX_EXPR_LEN - 1);
+        result->sleep_duration = span_atoi(start + 5, end);
         return;
     }
 }
@@ -304,6 +687,8 @@ void input_parser(char *inp, ParsedCommand *result) {
 void disable_output() {
     was_disabled = true;
     output_enabled = false;
+    // Prompts keep scrolling the terminal while nothing is drawn
+    display_invalidate();
 }
 
 void enable_output() {
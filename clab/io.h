@@ -14,7 +14,9 @@
 
     // Maximum lengths for various input components
     #define MAX_INPUT_LEN 256    // Maximum length of input command
-    #define MAX_CELL_LEN 7       // Maximum length of cell reference (e.g., "AAA999")
+    #define INPUT_BUFFER_SIZE 65536  // Bytes of stdin read at a time
+    #define MAX_CELL_LEN 11      // Maximum length of cell reference (e.g., "AAA999", "AAA1000000" when backed)
+    #define MAX_ARG_LEN 15       // Maximum length of the extra argument of PERCENTILE, RANK, COUNTIF, SUMIF
     #define MAX_EXPR_LEN 200     // Maximum length of formula/expression
     #define MAX_RANGE_LEN 25     // Maximum length of range reference (e.g., "A1:B10")
 
@@ -34,7 +36,10 @@ typedef enum {
     CMD_SLEEP,       // Sleep command
     CMD_ARITHMETIC,  // Arithmetic operations
     CMD_FUNCTION,    // Function operations (MIN,MAX,etc)
-    CMD_INVALID      // Invalid/unrecognized command
+    CMD_INVALID,     // Invalid/unrecognized command
+    CMD_EXPRESSION,  // General expression compiled to bytecode
+    CMD_VIEWPORT,    // Set the viewport size (or follow the terminal)
+    CMD_FILE         // File commands (save, load, bgsave)
 } CommandType;
 
 /**
@@ -47,9 +52,26 @@ typedef enum {
     FUNC_SUM,      // Sum of values in range
     FUNC_AVG,      // Average of values in range
     FUNC_STDEV,    // Standard deviation of values in range
-    FUNC_SLEEP     // Sleep function
+    FUNC_SLEEP,    // Sleep function
+    FUNC_MEDIAN,   // Median of values in range
+    FUNC_PERCENTILE, // Percentile (0-100) of values in range
+    FUNC_RANK,     // Descending rank of a value within range
+    FUNC_COUNTIF,  // Number of values in range matching a condition
+    FUNC_SUMIF     // Sum of values in range matching a condition
 } FunctionType;
 
+/**
+ * Comparison used by conditional functions (COUNTIF, SUMIF)
+ */
+typedef enum {
+    PRED_EQ,       // = value (also a bare value)
+    PRED_NE,       // <> value
+    PRED_LT,       // < value
+    PRED_LE,       // <= value
+    PRED_GT,       // > value
+    PRED_GE        // >= value
+} PredicateType;
+
 /**
  * Structure to represent a cell reference or value operand
  */
@@ -59,13 +81,17 @@ typedef struct {
     int value;   // Direct value (used when row/col are 0)
 } Operand;
 
+struct ParsedCommand;
+
+// Evaluator of an arithmetic formula, specialized for its operand shape
+typedef int (*ArithmeticKernel)(const struct ParsedCommand *cmd);
+
 /**
  * Structure to hold a parsed command with all its components
  */
-typedef struct {
+typedef struct ParsedCommand {
     CommandType type;                    // Type of command
     FunctionType func;                   // Function type (if applicable)
-    char command[MAX_EXPR_LEN];         // Original command string
     Operand op1;                        // Target cell
     Operand op2;                        // First operand
     Operand op3;                        // Second operand
@@ -78,6 +104,10 @@ typedef struct {
     int sleep_duration;                // Sleep duration in seconds
     int error_code;                    // Error code if command fails
     char operator;                     // Arithmetic operator (+,-,*,/)
+    int func_arg;                      // Extra function argument (PERCENTILE p, RANK value, condition value)
+    PredicateType predicate;           // Comparison of COUNTIF/SUMIF conditions
+    struct Program *program;           // Compiled expression (owned by the cell once bound)
+    ArithmeticKernel kernel;           // Arithmetic evaluator chosen when the formula is bound
 } ParsedCommand;
 
 // Global flags for output control and viewport position
@@ -101,6 +131,9 @@ bool is_number(const char* str);
     
     // Input processing functions
     void input_reader(char *inp);                    // Read raw input from user
+    char *input_next_line();                         // Next stdin line, in place (NULL at end of input)
+    bool input_ready();                              // Check if a line can be read without waiting
+    bool input_queued();                             // Check if more input has arrived (buffered or not)
     void input_parser(char *inp, ParsedCommand *result);  // Parse input into command structure
     bool validate_cell(const char *cell);            // Validate cell reference format
     bool validate_range(const char *range);          // Validate range reference format
@@ -0,0 +1,373 @@
+/**
+ * journal.c
+ * Write-ahead command journal
+ * - Accepted commands are encoded into a buffer as length + CRC-32 + text;
+ *   appending costs a copy and a checksum, no system call
+ * - A commit writes the buffer with one write(2) and syncs the file with
+ *   fdatasync(2); the policy decides whether that happens after every
+ *   command, once per batch of input, or at most every few milliseconds
+ * - On open, an existing journal is replayed like a batch script, with
+ *   dependents recalculated once at the end; a torn record left by a crash,
+ *   or a record that is not a command the journal takes, ends the replay
+ *   and is cut off before new records are appended
+ * - Loads and imports record the size and CRC-32 of the file they read;
+ *   a journal whose files have changed since is refused rather than
+ *   replayed against different data
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "init.h"
+#include "io.h"
+#include "process.h"
+#include "formula.h"
+#include "timer.h"
+#include "journal.h"
+
+// Bytes in front of each record's text: length (2) and CRC-32 (4)
+#define RECORD_HEADER 6
+
+// Bytes after the text of a load or import: NUL, file size (8) and CRC-32 (4)
+#define FILE_TRAILER 13
+
+// Journal configuration
+JournalPolicy journal_policy = JOURNAL_SYNC_BATCH;
+long journal_interval_ms = 100;
+
+static int journal_fd = -1;
+static char *pending = NULL;            // Records not yet written
+static size_t pending_used = 0;
+static bool unsynced = false;           // Written records not yet synced
+static long long last_sync = 0;         // Time of the last sync (ms)
+
+static uint32_t crc_table[256];
+static bool crc_ready = false;
+
+/**
+ * Computes the CRC-32 (IEEE) of [data, data + length)
+ */
+static uint32_t crc32(const char *data, size_t length) {
+    if (!crc_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            crc_table[i] = c;
+        }
+        crc_ready = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * Returns the monotonic clock time in milliseconds
+ */
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Computes the size and CRC-32 of the contents of a file
+ * @return false if the file cannot be read
+ */
+static bool file_fingerprint(const char *path, long long *size, uint32_t *crc) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    *size = (long long)st.st_size;
+    *crc = crc32(NULL, 0);
+    if (*size > 0) {
+        const char *map = (const char *)mmap(NULL, (size_t)*size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise((void *)map, (size_t)*size, MADV_SEQUENTIAL);
+        *crc = crc32(map, (size_t)*size);
+        munmap((void *)map, (size_t)*size);
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * Checks that a file still has the size and CRC-32 stored in a record
+ * @param trailer The bytes after the NUL of the record
+ */
+static bool file_unchanged(const char *path, const char *trailer) {
+    long long size, stored_size;
+    uint32_t crc, stored_crc;
+    memcpy(&stored_size, trailer, sizeof(stored_size));
+    memcpy(&stored_crc, trailer + sizeof(stored_size), sizeof(stored_crc));
+    return file_fingerprint(path, &size, &crc) && size == stored_size && crc == stored_crc;
+}
+
+/**
+ * Writes [data, data + length) to the journal
+ * A failed write is reported once and stops journaling
+ */
+static void write_all(const char *data, size_t length) {
+    while (length > 0 && journal_fd >= 0) {
+        ssize_t n = write(journal_fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("journal");
+            close(journal_fd);
+            journal_fd = -1;
+            return;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+}
+
+/**
+ * Hands the buffered records to the kernel, without syncing
+ */
+static void write_pending() {
+    if (pending_used == 0) return;
+    write_all(pending, pending_used);
+    pending_used = 0;
+    unsynced = true;
+}
+
+/**
+ * Checks whether a parsed record is a command the journal takes: a valid
+ * write to a cell, a load or an import
+ * Anything else could only come from a damaged or foreign file
+ */
+static bool replayable(ParsedCommand *result) {
+    switch (result->type) {
+        case CMD_SET_CELL:
+            return result->op1.row >= 1 && is_numeric_value(result);
+        case CMD_ARITHMETIC:
+        case CMD_EXPRESSION:
+            return result->op1.row >= 1;
+        case CMD_FUNCTION:
+            return result->op1.row >= 1 && is_valid_range(result);
+        case CMD_FILE:
+            return strcmp(result->control_cmd, "load") == 0 || strcmp(result->control_cmd, "import") == 0;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Applies the records of a journal to the sheet
+ * Records are checked the way the REPL checks input, then go to
+ * handle_dependencies(); SLEEP completes at once instead of blocking, as
+ * it would have by now
+ * @return Offset just past the last intact record
+ */
+static long long replay(const char *map, long long size, bool *changed) {
+    bool real_clock = !virtual_clock;
+    virtual_clock = true;
+    defer_recalc = true;
+
+    long long offset = (long long)sizeof(JournalHeader);
+    while (offset + RECORD_HEADER <= size) {
+        uint16_t length;
+        uint32_t crc;
+        memcpy(&length, map + offset, sizeof(length));
+        memcpy(&crc, map + offset + 2, sizeof(crc));
+        const char *text = map + offset + RECORD_HEADER;
+        if (length == 0 || length >= MAX_INPUT_LEN + FILE_TRAILER || offset + RECORD_HEADER + length > size ||
+            crc32(text, length) != crc) {
+            break;
+        }
+
+        // Only a load or import carries a file trailer, and it must have one
+        const char *end = (const char *)memchr(text, '\0', length);
+        size_t text_length = end != NULL ? (size_t)(end - text) : length;
+        if (text_length >= MAX_INPUT_LEN || (end != NULL && length - text_length != FILE_TRAILER)) break;
+
+        char line[MAX_INPUT_LEN];
+        memcpy(line, text, text_length);
+        line[text_length] = '\0';
+        ParsedCommand result;
+        input_parser(line, &result);
+        if (!replayable(&result) || (result.type == CMD_FILE) != (end != NULL)) {
+            if (result.type == CMD_EXPRESSION) formula_free(result.program);
+            break;
+        }
+        if (end != NULL && !file_unchanged(result.expression, end + 1)) {
+            *changed = true;
+            break;
+        }
+        handle_dependencies(&result);
+        offset += RECORD_HEADER + length;
+    }
+
+    defer_recalc = false;
+    recalc_deferred();
+    if (real_clock) virtual_clock = false;
+    strcpy(status, "ok");
+    return offset;
+}
+
+/**
+ * Opens the journal, replaying the commands it already holds
+ * A missing or empty file is started with a header for this sheet size
+ * @return false if the file cannot be used or belongs to another sheet size
+ */
+bool journal_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    long long size = (long long)st.st_size;
+    if (size == 0) {
+        JournalHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        header.rows = MAXROW;
+        header.cols = MAXCOL;
+        if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || fdatasync(fd) < 0) {
+            close(fd);
+            return false;
+        }
+    } else {
+        if (size < (long long)sizeof(JournalHeader)) {
+            close(fd);
+            return false;
+        }
+        const char *map = (const char *)mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        JournalHeader header;
+        memcpy(&header, map, sizeof(header));
+        if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != JOURNAL_VERSION || header.rows != MAXROW || header.cols != MAXCOL) {
+            munmap((void *)map, (size_t)size);
+            close(fd);
+            return false;
+        }
+
+        madvise((void *)map, (size_t)size, MADV_SEQUENTIAL);
+        bool changed = false;
+        long long intact = replay(map, size, &changed);
+        munmap((void *)map, (size_t)size);
+
+        // The records after a changed file are kept for a later attempt
+        if (changed) {
+            close(fd);
+            return false;
+        }
+
+        // Drop a record torn by a crash so new records follow intact ones
+        if (intact < size && ftruncate(fd, intact) < 0) {
+            close(fd);
+            return false;
+        }
+    }
+
+    journal_fd = fd;
+    if (pending == NULL) pending = (char *)malloc(JOURNAL_BUFFER_SIZE);
+    pending_used = 0;
+    unsynced = false;
+    last_sync = now_ms();
+    return true;
+}
+
+/**
+ * Buffers one record and commits it if the policy asks for it
+ */
+static void append_record(const char *data, size_t length) {
+    if (pending_used + RECORD_HEADER + length > JOURNAL_BUFFER_SIZE) write_pending();
+    uint16_t size = (uint16_t)length;
+    uint32_t crc = crc32(data, length);
+    char *record = pending + pending_used;
+    memcpy(record, &size, sizeof(size));
+    memcpy(record + 2, &crc, sizeof(crc));
+    memcpy(record + RECORD_HEADER, data, length);
+    pending_used += RECORD_HEADER + length;
+
+    if (journal_policy == JOURNAL_SYNC_ALWAYS) {
+        journal_commit();
+    } else if (journal_policy == JOURNAL_SYNC_INTERVAL && now_ms() - last_sync >= journal_interval_ms) {
+        journal_commit();
+    }
+}
+
+/**
+ * Records a command that was accepted and applied to the sheet
+ */
+void journal_append(const char *command) {
+    if (journal_fd < 0) return;
+    size_t length = strlen(command);
+    if (length == 0 || length >= MAX_INPUT_LEN) return;
+    append_record(command, length);
+}
+
+/**
+ * Records a load or import that was applied to the sheet, together with
+ * the size and CRC-32 of the file as it was read
+ */
+void journal_append_file(const char *command, const char *path) {
+    if (journal_fd < 0) return;
+    size_t length = strlen(command);
+    long long size;
+    uint32_t crc;
+    if (length == 0 || length >= MAX_INPUT_LEN || !file_fingerprint(path, &size, &crc)) return;
+
+    char record[MAX_INPUT_LEN + FILE_TRAILER];
+    memcpy(record, command, length);
+    record[length] = '\0';
+    memcpy(record + length + 1, &size, sizeof(size));
+    memcpy(record + length + 1 + sizeof(size), &crc, sizeof(crc));
+    append_record(record, length + FILE_TRAILER);
+}
+
+/**
+ * Makes every appended record durable
+ * Called after each command, at the end of each batch of input, or when
+ * the interval has passed, depending on the policy; the REPL also calls
+ * it whenever the input runs dry, whatever the policy
+ */
+void journal_commit() {
+    if (journal_fd < 0) return;
+    write_pending();
+    if (unsynced && journal_fd >= 0) {
+        if (fdatasync(journal_fd) < 0) perror("journal");
+        unsynced = false;
+    }
+    last_sync = now_ms();
+}
+
+/**
+ * Commits what is left and closes the journal
+ */
+void journal_close() {
+    journal_commit();
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = -1;
+    free(pending);
+    pending = NULL;
+    pending_used = 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * journal.h
+ * Write-ahead journal of the commands that change the sheet (--journal)
+ * Accepted commands are appended as checksummed binary records and made
+ * durable according to the fsync policy; on restart the journal is
+ * replayed with deferred recalculation to rebuild the sheet
+ */
+
+#ifndef __JOURNAL__
+#define __JOURNAL__
+
+#include <stdbool.h>
+
+// Identifies a journal file and its format revision
+#define JOURNAL_MAGIC "CLABJRNL"
+#define JOURNAL_VERSION 1
+
+// Records are collected here and written out at each commit
+#define JOURNAL_BUFFER_SIZE 65536
+
+/**
+ * When appended records are forced to disk
+ */
+typedef enum {
+    JOURNAL_SYNC_ALWAYS,        // After every command
+    JOURNAL_SYNC_BATCH,         // Once per batch of input, before waiting for more (group commit)
+    JOURNAL_SYNC_INTERVAL       // At most every journal_interval_ms while input keeps coming;
+                                // still once per batch when the input runs dry, so typed
+                                // commands are synced as they are with JOURNAL_SYNC_BATCH
+} JournalPolicy;
+
+/**
+ * File header, at offset 0
+ * Records follow back to back: a 2-byte record length, the 4-byte CRC-32
+ * of the record, then the command text without terminator
+ * A load or import record goes on with a NUL, the 8-byte size and the
+ * 4-byte CRC-32 of the file it read, so replay can tell when the file has
+ * changed since
+ */
+typedef struct JournalHeader {
+    char magic[8];              // JOURNAL_MAGIC (not NUL-terminated)
+    int version;                // JOURNAL_VERSION
+    int rows, cols;             // Sheet dimensions
+} JournalHeader;
+
+// Journal configuration
+extern JournalPolicy journal_policy;    // fsync policy (--fsync)
+extern long journal_interval_ms;        // Interval of JOURNAL_SYNC_INTERVAL
+
+// Journal management functions
+bool journal_open(const char *path);    // Replay an existing journal, then append to it (false if
+                                        // it is foreign or a file it loaded has changed)
+void journal_append(const char *command);  // Record an accepted command
+void journal_append_file(const char *command, const char *path);  // Record an accepted load or import of path
+void journal_commit();                  // Write out and sync what was appended (end of a batch)
+void journal_close();                   // Commit and close
+
+#endif
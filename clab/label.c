@@ -0,0 +1,84 @@
+/**
+ * label.c
+ * Column labels for the spreadsheet
+ * - Every label from A to ZZZ is built on first use into one table that
+ *   the header row, the batch output and the cell parsers share
+ * - Letters are mapped to their values through a byte table, so reading
+ *   a column reference needs no ctype calls
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "label.h"
+
+// Letters of each column (1-based) and their count
+static char labels[LABEL_COLUMNS + 1][LABEL_MAX_LEN + 1];
+static unsigned char label_lengths[LABEL_COLUMNS + 1];
+
+// Value (1-26) of each letter byte, either case; 0 for any other byte
+static unsigned char letter_values[256];
+
+static bool labels_built = false;
+
+/**
+ * Builds the label and letter tables
+ * Each label is the previous one counted up by one, like an odometer
+ * whose digits run from A to Z
+ */
+static void build_labels() {
+    for (int i = 0; i < 26; i++) {
+        letter_values['A' + i] = (unsigned char)(i + 1);
+        letter_values['a' + i] = (unsigned char)(i + 1);
+    }
+
+    char current[LABEL_MAX_LEN + 1] = "A";
+    int length = 1;
+    for (int col = 1; col <= LABEL_COLUMNS; col++) {
+        for (int i = 0; i <= length; i++) labels[col][i] = current[i];
+        label_lengths[col] = (unsigned char)length;
+
+        int i = length - 1;
+        while (i >= 0 && current[i] == 'Z') {
+            current[i] = 'A';
+            i--;
+        }
+        if (i >= 0) {
+            current[i]++;
+        } else if (length < LABEL_MAX_LEN) {
+            current[length++] = 'A';
+            current[length] = '\0';
+        }
+    }
+    labels_built = true;
+}
+
+/**
+ * Looks up the letters of a column
+ * @param col Column number (1-based)
+ * @param length Pointer to store the number of letters (may be NULL)
+ * @return The NUL-terminated label, or NULL if col is outside A-ZZZ
+ */
+const char *column_label(int col, int *length) {
+    if (col < 1 || col > LABEL_COLUMNS) return NULL;
+    if (!labels_built) build_labels();
+    if (length) *length = label_lengths[col];
+    return labels[col];
+}
+
+/**
+ * Reads the column letters at the start of [start, end)
+ * @param stop Pointer to store the first byte after the letters (may be NULL)
+ * @return The column number (1-based), or 0 if there are no letters or
+ *         more than LABEL_MAX_LEN of them
+ */
+int column_number(const char *start, const char *end, const char **stop) {
+    if (!labels_built) build_labels();
+    const char *p = start;
+    int col = 0;
+    while (p < end && letter_values[(unsigned char)*p]) {
+        if (p - start < LABEL_MAX_LEN) col = col * 26 + letter_values[(unsigned char)*p];
+        p++;
+    }
+    if (stop) *stop = p;
+    return p - start > LABEL_MAX_LEN ? 0 : col;
+}
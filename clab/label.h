@@ -0,0 +1,21 @@
+/**
+ * label.h
+ * Column labels for the spreadsheet
+ * The labels A..ZZZ are built once into a shared table, so converting a
+ * column number to letters (and letters back to a number) is a lookup
+ */
+
+#ifndef __LABEL__
+#define __LABEL__
+
+// Number of columns that have a label (A-ZZZ)
+#define LABEL_COLUMNS 18278
+
+// Most letters in a column label
+#define LABEL_MAX_LEN 3
+
+// Lookup functions
+const char *column_label(int col, int *length);   // Letters of column col (1-based), NULL outside A-ZZZ
+int column_number(const char *start, const char *end, const char **stop);  // Column of the letters at start, 0 if none or too many
+
+#endif
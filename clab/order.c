@@ -0,0 +1,262 @@
+/**
+ * order.c
+ * Order-statistic treap
+ * - One node per distinct value with a multiplicity count
+ * - Subtree sizes give the k-th smallest value and ranks in O(log n)
+ * - Subtree sums give conditional sums (values below/above a bound)
+ * - Priorities come from a fixed xorshift generator, so tree shapes
+ *   are reproducible from run to run
+ */
+
+#include <stdlib.h>
+#include "order.h"
+
+static unsigned int order_seed = 2463534242u;
+
+/**
+ * Returns the next pseudo-random node priority
+ */
+static unsigned int next_priority() {
+    order_seed ^= order_seed << 13;
+    order_seed ^= order_seed >> 17;
+    order_seed ^= order_seed << 5;
+    return order_seed;
+}
+
+static int subtree_size(OrderNode *node) {
+    return node ? node->size : 0;
+}
+
+static long long subtree_sum(OrderNode *node) {
+    return node ? node->sum : 0;
+}
+
+static void update_size(OrderNode *node) {
+    node->size = node->count + subtree_size(node->left) + subtree_size(node->right);
+    node->sum = (long long)node->value * node->count +
+                subtree_sum(node->left) + subtree_sum(node->right);
+}
+
+static OrderNode *rotate_right(OrderNode *node) {
+    OrderNode *left = node->left;
+    node->left = left->right;
+    left->right = node;
+    update_size(node);
+    update_size(left);
+    return left;
+}
+
+static OrderNode *rotate_left(OrderNode *node) {
+    OrderNode *right = node->right;
+    node->right = right->left;
+    right->left = node;
+    update_size(node);
+    update_size(right);
+    return right;
+}
+
+static OrderNode *insert_node(OrderNode *node, int value) {
+    if (node == NULL) {
+        node = (OrderNode *)malloc(sizeof(OrderNode));
+        node->value = value;
+        node->count = 1;
+        node->size = 1;
+        node->sum = value;
+        node->priority = next_priority();
+        node->left = NULL;
+        node->right = NULL;
+        return node;
+    }
+
+    if (value == node->value) {
+        node->count++;
+    } else if (value < node->value) {
+        node->left = insert_node(node->left, value);
+        if (node->left->priority > node->priority) node = rotate_right(node);
+    } else {
+        node->right = insert_node(node->right, value);
+        if (node->right->priority > node->priority) node = rotate_left(node);
+    }
+    update_size(node);
+    return node;
+}
+
+static OrderNode *erase_node(OrderNode *node, int value) {
+    if (node == NULL) return NULL;
+
+    if (value < node->value) {
+        node->left = erase_node(node->left, value);
+    } else if (value > node->value) {
+        node->right = erase_node(node->right, value);
+    } else if (node->count > 1) {
+        node->count--;
+    } else if (node->left == NULL || node->right == NULL) {
+        // Single child (or leaf): splice the node out
+        OrderNode *child = node->left ? node->left : node->right;
+        free(node);
+        return child;
+    } else {
+        // Rotate the node down until it can be spliced out
+        if (node->left->priority > node->right->priority) {
+            node = rotate_right(node);
+            node->right = erase_node(node->right, value);
+        } else {
+            node = rotate_left(node);
+            node->left = erase_node(node->left, value);
+        }
+    }
+    update_size(node);
+    return node;
+}
+
+static void free_nodes(OrderNode *node) {
+    if (node == NULL) return;
+    free_nodes(node->left);
+    free_nodes(node->right);
+    free(node);
+}
+
+/**
+ * Creates an empty tree
+ */
+OrderTree *order_new() {
+    OrderTree *tree = (OrderTree *)malloc(sizeof(OrderTree));
+    tree->root = NULL;
+    return tree;
+}
+
+/**
+ * Frees a tree and all of its nodes
+ */
+void order_free(OrderTree *tree) {
+    if (tree == NULL) return;
+    free_nodes(tree->root);
+    free(tree);
+}
+
+/**
+ * Adds one occurrence of a value
+ */
+void order_insert(OrderTree *tree, int value) {
+    tree->root = insert_node(tree->root, value);
+}
+
+/**
+ * Removes one occurrence of a value (no-op if it is not stored)
+ */
+void order_erase(OrderTree *tree, int value) {
+    tree->root = erase_node(tree->root, value);
+}
+
+/**
+ * Returns the number of values stored, counting duplicates
+ */
+int order_size(OrderTree *tree) {
+    return subtree_size(tree->root);
+}
+
+/**
+ * Returns the k-th smallest value, 0 <= k < order_size(tree)
+ */
+int order_kth(OrderTree *tree, int k) {
+    OrderNode *node = tree->root;
+    while (node != NULL) {
+        int left = subtree_size(node->left);
+        if (k < left) {
+            node = node->left;
+        } else if (k < left + node->count) {
+            return node->value;
+        } else {
+            k -= left + node->count;
+            node = node->right;
+        }
+    }
+    return 0;   // k out of range
+}
+
+/**
+ * Returns the sum of all stored values, counting duplicates
+ */
+long long order_sum(OrderTree *tree) {
+    return subtree_sum(tree->root);
+}
+
+/**
+ * Returns the number of stored values strictly less than value
+ */
+int order_count_less(OrderTree *tree, int value) {
+    int less = 0;
+    OrderNode *node = tree->root;
+    while (node != NULL) {
+        if (value > node->value) {
+            less += node->count + subtree_size(node->left);
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return less;
+}
+
+/**
+ * Returns the sum of stored values strictly less than value
+ */
+long long order_sum_less(OrderTree *tree, int value) {
+    long long sum = 0;
+    OrderNode *node = tree->root;
+    while (node != NULL) {
+        if (value > node->value) {
+            sum += (long long)node->value * node->count + subtree_sum(node->left);
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return sum;
+}
+
+/**
+ * Returns the sum of stored values strictly greater than value
+ */
+long long order_sum_greater(OrderTree *tree, int value) {
+    long long sum = 0;
+    OrderNode *node = tree->root;
+    while (node != NULL) {
+        if (value < node->value) {
+            sum += (long long)node->value * node->count + subtree_sum(node->right);
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return sum;
+}
+
+/**
+ * Returns the number of stored values strictly greater than value
+ */
+int order_count_greater(OrderTree *tree, int value) {
+    int greater = 0;
+    OrderNode *node = tree->root;
+    while (node != NULL) {
+        if (value < node->value) {
+            greater += node->count + subtree_size(node->right);
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return greater;
+}
+
+/**
+ * Checks whether at least one occurrence of value is stored
+ */
+bool order_contains(OrderTree *tree, int value) {
+    OrderNode *node = tree->root;
+    while (node != NULL) {
+        if (value == node->value) return true;
+        node = value < node->value ? node->left : node->right;
+    }
+    return false;
+}
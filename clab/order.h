@@ -0,0 +1,51 @@
+/**
+ * order.h
+ * Order-statistic multiset of cell values
+ * Backs the MEDIAN, PERCENTILE, RANK, COUNTIF and SUMIF range functions:
+ * values are inserted and erased as cells change, and every query is O(log n)
+ */
+
+#ifndef __ORDER__
+#define __ORDER__
+
+#include <stdbool.h>
+
+/**
+ * Treap node holding one distinct value
+ */
+typedef struct OrderNode {
+    int value;                  // Cell value
+    int count;                  // Number of cells holding this value
+    int size;                   // Total count in this subtree
+    long long sum;              // Sum of all values in this subtree
+    unsigned int priority;      // Heap priority (random)
+    struct OrderNode *left;     // Smaller values
+    struct OrderNode *right;    // Larger values
+} OrderNode;
+
+/**
+ * Multiset of values with rank queries
+ */
+typedef struct {
+    OrderNode *root;            // Root of the treap
+} OrderTree;
+
+// Tree management functions
+OrderTree *order_new();                         // Create an empty tree
+void order_free(OrderTree *tree);               // Free a tree and all its nodes
+
+// Update functions
+void order_insert(OrderTree *tree, int value);  // Add one occurrence of value
+void order_erase(OrderTree *tree, int value);   // Remove one occurrence of value
+
+// Query functions
+int order_size(OrderTree *tree);                // Number of values stored
+int order_kth(OrderTree *tree, int k);          // k-th smallest value (0-based)
+long long order_sum(OrderTree *tree);           // Sum of all values stored
+int order_count_less(OrderTree *tree, int value);     // Number of values below value
+int order_count_greater(OrderTree *tree, int value);  // Number of values above value
+long long order_sum_less(OrderTree *tree, int value);     // Sum of values below value
+long long order_sum_greater(OrderTree *tree, int value);  // Sum of values above value
+bool order_contains(OrderTree *tree, int value);      // Whether value is stored
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * pool.c
+ * Fixed-size worker thread pool
+ * - Workers sleep on a condition variable until a job is posted
+ * - Job indices are handed out one at a time, so uneven blocks balance out
+ * - The calling thread takes part in the job and returns once every
+ *   index has completed
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "pool.h"
+
+int pool_threads = 0;
+long parallel_min_cells = PARALLEL_MIN_CELLS;
+
+static pthread_t workers[POOL_MAX_THREADS];
+static int worker_count = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_posted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+// Current job, protected by pool_lock
+static PoolTask job_task = NULL;
+static void *job_arg = NULL;
+static int job_count = 0;
+static int job_next = 0;
+static int job_finished = 0;
+static unsigned long job_generation = 0;
+static bool pool_stopping = false;
+
+/**
+ * Claims and runs indices of the current job until none are left
+ * Must be called with pool_lock held; returns with pool_lock held
+ */
+static void drain_job() {
+    while (job_next < job_count) {
+        int index = job_next++;
+        PoolTask task = job_task;
+        void *arg = job_arg;
+        pthread_mutex_unlock(&pool_lock);
+        task(arg, index);
+        pthread_mutex_lock(&pool_lock);
+        if (++job_finished == job_count) {
+            pthread_cond_broadcast(&job_done);
+        }
+    }
+}
+
+/**
+ * Worker thread main loop
+ */
+static void *worker_main(void *unused) {
+    (void)unused;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool_lock);
+    while (true) {
+        while (!pool_stopping && job_generation == seen) {
+            pthread_cond_wait(&job_posted, &pool_lock);
+        }
+        if (pool_stopping) break;
+        seen = job_generation;
+        drain_job();
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+/**
+ * Starts the pool with the given total number of threads
+ * The calling thread counts as one of them
+ */
+void pool_init(int threads) {
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    pool_stopping = false;
+    worker_count = 0;
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) {
+            break;  // Run with the workers we managed to start
+        }
+        worker_count++;
+    }
+    pool_threads = worker_count + 1;
+}
+
+/**
+ * Stops all workers and waits for them to exit
+ */
+void pool_shutdown() {
+    pthread_mutex_lock(&pool_lock);
+    pool_stopping = true;
+    pthread_cond_broadcast(&job_posted);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    worker_count = 0;
+    pool_threads = 0;
+}
+
+/**
+ * Runs a job on the pool and blocks until all of its indices are done
+ * Without workers the job simply runs on the calling thread
+ */
+void pool_run(PoolTask task, void *arg, int count) {
+    if (worker_count == 0) {
+        for (int i = 0; i < count; i++) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    job_task = task;
+    job_arg = arg;
+    job_count = count;
+    job_next = 0;
+    job_finished = 0;
+    job_generation++;
+    pthread_cond_broadcast(&job_posted);
+
+    drain_job();
+    while (job_finished < job_count) {
+        pthread_cond_wait(&job_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
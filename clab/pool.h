@@ -0,0 +1,30 @@
+/**
+ * pool.h
+ * Fixed-size worker thread pool for the spreadsheet
+ * Used to split large range reductions into blocks evaluated in parallel
+ */
+
+#ifndef __POOL__
+#define __POOL__
+
+// Default minimum number of cells before a range reduction goes parallel
+#define PARALLEL_MIN_CELLS 65536
+
+// Maximum number of worker threads in the pool
+#define POOL_MAX_THREADS 64
+
+// Task executed once for every index of a parallel job
+typedef void (*PoolTask)(void *arg, int index);
+
+// Pool configuration
+extern int pool_threads;          // Number of threads taking part in a job (0 = pool not running)
+extern long parallel_min_cells;   // Range size from which reductions are split
+
+// Pool management functions
+void pool_init(int threads);      // Start the worker threads
+void pool_shutdown();             // Stop and join the worker threads
+
+// Runs task(arg, i) for every i in [0, count) and waits for completion
+void pool_run(PoolTask task, void *arg, int count);
+
+#endif
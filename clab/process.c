@@ -13,6 +13,15 @@
 #include "string.h"
 #include <stdio.h>
 #include "dependent.h"
+#include "range.h"
+#include "pool.h"
+#include "storage.h"
+#include "timer.h"
+#include "formula.h"
+#include "snapshot.h"
+#include "import.h"
+#include "export.h"
+#include <stdlib.h>
 #include <time.h>
 
 // ERROR_VALUE is already defined in init.h, no need to redefine it here
@@ -39,21 +48,16 @@ void assign(ParsedCommand *result) {
     int val = result->op2.value;
     
     // Store original value in case we need to revert
-    int original_value = sheet[r1][c1];
+    int original_value = CELL(r1, c1);
 
-    // Remove old dependencies
-    Parent *parent = Parent_lst[r1][c1];
-    while (parent != NULL) {
-        remove_child(parent->r, parent->c, r1, c1);
-        parent = parent->next;
-    }
-    while (Parent_lst[r1][c1] != NULL) {
-        remove_parent(Parent_lst[r1][c1]->r, Parent_lst[r1][c1]->c, r1, c1);
-    }
+    // Remove old dependencies (and any SLEEP still pending or program compiled for the cell)
+    timer_cancel(r1, c1);
+    formula_release(r1, c1);
+    clear_parents(r1, c1);
 
     if (r2 == -1 && c2 == -1) {
         // Direct value assignment
-        sheet[r1][c1] = val;
+        set_cell(r1, c1, val);
     } else {
         // Cell reference assignment
         // Add dependency
@@ -66,25 +70,131 @@ void assign(ParsedCommand *result) {
             remove_child(r2, c2, r1, c1);
             remove_parent(r2, c2, r1, c1);
             // Set ERROR_VALUE for cycle detection
-            sheet[r1][c1] = ERROR_VALUE;
+            set_cell(r1, c1, ERROR_VALUE);
             // Set status to "err" for cycle detection
             strcpy(status, "err");
             return;
         }
         
         // Check if referenced cell has an error
-        if (sheet[r2][c2] == ERROR_VALUE) {
-            sheet[r1][c1] = ERROR_VALUE;
+        if (CELL(r2, c2) == ERROR_VALUE) {
+            set_cell(r1, c1, ERROR_VALUE);
         } else {
-            sheet[r1][c1] = sheet[r2][c2];
+            set_cell(r1, c1, CELL(r2, c2));
         }
     }
 }
 
+/**
+ * Arithmetic kernels, one per operand shape and operator
+ * - The kernel is chosen once when the formula is bound, so recalculation
+ *   neither looks at the operand kinds nor switches on the operator
+ * - Literal operands are known not to be ERROR_VALUE and literal divisors
+ *   not to be zero; those cases are folded when binding
+ */
+#define CELL_OPERAND(op) CELL((op).row - 1, (op).col - 1)
+
+#define CELL_CELL_KERNEL(name, expr)                                    \
+    static int name(const ParsedCommand *cmd) {                         \
+        int x = CELL_OPERAND(cmd->op2);                                 \
+        int y = CELL_OPERAND(cmd->op3);                                 \
+        if (x == ERROR_VALUE || y == ERROR_VALUE) return ERROR_VALUE;   \
+        return expr;                                                    \
+    }
+
+#define CELL_LITERAL_KERNEL(name, expr)                                 \
+    static int name(const ParsedCommand *cmd) {                         \
+        int x = CELL_OPERAND(cmd->op2);                                 \
+        int y = cmd->op3.value;                                         \
+        if (x == ERROR_VALUE) return ERROR_VALUE;                       \
+        return expr;                                                    \
+    }
+
+#define LITERAL_CELL_KERNEL(name, expr)                                 \
+    static int name(const ParsedCommand *cmd) {                         \
+        int x = cmd->op2.value;                                         \
+        int y = CELL_OPERAND(cmd->op3);                                 \
+        if (y == ERROR_VALUE) return ERROR_VALUE;                       \
+        return expr;                                                    \
+    }
+
+CELL_CELL_KERNEL(add_cell_cell, WRAP_ADD(x, y))
+CELL_CELL_KERNEL(sub_cell_cell, WRAP_SUB(x, y))
+CELL_CELL_KERNEL(mul_cell_cell, WRAP_MUL(x, y))
+CELL_CELL_KERNEL(div_cell_cell, y == 0 ? ERROR_VALUE : WRAP_DIV(x, y))
+CELL_LITERAL_KERNEL(add_cell_literal, WRAP_ADD(x, y))
+CELL_LITERAL_KERNEL(sub_cell_literal, WRAP_SUB(x, y))
+CELL_LITERAL_KERNEL(mul_cell_literal, WRAP_MUL(x, y))
+CELL_LITERAL_KERNEL(div_cell_literal, WRAP_DIV(x, y))
+LITERAL_CELL_KERNEL(add_literal_cell, WRAP_ADD(x, y))
+LITERAL_CELL_KERNEL(sub_literal_cell, WRAP_SUB(x, y))
+LITERAL_CELL_KERNEL(mul_literal_cell, WRAP_MUL(x, y))
+LITERAL_CELL_KERNEL(div_literal_cell, y == 0 ? ERROR_VALUE : WRAP_DIV(x, y))
+
+/**
+ * Kernel of a formula whose result is ERROR_VALUE whatever its cell holds
+ * (an ERROR_VALUE literal or a literal zero divisor)
+ */
+static int error_kernel(const ParsedCommand *cmd) {
+    (void)cmd;
+    return ERROR_VALUE;
+}
+
+/**
+ * Applies an operator to two values, as the kernels do
+ * Only used when binding, to fold formulas whose operands are both literals
+ */
+static int apply_operator(char op, int x, int y) {
+    if (x == ERROR_VALUE || y == ERROR_VALUE) return ERROR_VALUE;
+    switch (op) {
+        case '+': return WRAP_ADD(x, y);
+        case '-': return WRAP_SUB(x, y);
+        case '*': return WRAP_MUL(x, y);
+        case '/': return y == 0 ? ERROR_VALUE : WRAP_DIV(x, y);
+    }
+    return ERROR_VALUE;
+}
+
+/**
+ * Picks the kernel for the operand shape and operator of a formula
+ * @return The kernel, or NULL if both operands are literals
+ */
+static ArithmeticKernel bind_arithmetic(const ParsedCommand *cmd) {
+    static const ArithmeticKernel cell_cell[] =
+        {add_cell_cell, sub_cell_cell, mul_cell_cell, div_cell_cell};
+    static const ArithmeticKernel cell_literal[] =
+        {add_cell_literal, sub_cell_literal, mul_cell_literal, div_cell_literal};
+    static const ArithmeticKernel literal_cell[] =
+        {add_literal_cell, sub_literal_cell, mul_literal_cell, div_literal_cell};
+
+    int op;
+    switch (cmd->operator) {
+        case '+': op = 0; break;
+        case '-': op = 1; break;
+        case '*': op = 2; break;
+        default:  op = 3; break;
+    }
+
+    bool cell2 = cmd->op2.row != 0 && cmd->op2.col != 0;
+    bool cell3 = cmd->op3.row != 0 && cmd->op3.col != 0;
+    if (cell2 && cell3) return cell_cell[op];
+    if (cell2) {
+        if (cmd->op3.value == ERROR_VALUE || (op == 3 && cmd->op3.value == 0)) return error_kernel;
+        return cell_literal[op];
+    }
+    if (cell3) {
+        if (cmd->op2.value == ERROR_VALUE) return error_kernel;
+        return literal_cell[op];
+    }
+    return NULL;
+}
+
 /**
  * Performs arithmetic operations between cells or values
  * - Supports +, -, *, / operations
  * - Handles cell references and direct values
+ * - Binds the kernel for the operand shape; two literals are folded into
+ *   a plain value with no dependencies
  * - Sets ERROR_VALUE for division by zero and propagates to dependents
  */
 void arithmetic(ParsedCommand *result) {
@@ -94,23 +204,20 @@ void arithmetic(ParsedCommand *result) {
     int c2 = result->op2.col - 1;
     int r3 = result->op3.row - 1;
     int c3 = result->op3.col - 1;
-    int val2 = result->op2.value;
-    int val3 = result->op3.value;
-    
-    // Store original value in case we need to revert
-    int original_value = sheet[r1][c1];
 
-    // Remove old dependencies
-    Parent *parent = Parent_lst[r1][c1];
-    while (parent != NULL) {
-        remove_child(parent->r, parent->c, r1, c1);
-        parent = parent->next;
-    }
-    while (Parent_lst[r1][c1] != NULL) {
-        remove_parent(Parent_lst[r1][c1]->r, Parent_lst[r1][c1]->c, r1, c1);
+    // Remove old dependencies (and any SLEEP still pending or program compiled for the cell)
+    timer_cancel(r1, c1);
+    formula_release(r1, c1);
+    clear_parents(r1, c1);
+
+    // Constant formula: fold it now
+    result->kernel = bind_arithmetic(result);
+    if (result->kernel == NULL) {
+        set_cell(r1, c1, apply_operator(result->operator, result->op2.value, result->op3.value));
+        return;
     }
 
-    // Add dependencies for cell references
+    // Add dependencies for cell references (the stored copies carry the kernel)
     if (r2 != -1 && c2 != -1) {
         assign_parent(r2, c2, r1, c1, *result);
         assign_child(r2, c2, r1, c1, *result);
@@ -132,41 +239,238 @@ void arithmetic(ParsedCommand *result) {
             remove_parent(r3, c3, r1, c1);
         }
         // Set ERROR_VALUE for cycle detection
-        sheet[r1][c1] = ERROR_VALUE;
+        set_cell(r1, c1, ERROR_VALUE);
         // Set status to "err" for cycle detection
         strcpy(status, "err");
         return;
     }
 
-    int operand1 = (r2 == -1 && c2 == -1) ? val2 : sheet[r2][c2];
-    int operand2 = (r3 == -1 && c3 == -1) ? val3 : sheet[r3][c3];
+    set_cell(r1, c1, result->kernel(result));
+}
+
+/**
+ * Checks whether an earlier instruction of a program already reads the
+ * same cell or the same range as instruction i
+ */
+static bool repeats_reference(const Program *program, int i) {
+    const Instr *ins = &program->code[i];
+    for (int j = 0; j < i; j++) {
+        const Instr *prev = &program->code[j];
+        if (prev->op != ins->op || prev->a != ins->a || prev->b != ins->b) continue;
+        if (ins->op == OP_CELL) return true;
+        if (prev->func == ins->func && prev->c == ins->c && prev->d == ins->d) return true;
+    }
+    return false;
+}
+
+/**
+ * Makes every cell a compiled expression reads a parent of the target cell
+ * - A range argument subscribes the cell to the interned range, so it costs
+ *   one edge however large the rectangle is
+ * - A cell or range referenced more than once is linked once
+ */
+static void link_program(ParsedCommand *result) {
+    int r1 = result->op1.row - 1;
+    int c1 = result->op1.col - 1;
+    const Program *program = result->program;
+    for (int i = 0; i < program->length; i++) {
+        const Instr *ins = &program->code[i];
+        if (ins->op != OP_CELL && ins->op != OP_RANGE) continue;
+        if (repeats_reference(program, i)) continue;
 
-    // Check if any operand is ERROR_VALUE
-    if (operand1 == ERROR_VALUE || operand2 == ERROR_VALUE) {
-        sheet[r1][c1] = ERROR_VALUE;
+        if (ins->op == OP_CELL) {
+            assign_parent(ins->a, ins->b, r1, c1, *result);
+            assign_child(ins->a, ins->b, r1, c1, *result);
+        } else {
+            RangeEntry *entry = range_acquire(ins->func, 0, 0, ins->a, ins->b, ins->c, ins->d);
+            range_attach(entry, r1, c1, *result);
+        }
+    }
+}
+
+/**
+ * Binds a compiled expression to its cell and evaluates it
+ * - The cell takes ownership of the program
+ * - Every referenced cell becomes a parent of the target cell and every
+ *   range argument subscribes it to the interned range
+ * - Sets ERROR_VALUE (and frees the program) if the expression depends
+ *   on its own cell
+ */
+void expression(ParsedCommand *result) {
+    int r1 = result->op1.row - 1;
+    int c1 = result->op1.col - 1;
+    Program *program = result->program;
+
+    // Remove old dependencies (and any SLEEP still pending on the cell)
+    timer_cancel(r1, c1);
+    clear_parents(r1, c1);
+    formula_bind(r1, c1, program);
+    link_program(result);
+
+    // Check for cycles after adding dependencies
+    if (detect_cycle(r1, c1)) {
+        clear_parents(r1, c1);
+        formula_release(r1, c1);
+        // Set ERROR_VALUE for cycle detection
+        set_cell(r1, c1, ERROR_VALUE);
+        // Set status to "err" for cycle detection
+        strcpy(status, "err");
         return;
     }
 
-    switch (result->operator) {
-        case '+':
-            sheet[r1][c1] = operand1 + operand2;
-            break;
-        case '-':
-            sheet[r1][c1] = operand1 - operand2;
+    set_cell(r1, c1, evaluate_program(program));
+}
+
+/**
+ * Re-creates the dependencies of a saved formula without evaluating it
+ * - The cell already holds the value the formula had when it was saved,
+ *   which also seeds the cached result of a new interned range
+ * - No cycle check: saved formulas are loaded in dependency order
+ * - The cell takes ownership of the program of a compiled expression
+ */
+void restore_formula(ParsedCommand *result) {
+    int r1 = result->op1.row - 1;
+    int c1 = result->op1.col - 1;
+    int r2 = result->op2.row - 1;
+    int c2 = result->op2.col - 1;
+    int r3 = result->op3.row - 1;
+    int c3 = result->op3.col - 1;
+
+    switch (result->type) {
+        case CMD_SET_CELL:
+            assign_parent(r2, c2, r1, c1, *result);
+            assign_child(r2, c2, r1, c1, *result);
             break;
-        case '*':
-            sheet[r1][c1] = operand1 * operand2;
+        case CMD_ARITHMETIC:
+            result->kernel = bind_arithmetic(result);
+            if (r2 != -1 && c2 != -1) {
+                assign_parent(r2, c2, r1, c1, *result);
+                assign_child(r2, c2, r1, c1, *result);
+            }
+            if (r3 != -1 && c3 != -1) {
+                assign_parent(r3, c3, r1, c1, *result);
+                assign_child(r3, c3, r1, c1, *result);
+            }
             break;
-        case '/':
-            if (operand2 == 0) {
-                sheet[r1][c1] = ERROR_VALUE;
+        case CMD_FUNCTION:
+            if (result->func == FUNC_SLEEP) {
+                assign_parent(r2, c2, r1, c1, *result);
+                assign_child(r2, c2, r1, c1, *result);
             } else {
-                sheet[r1][c1] = operand1 / operand2;
+                RangeEntry *entry = range_acquire(result->func, result->func_arg, result->predicate,
+                                                  r2, c2, r3, c3);
+                if (entry->dirty) {
+                    entry->value = CELL(r1, c1);
+                    entry->dirty = false;
+                }
+                range_attach(entry, r1, c1, *result);
             }
             break;
+        case CMD_EXPRESSION:
+            formula_bind(r1, c1, result->program);
+            link_program(result);
+            break;
+        default:
+            break;
     }
 }
 
+/**
+ * Applies a function to the values popped by OP_CALL
+ * Same semantics as the range functions: integer AVG, rounded STDEV
+ * Also used by the compiler to fold calls whose arguments are literals
+ */
+int call_function(int func, const int *values, int count) {
+    int sum = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+
+    switch (func) {
+        case FUNC_MIN:
+            return min;
+        case FUNC_MAX:
+            return max;
+        case FUNC_SUM:
+            return sum;
+        case FUNC_AVG:
+            return sum / count;
+        case FUNC_STDEV: {
+            if (count < 2) return 0;
+            int mean = sum / count;
+            double variance = 0.0;
+            for (int i = 0; i < count; i++) {
+                variance += (values[i] - mean) * (values[i] - mean);
+            }
+            return (int)round(sqrt(variance / count));
+        }
+        default:
+            return ERROR_VALUE;
+    }
+}
+
+/**
+ * Bytecode interpreter for compiled expressions
+ * Any ERROR_VALUE operand or division by zero makes the whole result
+ * ERROR_VALUE, as with the single-operator formulas
+ */
+int evaluate_program(const Program *program) {
+    int stack[FORMULA_MAX_DEPTH];
+    int top = -1;
+
+    const Instr *ins = program->code;
+    const Instr *end = ins + program->length;
+    for (; ins < end; ins++) {
+        switch (ins->op) {
+            case OP_CONST:
+                stack[++top] = ins->a;
+                break;
+            case OP_CELL:
+                stack[++top] = CELL(ins->a, ins->b);
+                if (stack[top] == ERROR_VALUE) return ERROR_VALUE;
+                break;
+            case OP_RANGE: {
+                // A linked program reads the cached result of its interned range
+                RangeEntry *entry = range_lookup(ins->func, 0, 0, ins->a, ins->b, ins->c, ins->d);
+                stack[++top] = entry != NULL ? range_value(entry)
+                                             : range_aggregate(ins->func, ins->a, ins->b, ins->c, ins->d);
+                if (stack[top] == ERROR_VALUE) return ERROR_VALUE;
+                break;
+            }
+            case OP_CALL:
+                top -= ins->argc - 1;
+                stack[top] = call_function(ins->func, &stack[top], ins->argc);
+                if (stack[top] == ERROR_VALUE) return ERROR_VALUE;
+                break;
+            case OP_NEG:
+                stack[top] = WRAP_NEG(stack[top]);
+                break;
+            case OP_ADD:
+                top--;
+                stack[top] = WRAP_ADD(stack[top], stack[top + 1]);
+                break;
+            case OP_SUB:
+                top--;
+                stack[top] = WRAP_SUB(stack[top], stack[top + 1]);
+                break;
+            case OP_MUL:
+                top--;
+                stack[top] = WRAP_MUL(stack[top], stack[top + 1]);
+                break;
+            case OP_DIV:
+                top--;
+                if (stack[top + 1] == 0) return ERROR_VALUE;
+                stack[top] = WRAP_DIV(stack[top], stack[top + 1]);
+                break;
+        }
+    }
+    return stack[top];
+}
+
 /**
  * Validates if a range of cells is within bounds and properly ordered
  * @param r1,c1 Starting cell coordinates (0-based)
@@ -175,8 +479,7 @@ void arithmetic(ParsedCommand *result) {
  */
 bool is_valid_range(ParsedCommand* cmd) {
     // For range operations
-    if (cmd->func == FUNC_MIN || cmd->func == FUNC_MAX || cmd->func == FUNC_SUM || 
-        cmd->func == FUNC_AVG || cmd->func == FUNC_STDEV) {
+    if (is_range_function(cmd->func)) {
         
         int r1 = cmd->op2.row - 1;
         int c1 = cmd->op2.col - 1;
@@ -199,6 +502,27 @@ bool is_valid_range(ParsedCommand* cmd) {
     return true;  // Non-range operations are always valid
 }
 
+// Cells changed while recalculation is deferred
+bool defer_recalc = false;
+static int *deferred_rows = NULL;
+static int *deferred_cols = NULL;
+static int deferred_count = 0;
+static int deferred_capacity = 0;
+
+/**
+ * Records a cell whose dependents are recalculated by recalc_deferred()
+ */
+static void defer_cell(int r, int c) {
+    if (deferred_count == deferred_capacity) {
+        deferred_capacity = deferred_capacity == 0 ? 64 : deferred_capacity * 2;
+        deferred_rows = (int *)realloc(deferred_rows, deferred_capacity * sizeof(int));
+        deferred_cols = (int *)realloc(deferred_cols, deferred_capacity * sizeof(int));
+    }
+    deferred_rows[deferred_count] = r;
+    deferred_cols[deferred_count] = c;
+    deferred_count++;
+}
+
 /**
  * Handles dependencies for cell operations
  * - Detects and prevents circular dependencies
@@ -210,7 +534,10 @@ bool handle_dependencies(ParsedCommand *result) {
     if (result->type == CMD_SCROLL || 
         result->type == CMD_SCROLL_DIR || 
         result->type == CMD_CONTROL || 
-        result->type == CMD_INVALID) {
+        result->type == CMD_VIEWPORT ||
+        result->type == CMD_FILE ||
+        result->type == CMD_INVALID ||
+        is_sleep_command(result)) {
         process_command(result);
         return false;
     }
@@ -219,7 +546,7 @@ bool handle_dependencies(ParsedCommand *result) {
     int c1 = result->op1.col - 1;
     
     // Store the original value before processing
-    int original_value = sheet[r1][c1];
+    int original_value = CELL(r1, c1);
 
     // Process the current cell
     if (result->type == CMD_SET_CELL) {
@@ -228,19 +555,27 @@ bool handle_dependencies(ParsedCommand *result) {
         arithmetic(result);
     } else if (result->type == CMD_FUNCTION) {
         function(result);
+    } else if (result->type == CMD_EXPRESSION) {
+        expression(result);
     }
     
     // Check if the value has changed
-    if (sheet[r1][c1] != original_value) {
-        // Update all dependent cells recursively
-        update_dependents(r1, c1);
+    if (CELL(r1, c1) != original_value) {
+        if (defer_recalc) {
+            // Dependents are brought up to date by recalc_deferred()
+            defer_cell(r1, c1);
+        } else {
+            // Update all dependent cells recursively
+            update_dependents(r1, c1);
+        }
     }
     
     return true;
 }
 
 /**
- * Processes function commands (MIN, MAX, AVG, SUM, STDEV, SLEEP)
+ * Processes function commands (MIN, MAX, AVG, SUM, STDEV, SLEEP,
+ * MEDIAN, PERCENTILE, RANK, COUNTIF, SUMIF)
  * - Handles range-based operations
  * - Special handling for SLEEP function:
  *   * Supports both cell reference and direct value for duration
@@ -256,18 +591,18 @@ void function(ParsedCommand *result) {
     int r3 = result->op3.row - 1;
     int c3 = result->op3.col - 1;
     
-    // Store original value in case we need to revert
-    int original_value = sheet[r1][c1];
-    
-    // Remove old dependencies
-    Parent *parent = Parent_lst[r1][c1];
-    while (parent != NULL) {
-        remove_child(parent->r, parent->c, r1, c1);
-        parent = parent->next;
-    }
-    while (Parent_lst[r1][c1] != NULL) {
-        remove_parent(Parent_lst[r1][c1]->r, Parent_lst[r1][c1]->c, r1, c1);
+    // Pin the interned range before dropping the old dependencies, so
+    // re-binding a cell to the same range keeps the existing edges
+    RangeEntry *entry = NULL;
+    if (is_range_function(result->func) && is_valid_range(result)) {
+        entry = range_acquire(result->func, result->func_arg, result->predicate,
+                              r2, c2, r3, c3);
     }
+
+    // Remove old dependencies (and any SLEEP still pending or program compiled for the cell)
+    timer_cancel(r1, c1);
+    formula_release(r1, c1);
+    clear_parents(r1, c1);
     
     if (result->func == FUNC_SLEEP) {
         // Get sleep duration from cell reference or direct value
@@ -283,17 +618,17 @@ void function(ParsedCommand *result) {
                 remove_child(r2, c2, r1, c1);
                 remove_parent(r2, c2, r1, c1);
                 // Set ERROR_VALUE for cycle detection
-                sheet[r1][c1] = ERROR_VALUE;
+                set_cell(r1, c1, ERROR_VALUE);
                 // Set status to "err" for cycle detection
                 strcpy(status, "err");
                 return;
             }
             
-            sleep_duration = sheet[r2][c2];
+            sleep_duration = CELL(r2, c2);
             
             // Check if the referenced cell has an error
             if (sleep_duration == ERROR_VALUE) {
-                sheet[r1][c1] = ERROR_VALUE;
+                set_cell(r1, c1, ERROR_VALUE);
                 return;
             }
         } else {
@@ -302,56 +637,254 @@ void function(ParsedCommand *result) {
 
         // Validate sleep duration
         if (sleep_duration < 0 || sleep_duration > 3600) {
-            sheet[r1][c1] = 0;
+            set_cell(r1, c1, 0);
+            return;
+        }
+
+        // In the REPL the cell stays pending until the timer fires
+        if (sleep_async && sleep_duration > 0) {
+            timer_schedule(r1, c1, sleep_duration, sleep_duration);
             return;
         }
 
         // Perform sleep and store the duration
-        // Use nanosleep for more precise timing
-        struct timespec ts;
-        ts.tv_sec = sleep_duration;
-        ts.tv_nsec = 0;
-        nanosleep(&ts, NULL);
+        // (on the virtual clock this only advances the clock)
+        timer_sleep((long long)sleep_duration * 1000);
         
-        sheet[r1][c1] = sleep_duration;
+        set_cell(r1, c1, sleep_duration);
         return;
     }
 
-    // For range operations, add dependencies for all cells in the range
-    if (result->func == FUNC_MIN || result->func == FUNC_MAX || 
-        result->func == FUNC_SUM || result->func == FUNC_AVG || 
-        result->func == FUNC_STDEV) {
-        
+    // For range operations, subscribe to the interned range
+    if (is_range_function(result->func)) {
         // Validate range
-        if (!is_valid_range(result)) {
+        if (entry == NULL) {
             // Set ERROR_VALUE for invalid range
-            sheet[r1][c1] = ERROR_VALUE;
+            set_cell(r1, c1, ERROR_VALUE);
             return;
         }
         
-        // Add dependencies for all cells in the range
-        for (int i = r2; i <= r3; i++) {
-            for (int j = c2; j <= c3; j++) {
-                assign_parent(i, j, r1, c1, *result);
-                assign_child(i, j, r1, c1, *result);
-            }
-        }
+        range_attach(entry, r1, c1, *result);
         
         // Check for cycles
         if (detect_cycle(r1, c1)) {
-            // Remove all dependencies if cycle is detected
-            for (int i = r2; i <= r3; i++) {
-                for (int j = c2; j <= c3; j++) {
-                    remove_child(i, j, r1, c1);
-                    remove_parent(i, j, r1, c1);
-                }
-            }
+            // Drop the subscription (and the range edges if now unused)
+            clear_parents(r1, c1);
             // Set ERROR_VALUE for cycle detection
-            sheet[r1][c1] = ERROR_VALUE;
+            set_cell(r1, c1, ERROR_VALUE);
             // Set status to "err" for cycle detection
             strcpy(status, "err");
             return;
         }
+        
+        // Shared ranges are computed once and reused by every subscriber
+        set_cell(r1, c1, range_value(entry));
+        return;
+    }
+
+    // FUNC_NONE should never reach this point
+    set_cell(r1, c1, ERROR_VALUE);
+}
+
+/**
+ * Checks whether a function type aggregates a range of cells
+ */
+bool is_range_function(int func) {
+    return func == FUNC_MIN || func == FUNC_MAX || func == FUNC_SUM ||
+           func == FUNC_AVG || func == FUNC_STDEV || is_order_function(func);
+}
+
+/**
+ * Writes a value into a cell
+ * Every cell write goes through here so that the sorted indexes of
+ * order-statistic ranges covering the cell stay up to date
+ */
+void set_cell(int r, int c, int value) {
+    int old_value = CELL(r, c);
+    if (old_value == value) return;
+    CELL(r, c) = value;
+    range_cell_written(r, c, old_value, value);
+}
+
+/**
+ * Partial result of one block of a parallel range reduction
+ * The sum is kept modulo 2^32 so that merging blocks reproduces the
+ * wrap-around of the serial int accumulator bit for bit
+ */
+typedef struct {
+    unsigned int sum;           // Sum of the block (wrapping)
+    int count;                  // Number of cells in the block
+    int min;                    // Smallest value in the block
+    int max;                    // Largest value in the block
+    bool error;                 // Block contains ERROR_VALUE
+    unsigned long long squares; // Sum of squared deviations from the mean (mod 2^64)
+} RangePartial;
+
+/**
+ * A range split into consecutive row (or column) blocks
+ */
+typedef struct {
+    int r1, c1, r2, c2;         // Rectangle being reduced
+    bool by_rows;               // Split along rows instead of columns
+    int blocks;                 // Number of blocks
+    int mean;                   // Integer mean for the STDEV pass
+    RangePartial *parts;        // One partial per block, merged in order
+} ParallelRange;
+
+/**
+ * Computes the rectangle covered by one block
+ */
+static void block_bounds(ParallelRange *job, int index, int *r1, int *c1, int *r2, int *c2) {
+    int first = job->by_rows ? job->r1 : job->c1;
+    int lines = job->by_rows ? (job->r2 - job->r1 + 1) : (job->c2 - job->c1 + 1);
+    int lo = first + (int)((long)lines * index / job->blocks);
+    int hi = first + (int)((long)lines * (index + 1) / job->blocks) - 1;
+
+    *r1 = job->by_rows ? lo : job->r1;
+    *r2 = job->by_rows ? hi : job->r2;
+    *c1 = job->by_rows ? job->c1 : lo;
+    *c2 = job->by_rows ? job->c2 : hi;
+}
+
+/**
+ * Pool task: sum, count, extremes and error flag of one block
+ */
+static void reduce_block(void *arg, int index) {
+    ParallelRange *job = (ParallelRange *)arg;
+    RangePartial *part = &job->parts[index];
+    int r1, c1, r2, c2;
+    block_bounds(job, index, &r1, &c1, &r2, &c2);
+
+    part->sum = 0;
+    part->count = 0;
+    part->min = INT_MAX;
+    part->max = INT_MIN;
+    part->error = false;
+    CellSpan span = cell_span(r1, c1, r2, c2);
+    int *line;
+    while ((line = span_next(&span)) != NULL) {
+        for (int k = 0; k < span.length; k++) {
+            int value = line[k];
+            if (value == ERROR_VALUE) {
+                part->error = true;
+                return;
+            }
+            part->sum += (unsigned int)value;
+            part->count++;
+            if (value < part->min) part->min = value;
+            if (value > part->max) part->max = value;
+        }
+    }
+}
+
+/**
+ * Pool task: squared deviations of one block from the shared mean
+ * Each term is computed exactly like the serial loop before it is added
+ */
+static void deviation_block(void *arg, int index) {
+    ParallelRange *job = (ParallelRange *)arg;
+    int r1, c1, r2, c2;
+    block_bounds(job, index, &r1, &c1, &r2, &c2);
+
+    unsigned long long squares = 0;
+    CellSpan span = cell_span(r1, c1, r2, c2);
+    int *line;
+    while ((line = span_next(&span)) != NULL) {
+        for (int k = 0; k < span.length; k++) {
+            unsigned long long deviation = (unsigned long long)((long long)line[k] - job->mean);
+            squares += deviation * deviation;
+        }
+    }
+    job->parts[index].squares = squares;
+}
+
+/**
+ * Computes a range function by reducing blocks of the range on the pool
+ * - Partials are merged in block order, so the result does not depend on
+ *   which thread finished first
+ * - Returns exactly what the serial loop in range_aggregate() returns
+ */
+static int parallel_aggregate(int func, int r2, int c2, int r3, int c3) {
+    ParallelRange job;
+    job.r1 = r2;
+    job.c1 = c2;
+    job.r2 = r3;
+    job.c2 = c3;
+    job.by_rows = (r3 - r2) >= (c3 - c2);
+
+    int lines = job.by_rows ? (r3 - r2 + 1) : (c3 - c2 + 1);
+    job.blocks = pool_threads * 4;
+    if (job.blocks > lines) job.blocks = lines;
+    job.parts = (RangePartial *)malloc(job.blocks * sizeof(RangePartial));
+
+    pool_run(reduce_block, &job, job.blocks);
+
+    // Merge the partials in block order
+    unsigned int sum = 0;
+    int count = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+    for (int b = 0; b < job.blocks; b++) {
+        if (job.parts[b].error) {
+            free(job.parts);
+            return ERROR_VALUE;
+        }
+        sum += job.parts[b].sum;
+        count += job.parts[b].count;
+        if (job.parts[b].min < min) min = job.parts[b].min;
+        if (job.parts[b].max > max) max = job.parts[b].max;
+    }
+
+    if (count == 0) {
+        free(job.parts);
+        return ERROR_VALUE;
+    }
+
+    int total = (int)sum;
+    int std_dev = 0;
+    if (func == FUNC_STDEV && count > 1) {
+        job.mean = total / count;
+        pool_run(deviation_block, &job, job.blocks);
+
+        unsigned long long squares = 0;
+        for (int b = 0; b < job.blocks; b++) {
+            squares += job.parts[b].squares;
+        }
+        std_dev = (int)round(sqrt((double)squares / count));
+    }
+    free(job.parts);
+
+    switch (func) {
+        case FUNC_MIN:
+            return min;
+        case FUNC_MAX:
+            return max;
+        case FUNC_SUM:
+            return total;
+        case FUNC_AVG:
+            return total / count;
+        case FUNC_STDEV:
+            return std_dev;
+        default:
+            return ERROR_VALUE;
+    }
+}
+
+/**
+ * Computes a range function over the rectangle (r2, c2)..(r3, c3)
+ * - Any ERROR_VALUE in the range makes the result ERROR_VALUE
+ * - AVG and STDEV use integer arithmetic like the rest of the sheet: the
+ *   sum wraps like SUM, and STDEV squares the deviations from the integer
+ *   mean exactly, summing them modulo 2^64
+ * - Ranges of at least parallel_min_cells cells are reduced on the pool
+ * - A large range of a backed grid is read ahead before the scan
+ * @return The aggregate value
+ */
+int range_aggregate(int func, int r2, int c2, int r3, int c3) {
+    long cells = (long)(r3 - r2 + 1) * (c3 - c2 + 1);
+    sheet_advise(r2, c2, r3, c3);
+    if (pool_threads > 1 && cells >= parallel_min_cells) {
+        return parallel_aggregate(func, r2, c2, r3, c3);
     }
 
     // Initialize variables for range operations
@@ -361,15 +894,16 @@ void function(ParsedCommand *result) {
     int max = INT_MIN;
     int std_dev = 0;
     
-    // Calculate range statistics
-    for (int i = r2; i <= r3; i++) {
-        for (int j = c2; j <= c3; j++) {
-            int value = sheet[i][j];
+    // Calculate range statistics, one contiguous line at a time
+    CellSpan span = cell_span(r2, c2, r3, c3);
+    int *line;
+    while ((line = span_next(&span)) != NULL) {
+        for (int k = 0; k < span.length; k++) {
+            int value = line[k];
             if (value == ERROR_VALUE) {
-                sheet[r1][c1] = ERROR_VALUE;
-                return;
+                return ERROR_VALUE;
             }
-            sum += value;
+            sum = WRAP_ADD(sum, value);
             count++;
             if (value < min) min = value;
             if (value > max) max = value;
@@ -378,54 +912,41 @@ void function(ParsedCommand *result) {
 
     // Handle empty range
     if (count == 0) {
-        sheet[r1][c1] = ERROR_VALUE;
-        return;
+        return ERROR_VALUE;
     }
 
     // Calculate standard deviation if needed
-    if (count <= 1) {
-        std_dev = 0;  // Avoid division by zero
-    } else {
+    if (func == FUNC_STDEV && count > 1) {
         int mean = sum / count;
-        double variance = 0.0;
+        unsigned long long squares = 0;
 
-        for (int i = r2; i <= r3; i++) {
-            for (int j = c2; j <= c3; j++) {
-                variance += (sheet[i][j] - mean) * (sheet[i][j] - mean);
+        span = cell_span(r2, c2, r3, c3);
+        while ((line = span_next(&span)) != NULL) {
+            for (int k = 0; k < span.length; k++) {
+                unsigned long long deviation = (unsigned long long)((long long)line[k] - mean);
+                squares += deviation * deviation;
             }
         }
-        
-        // Calculate variance
-        variance /= count;
 
         // Return integer standard deviation (rounded)
-        std_dev = (int)round(sqrt(variance));
+        std_dev = (int)round(sqrt((double)squares / count));
     }
 
-    // Set the result based on the function type
-    switch (result->func) {
+    // Return the result based on the function type
+    switch (func) {
         case FUNC_MIN:
-            sheet[r1][c1] = min;
-            break;
+            return min;
         case FUNC_MAX:
-            sheet[r1][c1] = max;
-            break;
+            return max;
         case FUNC_SUM:
-            sheet[r1][c1] = sum;
-            break;
+            return sum;
         case FUNC_AVG:
-            sheet[r1][c1] = sum / count;
-            break;
+            return sum / count;
         case FUNC_STDEV:
-            sheet[r1][c1] = std_dev;
-            break;
-        case FUNC_SLEEP:
-            // Sleep function is handled separately, nothing to do here
-            break;
-        case FUNC_NONE:
+            return std_dev;
+        default:
             // This should never happen in this context
-            sheet[r1][c1] = ERROR_VALUE;
-            break;
+            return ERROR_VALUE;
     }
 }
 
@@ -434,15 +955,27 @@ void function(ParsedCommand *result) {
  * - Routes commands to appropriate handlers
  * - Handles all command types:
  *   * Cell operations (SET, ARITHMETIC, FUNCTION)
- *   * Navigation (SCROLL, SCROLL_DIR)
+ *   * Navigation (SCROLL, SCROLL_DIR, VIEWPORT)
+ *   * Snapshots (save, load, bgsave, bgsave_status)
  *   * Control commands (enable/disable_output)
  *   * Sleep commands
  */
 void process_command(ParsedCommand *result) {
+    // A bare sleep, or SLEEP(n) on its own, waits without writing a cell
+    if (is_sleep_command(result)) {
+        if (sleep_async) {
+            timer_schedule(-1, -1, 0, result->sleep_duration);
+        } else {
+            timer_sleep((long long)result->sleep_duration * 1000);
+        }
+        return;
+    }
+
     // For cell operations, use handle_dependencies to ensure proper dependency updates
     if (result->type == CMD_SET_CELL || 
         result->type == CMD_ARITHMETIC || 
-        result->type == CMD_FUNCTION) {
+        result->type == CMD_FUNCTION ||
+        result->type == CMD_EXPRESSION) {
         handle_dependencies(result);
         return;
     }
@@ -466,6 +999,49 @@ void process_command(ParsedCommand *result) {
                 }
             }
             break;
+        case CMD_VIEWPORT:
+            set_viewport(result->op1.row, result->op1.col);
+            break;
+        case CMD_FILE:
+            if (strcmp(result->control_cmd, "save") == 0) {
+                if (!snapshot_save(result->expression)) strcpy(status, "save failed");
+            } else if (strcmp(result->control_cmd, "load") == 0) {
+                if (!snapshot_load(result->expression)) strcpy(status, "load failed");
+            } else if (strcmp(result->control_cmd, "bgsave") == 0) {
+                // One background save at a time
+                if (snapshot_bgsave_poll(false) == BGSAVE_RUNNING) {
+                    strcpy(status, "saving");
+                } else if (!snapshot_bgsave(result->expression)) {
+                    strcpy(status, "save failed");
+                }
+            } else if (strcmp(result->control_cmd, "bgsave_status") == 0) {
+                switch (snapshot_bgsave_poll(false)) {
+                    case BGSAVE_NONE: strcpy(status, "no bgsave"); break;
+                    case BGSAVE_RUNNING: strcpy(status, "saving"); break;
+                    case BGSAVE_DONE: strcpy(status, "saved"); break;
+                    case BGSAVE_FAILED: strcpy(status, "save failed"); break;
+                }
+            } else if (strcmp(result->control_cmd, "import") == 0) {
+                if (!import_csv(result->expression, result->op1.row - 1, result->op1.col - 1)) {
+                    strcpy(status, "import failed");
+                }
+            } else if (strncmp(result->control_cmd, "export", 6) == 0) {
+                // Without a range the whole sheet is written
+                int r1 = 0, c1 = 0, r2 = MAXROW - 1, c2 = MAXCOL - 1;
+                if (result->op2.row != 0) {
+                    r1 = result->op2.row - 1;
+                    c1 = result->op2.col - 1;
+                    r2 = result->op3.row - 1;
+                    c2 = result->op3.col - 1;
+                }
+                bool formulas = strcmp(result->control_cmd, "export_formulas") == 0;
+                if (r1 > r2 || c1 > c2) {
+                    strcpy(status, "Invalid range");
+                } else if (!export_file(result->expression, r1, c1, r2, c2, formulas)) {
+                    strcpy(status, "export failed");
+                }
+            }
+            break;
         case CMD_CONTROL:
             if (strcmp(result->control_cmd, "disable_output") == 0) {
                 disable_output();
@@ -473,9 +1049,6 @@ void process_command(ParsedCommand *result) {
                 enable_output();
             }
             break;
-        case CMD_SLEEP:
-            sleep((unsigned int) result->sleep_duration);
-            break;
         case CMD_INVALID:
             // Handle invalid command
             break;
@@ -485,6 +1058,15 @@ void process_command(ParsedCommand *result) {
     }
 }
 
+/**
+ * Checks if a command only waits: the sleep command, or SLEEP(n) with no
+ * target cell
+ */
+bool is_sleep_command(const ParsedCommand *cmd) {
+    return cmd->type == CMD_SLEEP ||
+           (cmd->type == CMD_FUNCTION && cmd->func == FUNC_SLEEP && cmd->op1.row == 0);
+}
+
 /**
  * Checks if the value being assigned is a valid numeric value
  */
@@ -505,50 +1087,99 @@ bool is_numeric_value(ParsedCommand* cmd) {
     return true;  // Other command types are considered valid
 }
 
+/**
+ * Re-evaluates the formula of a cell after one of its inputs changed
+ * - In the REPL a SLEEP starts waiting again on its timer, so every SLEEP
+ *   dirtied by the same change sleeps at the same time and the cells
+ *   downstream of it are held back until it fires
+ * - Otherwise SLEEP just stores the new duration without sleeping
+ */
+static void recompute_formula(ParsedCommand *cmd) {
+    if (cmd->type == CMD_ARITHMETIC && cmd->kernel != NULL) {
+        // The operands of a bound formula never change, so only its kernel
+        // is run again
+        set_cell(cmd->op1.row - 1, cmd->op1.col - 1, cmd->kernel(cmd));
+    } else if (cmd->type == CMD_ARITHMETIC) {
+        // Formula stored without being bound: bind and evaluate it
+        arithmetic(cmd);
+    } else if (cmd->type == CMD_FUNCTION && cmd->func != FUNC_SLEEP) {
+        // Recalculate function (except SLEEP)
+        function(cmd);
+    } else if (cmd->type == CMD_SET_CELL) {
+        // Update cell reference
+        assign(cmd);
+    } else if (cmd->type == CMD_EXPRESSION) {
+        // The references of a compiled expression never change, so only
+        // the program is run again
+        set_cell(cmd->op1.row - 1, cmd->op1.col - 1, evaluate_program(cmd->program));
+    } else if (cmd->type == CMD_FUNCTION && cmd->func == FUNC_SLEEP) {
+        int r1 = cmd->op1.row - 1;
+        int c1 = cmd->op1.col - 1;
+        int r2 = cmd->op2.row - 1;
+        int c2 = cmd->op2.col - 1;
+
+        // Get sleep duration without sleeping
+        int sleep_duration;
+        if (cmd->op2.row != 0 && cmd->op2.col != 0) {
+            sleep_duration = CELL(r2, c2);
+        } else {
+            sleep_duration = cmd->op2.value;
+        }
+
+        if (sleep_duration >= 0 && sleep_duration <= 3600) {
+            if (sleep_async && sleep_duration > 0) {
+                timer_schedule(r1, c1, sleep_duration, sleep_duration);
+            } else {
+                timer_cancel(r1, c1);
+                set_cell(r1, c1, sleep_duration);
+            }
+        }
+    }
+}
+
 /**
  * Recursively updates all cells that depend on the given cell
  */
 void update_dependents(int row, int col) {
+    // Mark every range covering this cell before evaluating any of them,
+    // so runs of shifted windows can be recomputed together
+    for (Child *child = Child_lst[row][col]; child != NULL; child = child->next) {
+        if (child->range != NULL) {
+            child->range->dirty = true;
+        }
+    }
+
     // Create a temporary copy of the child list to avoid issues with list modification during traversal
     Child *current = Child_lst[row][col];
     
     // Process each child that depends on this cell
     while (current != NULL) {
+        if (current->range != NULL) {
+            // Recompute the shared range once and fan the result out
+            RangeEntry *entry = current->range;
+            Child *next_child = current->next;
+            int value = range_value(entry);
+            for (Subscriber *sub = entry->subs; sub != NULL; sub = sub->next) {
+                ParsedCommand cmd = Parent_lst[sub->r][sub->c]->formula;
+                if (cmd.type == CMD_EXPRESSION) {
+                    // An expression reads the range as one of its operands
+                    recompute_formula(&cmd);
+                } else {
+                    set_cell(sub->r, sub->c, value);
+                }
+                update_dependents(sub->r, sub->c);
+            }
+            current = next_child;
+            continue;
+        }
+
         int child_r = current->r;
         int child_c = current->c;
         ParsedCommand cmd = current->formula;
         Child *next_child = current->next; // Save next pointer before processing
         
         // Process the child's formula based on its type
-        if (cmd.type == CMD_ARITHMETIC) {
-            // Recalculate arithmetic operation
-            arithmetic(&cmd);
-        } else if (cmd.type == CMD_FUNCTION && cmd.func != FUNC_SLEEP) {
-            // Recalculate function (except SLEEP)
-            function(&cmd);
-        } else if (cmd.type == CMD_SET_CELL) {
-            // Update cell reference
-            assign(&cmd);
-        } else if (cmd.type == CMD_FUNCTION && cmd.func == FUNC_SLEEP) {
-            // For SLEEP functions, just update the value without sleeping again
-            int r1 = cmd.op1.row - 1;
-            int c1 = cmd.op1.col - 1;
-            int r2 = cmd.op2.row - 1;
-            int c2 = cmd.op2.col - 1;
-            
-            // Get sleep duration without sleeping
-            int sleep_duration;
-            if (cmd.op2.row != 0 && cmd.op2.col != 0) {
-                sleep_duration = sheet[r2][c2];
-            } else {
-                sleep_duration = cmd.op2.value;
-            }
-            
-            // Just update the cell value without sleeping
-            if (sleep_duration >= 0 && sleep_duration <= 3600) {
-                sheet[r1][c1] = sleep_duration;
-            }
-        }
+        recompute_formula(&cmd);
         
         // Recursively update this child's dependents
         update_dependents(child_r, child_c);
@@ -557,3 +1188,221 @@ void update_dependents(int row, int col) {
         current = next_child;
     }
 }
+
+/**
+ * Cell taking part in a recalculation wave
+ */
+typedef struct WaveNode {
+    int r, c;                   // Cell coordinates
+    int indegree;               // Parents inside the wave not yet evaluated
+    bool stale;                 // A parent changed, so the cell is recomputed
+    bool root;                  // Value was stored directly (fired SLEEP)
+} WaveNode;
+
+/**
+ * Affected subgraph of a recalculation wave
+ * Cells are numbered in discovery order and found through an
+ * open-addressing table keyed by their coordinates
+ */
+typedef struct Wave {
+    WaveNode *nodes;            // Cells of the wave
+    int count;                  // Number of cells
+    int capacity;               // Allocated cells (the table has twice as many slots)
+    int *slots;                 // Cell index per slot (-1 = empty)
+} Wave;
+
+/**
+ * Returns the table slot of a cell (its own slot or the empty one it belongs in)
+ */
+static int wave_slot(Wave *wave, int r, int c) {
+    int mask = wave->capacity * 2 - 1;
+    int slot = (int)(((unsigned)r * 2654435761u ^ (unsigned)c * 40503u) & (unsigned)mask);
+    while (wave->slots[slot] != -1) {
+        WaveNode *node = &wave->nodes[wave->slots[slot]];
+        if (node->r == r && node->c == c) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * Returns the index of a cell in the wave, adding it if needed
+ */
+static int wave_add(Wave *wave, int r, int c) {
+    int slot = wave_slot(wave, r, c);
+    if (wave->slots[slot] != -1) return wave->slots[slot];
+
+    if (wave->count == wave->capacity) {
+        wave->capacity *= 2;
+        wave->nodes = (WaveNode *)realloc(wave->nodes, wave->capacity * sizeof(WaveNode));
+        free(wave->slots);
+        wave->slots = (int *)malloc(wave->capacity * 2 * sizeof(int));
+        for (int i = 0; i < wave->capacity * 2; i++) wave->slots[i] = -1;
+        for (int i = 0; i < wave->count; i++) {
+            wave->slots[wave_slot(wave, wave->nodes[i].r, wave->nodes[i].c)] = i;
+        }
+        slot = wave_slot(wave, r, c);
+    }
+
+    wave->nodes[wave->count] = (WaveNode){.r = r, .c = c, .indegree = 0, .stale = false, .root = false};
+    wave->slots[slot] = wave->count;
+    return wave->count++;
+}
+
+/**
+ * Returns the index of a cell already in the wave
+ */
+static int wave_find(Wave *wave, int r, int c) {
+    return wave->slots[wave_slot(wave, r, c)];
+}
+
+/**
+ * Re-evaluates one cell of a wave from its own formula
+ */
+static void wave_recompute(int r, int c) {
+    Parent *parent = Parent_lst[r][c];
+    if (parent == NULL) return;
+
+    if (parent->range != NULL && parent->formula.type != CMD_EXPRESSION) {
+        set_cell(r, c, range_value(parent->range));
+    } else {
+        ParsedCommand cmd = parent->formula;
+        recompute_formula(&cmd);
+    }
+}
+
+/**
+ * Recalculates everything downstream of a set of cells whose values were
+ * just stored, visiting each affected cell once and only after all of its
+ * affected parents (Kahn's algorithm over the affected subgraph)
+ * Cells none of whose parents changed keep their value, so a SLEEP that is
+ * still pending holds back its downstream cells until its timer fires
+ * @param recompute_roots Also recompute a root whose parents changed (its
+ *        formula was bound before they got their final values)
+ */
+static void recalc_wave(int count, const int *rows, const int *cols, bool recompute_roots) {
+    Wave wave;
+    wave.capacity = 64;
+    while (wave.capacity < count * 2) wave.capacity *= 2;
+    wave.count = 0;
+    wave.nodes = (WaveNode *)malloc(wave.capacity * sizeof(WaveNode));
+    wave.slots = (int *)malloc(wave.capacity * 2 * sizeof(int));
+    for (int i = 0; i < wave.capacity * 2; i++) wave.slots[i] = -1;
+
+    for (int i = 0; i < count; i++) {
+        int index = wave_add(&wave, rows[i], cols[i]);
+        wave.nodes[index].root = true;
+    }
+
+    // Discover the affected cells breadth-first and count the edges among them
+    // (wave_add may move the nodes, so they are indexed only after it returns)
+    for (int i = 0; i < wave.count; i++) {
+        int r = wave.nodes[i].r;
+        int c = wave.nodes[i].c;
+        for (Child *child = Child_lst[r][c]; child != NULL; child = child->next) {
+            if (child->range != NULL) {
+                for (Subscriber *sub = child->range->subs; sub != NULL; sub = sub->next) {
+                    int index = wave_add(&wave, sub->r, sub->c);
+                    wave.nodes[index].indegree++;
+                }
+            } else {
+                int index = wave_add(&wave, child->r, child->c);
+                wave.nodes[index].indegree++;
+            }
+        }
+    }
+
+    int *ready = (int *)malloc(wave.count * sizeof(int));
+    int head = 0, tail = 0;
+    for (int i = 0; i < wave.count; i++) {
+        if (wave.nodes[i].indegree == 0) ready[tail++] = i;
+    }
+
+    while (head < tail) {
+        int index = ready[head++];
+        int r = wave.nodes[index].r;
+        int c = wave.nodes[index].c;
+
+        bool changed = wave.nodes[index].root;
+        if (wave.nodes[index].stale && (!wave.nodes[index].root || recompute_roots)) {
+            int old_value = CELL(r, c);
+            wave_recompute(r, c);
+            changed = changed || CELL(r, c) != old_value;
+        }
+
+        for (Child *child = Child_lst[r][c]; child != NULL; child = child->next) {
+            if (child->range != NULL) {
+                if (changed) child->range->dirty = true;
+                for (Subscriber *sub = child->range->subs; sub != NULL; sub = sub->next) {
+                    WaveNode *node = &wave.nodes[wave_find(&wave, sub->r, sub->c)];
+                    if (changed) node->stale = true;
+                    if (--node->indegree == 0) ready[tail++] = (int)(node - wave.nodes);
+                }
+            } else {
+                WaveNode *node = &wave.nodes[wave_find(&wave, child->r, child->c)];
+                if (changed) node->stale = true;
+                if (--node->indegree == 0) ready[tail++] = (int)(node - wave.nodes);
+            }
+        }
+    }
+
+    free(ready);
+    free(wave.nodes);
+    free(wave.slots);
+}
+
+/**
+ * Completes a batch of non-blocking SLEEPs whose timers fired together
+ * Every result is stored first and the cells downstream are then
+ * recalculated in a single topologically ordered wave
+ */
+void complete_sleeps(int count, const int *rows, const int *cols, const int *values) {
+    int changed = 0;
+    int *changed_rows = (int *)malloc(count * sizeof(int));
+    int *changed_cols = (int *)malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        if (CELL(rows[i], cols[i]) == values[i]) continue;
+        set_cell(rows[i], cols[i], values[i]);
+        changed_rows[changed] = rows[i];
+        changed_cols[changed] = cols[i];
+        changed++;
+    }
+
+    if (changed > 0) {
+        recalc_wave(changed, changed_rows, changed_cols, false);
+    }
+    free(changed_rows);
+    free(changed_cols);
+}
+
+/**
+ * Recalculates everything downstream of cells written directly into the
+ * sheet (their range indexes must already be up to date)
+ * While recalculation is deferred the cells are only recorded
+ */
+void recalc_cells(int count, const int *rows, const int *cols) {
+    if (defer_recalc) {
+        for (int i = 0; i < count; i++) {
+            defer_cell(rows[i], cols[i]);
+        }
+    } else if (count > 0) {
+        recalc_wave(count, rows, cols, false);
+    }
+}
+
+/**
+ * Ends a stretch of deferred recalculation
+ * Everything downstream of the cells changed meanwhile is recalculated in
+ * a single topologically ordered wave, so each affected cell runs once
+ */
+void recalc_deferred() {
+    if (deferred_count > 0) {
+        recalc_wave(deferred_count, deferred_rows, deferred_cols, true);
+    }
+    free(deferred_rows);
+    free(deferred_cols);
+    deferred_rows = NULL;
+    deferred_cols = NULL;
+    deferred_count = 0;
+    deferred_capacity = 0;
+}
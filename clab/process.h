@@ -18,14 +18,35 @@
     #define FUNC_AVG    4    // Average of values in range
     #define FUNC_STDEV  5    // Standard deviation of values in range
     #define FUNC_SLEEP  6    // Sleep operation
+    #define FUNC_MEDIAN 7    // Median of values in range
+    #define FUNC_PERCENTILE 8  // Percentile of values in range
+    #define FUNC_RANK   9    // Descending rank of a value within range
+    #define FUNC_COUNTIF 10  // Count of values in range matching a condition
+    #define FUNC_SUMIF  11   // Sum of values in range matching a condition
+
+    struct Program;                                      // Compiled expression (formula.h)
+
+    // Recalculation control
+    extern bool defer_recalc;                            // Collect changed cells instead of updating dependents
 
     // Core processing functions
     void assign(ParsedCommand *result);                  // Handle cell assignments
     void arithmetic(ParsedCommand *result);              // Process arithmetic operations
     void function(ParsedCommand *result);                // Execute spreadsheet functions
+    void expression(ParsedCommand *result);              // Bind and evaluate a compiled expression
+    void restore_formula(ParsedCommand *result);         // Re-create the dependencies of a saved formula
+    int evaluate_program(const struct Program *program); // Run the bytecode of a compiled expression
+    int call_function(int func, const int *values, int count);  // Apply MIN/MAX/SUM/AVG/STDEV to a list of values
     void process_command(ParsedCommand *result);         // Main command processor
     bool handle_dependencies(ParsedCommand* result);      // Manage cell dependencies
     bool is_valid_range(ParsedCommand* cmd);             // Validate cell ranges
     bool is_numeric_value(ParsedCommand* cmd);           // Check for valid numeric input
+    bool is_sleep_command(const ParsedCommand *cmd);     // Check for a sleep that writes no cell
+    bool is_range_function(int func);                    // Check if function aggregates a range
+    int range_aggregate(int func, int r1, int c1, int r2, int c2);  // Evaluate a range function
+    void set_cell(int r, int c, int value);              // Write a cell and maintain range indexes
+    void complete_sleeps(int count, const int *rows, const int *cols, const int *values);  // Store a batch of fired SLEEP timers
+    void recalc_cells(int count, const int *rows, const int *cols);  // Update everything downstream of cells written directly
+    void recalc_deferred();                              // Update everything downstream of the cells changed while deferring
 
 #endif
\ No newline at end of file
@@ -0,0 +1,501 @@
+/**
+ * range.c
+ * Interning of range expressions such as SUM(A1:A999)
+ * - One entry per (function, rectangle) pair
+ * - Dependency edges are registered once per entry instead of once per cell
+ * - The aggregate is evaluated once and fanned out to every subscriber
+ * - Runs of windows shifted by one row or column are evaluated together
+ *   with a sliding window instead of one full scan per window
+ * - MEDIAN, PERCENTILE, RANK, COUNTIF and SUMIF entries keep an
+ *   order-statistic tree of their cells, patched on every write instead
+ *   of sorting or scanning the range per evaluation; each cell lists the
+ *   trees covering it, apart from its child edges
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include "init.h"
+#include "process.h"
+#include "dependent.h"
+#include "range.h"
+#include "storage.h"
+
+static RangeEntry *range_table[RANGE_BUCKETS];
+
+// MAXROW x MAXCOL heads of the lists of indexed entries covering each cell
+static RangeRef **indexes = NULL;
+
+/**
+ * Returns the head of the list of indexed entries covering (r, c)
+ */
+static inline RangeRef **index_list(int r, int c) {
+    return &indexes[(size_t)r * MAXCOL + c];
+}
+
+/**
+ * Hashes a (function, argument, condition, rectangle) key into a bucket index
+ */
+static unsigned int range_hash(int func, int arg, int pred, int r1, int c1, int r2, int c2) {
+    unsigned int h = 2166136261u;
+    int key[7] = {func, arg, pred, r1, c1, r2, c2};
+    for (int i = 0; i < 7; i++) {
+        h = (h ^ (unsigned int)key[i]) * 16777619u;
+    }
+    return h % RANGE_BUCKETS;
+}
+
+/**
+ * Function to create the intern table (initialize all buckets to NULL)
+ */
+void make_range_table() {
+    for (int i = 0; i < RANGE_BUCKETS; i++) {
+        range_table[i] = NULL;
+    }
+    indexes = (RangeRef **)table_alloc(TABLE_INDEXES, sizeof(RangeRef *));
+}
+
+/**
+ * Function to free every interned range, its subscribers and its index refs
+ * The child edges pointing to the entries are owned by Child_lst
+ */
+void free_range_table() {
+    for (int i = 0; i < RANGE_BUCKETS; i++) {
+        RangeEntry *entry = range_table[i];
+        while (entry != NULL) {
+            RangeEntry *next = entry->next;
+            while (entry->subs != NULL) {
+                Subscriber *temp = entry->subs;
+                entry->subs = temp->next;
+                free(temp);
+            }
+            if (entry->order != NULL) {
+                // Only indexed entries put refs in their cells
+                for (int r = entry->r1; r <= entry->r2; r++) {
+                    for (int c = entry->c1; c <= entry->c2; c++) {
+                        while (*index_list(r, c) != NULL) {
+                            RangeRef *temp = *index_list(r, c);
+                            *index_list(r, c) = temp->next;
+                            free(temp);
+                        }
+                    }
+                }
+            }
+            order_free(entry->order);
+            free(entry);
+            entry = next;
+        }
+        range_table[i] = NULL;
+    }
+    table_free(TABLE_INDEXES, indexes, sizeof(RangeRef *));
+    indexes = NULL;
+}
+
+/**
+ * Finds an interned range without creating it
+ * @return The entry, or NULL if no cell uses this range expression
+ */
+RangeEntry *range_lookup(int func, int arg, int pred, int r1, int c1, int r2, int c2) {
+    RangeEntry *entry = range_table[range_hash(func, arg, pred, r1, c1, r2, c2)];
+    while (entry != NULL) {
+        if (entry->func == func && entry->arg == arg && entry->pred == pred &&
+            entry->r1 == r1 && entry->c1 == c1 &&
+            entry->r2 == r2 && entry->c2 == c2) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+/**
+ * Interns a range expression and pins it
+ * - A new entry registers one child edge in every cell of the rectangle
+ * - The pin keeps the entry (and its edges) alive while the caller
+ *   removes the old dependencies of the target cell
+ * - Order-statistic entries index the current values of the rectangle
+ */
+RangeEntry *range_acquire(int func, int arg, int pred, int r1, int c1, int r2, int c2) {
+    RangeEntry *entry = range_lookup(func, arg, pred, r1, c1, r2, c2);
+    if (entry != NULL) {
+        entry->refcount++;
+        return entry;
+    }
+
+    entry = (RangeEntry *)malloc(sizeof(RangeEntry));
+    entry->func = func;
+    entry->arg = arg;
+    entry->pred = pred;
+    entry->r1 = r1;
+    entry->c1 = c1;
+    entry->r2 = r2;
+    entry->c2 = c2;
+    entry->value = 0;
+    entry->dirty = true;
+    entry->refcount = 1;
+    entry->subs = NULL;
+    entry->order = NULL;
+    entry->errors = 0;
+
+    unsigned int bucket = range_hash(func, arg, pred, r1, c1, r2, c2);
+    entry->next = range_table[bucket];
+    range_table[bucket] = entry;
+
+    for (int i = r1; i <= r2; i++) {
+        for (int j = c1; j <= c2; j++) {
+            assign_range_child(i, j, entry);
+        }
+    }
+
+    if (is_order_function(func)) {
+        entry->order = order_new();
+        for (int i = r1; i <= r2; i++) {
+            for (int j = c1; j <= c2; j++) {
+                RangeRef *ref = (RangeRef *)malloc(sizeof(RangeRef));
+                ref->range = entry;
+                ref->next = *index_list(i, j);
+                *index_list(i, j) = ref;
+
+                if (CELL(i, j) == ERROR_VALUE) {
+                    entry->errors++;
+                } else {
+                    order_insert(entry->order, CELL(i, j));
+                }
+            }
+        }
+    }
+    return entry;
+}
+
+/**
+ * Subscribes cell (r, c) to a pinned entry
+ * The pin taken by range_acquire becomes the subscription reference
+ */
+void range_attach(RangeEntry *entry, int r, int c, ParsedCommand formula) {
+    Subscriber *sub = (Subscriber *)malloc(sizeof(Subscriber));
+    sub->r = r;
+    sub->c = c;
+    sub->next = entry->subs;
+    entry->subs = sub;
+    assign_range_parent(r, c, entry, formula);
+}
+
+/**
+ * Removes cell (r, c) from the subscribers of an entry
+ * The last reference removes the child edges and frees the entry
+ */
+void range_unsubscribe(RangeEntry *entry, int r, int c) {
+    Subscriber **link = &entry->subs;
+    while (*link != NULL) {
+        if ((*link)->r == r && (*link)->c == c) {
+            Subscriber *temp = *link;
+            *link = temp->next;
+            free(temp);
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    if (--entry->refcount > 0) return;
+
+    for (int i = entry->r1; i <= entry->r2; i++) {
+        for (int j = entry->c1; j <= entry->c2; j++) {
+            remove_range_child(i, j, entry);
+            if (entry->order == NULL) continue;
+            RangeRef **ref = index_list(i, j);
+            while ((*ref)->range != entry) {
+                ref = &(*ref)->next;
+            }
+            RangeRef *temp = *ref;
+            *ref = temp->next;
+            free(temp);
+        }
+    }
+
+    RangeEntry **bucket = &range_table[range_hash(entry->func, entry->arg, entry->pred, entry->r1, entry->c1,
+                                                  entry->r2, entry->c2)];
+    while (*bucket != entry) {
+        bucket = &(*bucket)->next;
+    }
+    *bucket = entry->next;
+    order_free(entry->order);
+    free(entry);
+}
+
+/**
+ * Checks whether a function can be evaluated with a sliding window
+ */
+static bool is_sliding_function(int func) {
+    return func == FUNC_MIN || func == FUNC_MAX || func == FUNC_SUM ||
+           func == FUNC_AVG || func == FUNC_STDEV;
+}
+
+/**
+ * Collects the run of dirty entries that contains an entry
+ * - The run is a chain of windows with the same function and size,
+ *   each shifted by (dr, dc) from the previous one
+ * @return Number of entries stored in run (0 if shorter than RANGE_RUN_MIN)
+ */
+static int collect_run(RangeEntry *entry, int dr, int dc, RangeEntry ***run) {
+    RangeEntry *first = entry;
+    RangeEntry *prev;
+    while ((prev = range_lookup(first->func, first->arg, first->pred, first->r1 - dr, first->c1 - dc,
+                                first->r2 - dr, first->c2 - dc)) != NULL && prev->dirty) {
+        first = prev;
+    }
+
+    int n = 1;
+    RangeEntry *last = first;
+    RangeEntry *next;
+    while ((next = range_lookup(last->func, last->arg, last->pred, last->r1 + dr, last->c1 + dc,
+                                last->r2 + dr, last->c2 + dc)) != NULL && next->dirty) {
+        last = next;
+        n++;
+    }
+    if (n < RANGE_RUN_MIN) return 0;
+
+    *run = (RangeEntry **)malloc(n * sizeof(RangeEntry *));
+    (*run)[0] = first;
+    for (int k = 1; k < n; k++) {
+        RangeEntry *p = (*run)[k - 1];
+        (*run)[k] = range_lookup(p->func, p->arg, p->pred, p->r1 + dr, p->c1 + dc, p->r2 + dr, p->c2 + dc);
+    }
+    return n;
+}
+
+/**
+ * Evaluates a run of shifted windows in one pass
+ * - Each line (row for vertical runs, column for horizontal runs) is
+ *   reduced once to its sum, sum of squares, extreme and error count
+ * - SUM/AVG/STDEV use prefix differences over the line totals; the sums
+ *   of squares are kept modulo 2^64, so the expanded sum of squared
+ *   deviations is the one range_aggregate() adds up term by term
+ * - MIN/MAX use a monotonic deque over the line extremes
+ * The results match range_aggregate() exactly
+ */
+static void evaluate_run(RangeEntry **run, int n, int dr) {
+    RangeEntry *first = run[0];
+    int func = first->func;
+    int span = dr ? (first->r2 - first->r1 + 1) : (first->c2 - first->c1 + 1);
+    int width = dr ? (first->c2 - first->c1 + 1) : (first->r2 - first->r1 + 1);
+    int lines = n + span - 1;
+    int count = span * width;
+
+    long long *sum = (long long *)malloc((lines + 1) * sizeof(long long));
+    unsigned long long *sumsq = (unsigned long long *)malloc((lines + 1) * sizeof(unsigned long long));
+    int *errors = (int *)malloc((lines + 1) * sizeof(int));
+    int *extreme = (int *)malloc(lines * sizeof(int));
+    int *deque = (int *)malloc(lines * sizeof(int));
+
+    // Reduce every line once and build prefix totals
+    sum[0] = sumsq[0] = 0;
+    errors[0] = 0;
+    for (int l = 0; l < lines; l++) {
+        long long line_sum = 0;
+        unsigned long long line_sumsq = 0;
+        int line_errors = 0;
+        int line_extreme = (func == FUNC_MIN) ? INT_MAX : INT_MIN;
+        for (int w = 0; w < width; w++) {
+            int value = dr ? CELL(first->r1 + l, first->c1 + w)
+                           : CELL(first->r1 + w, first->c1 + l);
+            if (value == ERROR_VALUE) {
+                line_errors++;
+                continue;
+            }
+            line_sum += value;
+            line_sumsq += (unsigned long long)((long long)value * value);
+            if (func == FUNC_MIN ? value < line_extreme : value > line_extreme) {
+                line_extreme = value;
+            }
+        }
+        sum[l + 1] = sum[l] + line_sum;
+        sumsq[l + 1] = sumsq[l] + line_sumsq;
+        errors[l + 1] = errors[l] + line_errors;
+        extreme[l] = line_extreme;
+    }
+
+    // Slide the window over the lines
+    int head = 0, tail = 0;
+    for (int l = 0; l < lines; l++) {
+        if (func == FUNC_MIN || func == FUNC_MAX) {
+            while (tail > head && (func == FUNC_MIN ? extreme[deque[tail - 1]] >= extreme[l]
+                                                    : extreme[deque[tail - 1]] <= extreme[l])) {
+                tail--;
+            }
+            deque[tail++] = l;
+            if (deque[head] <= l - span) head++;
+        }
+
+        int k = l - span + 1;   // Window ending at line l
+        if (k < 0) continue;
+
+        RangeEntry *entry = run[k];
+        long long window_sum = sum[l + 1] - sum[k];
+        int int_sum = (int)window_sum;
+
+        if (errors[l + 1] - errors[k] > 0) {
+            entry->value = ERROR_VALUE;
+        } else {
+            switch (func) {
+                case FUNC_MIN:
+                case FUNC_MAX:
+                    entry->value = extreme[deque[head]];
+                    break;
+                case FUNC_SUM:
+                    entry->value = int_sum;
+                    break;
+                case FUNC_AVG:
+                    entry->value = int_sum / count;
+                    break;
+                case FUNC_STDEV:
+                    if (count <= 1) {
+                        entry->value = 0;
+                    } else {
+                        // sum (v - mean)^2 = sum v^2 - 2 mean sum v + count mean^2,
+                        // which holds modulo 2^64 as well
+                        unsigned long long mean = (unsigned long long)(long long)(int_sum / count);
+                        unsigned long long squares = (sumsq[l + 1] - sumsq[k])
+                                                     - 2 * mean * (unsigned long long)window_sum
+                                                     + (unsigned long long)count * mean * mean;
+                        entry->value = (int)round(sqrt((double)squares / count));
+                    }
+                    break;
+            }
+        }
+        entry->dirty = false;
+    }
+
+    free(sum);
+    free(sumsq);
+    free(errors);
+    free(extreme);
+    free(deque);
+}
+
+/**
+ * Checks whether a function is answered from an order-statistic index
+ */
+bool is_order_function(int func) {
+    return func == FUNC_MEDIAN || func == FUNC_PERCENTILE || func == FUNC_RANK ||
+           func == FUNC_COUNTIF || func == FUNC_SUMIF;
+}
+
+/**
+ * Counts (or sums) the indexed values that satisfy a condition
+ * Each condition is a difference of at most two O(log n) prefix queries
+ */
+static long long match_condition(OrderTree *tree, int pred, int value, bool sum) {
+    long long all = sum ? order_sum(tree) : order_size(tree);
+    long long less = sum ? order_sum_less(tree, value) : order_count_less(tree, value);
+    long long greater = sum ? order_sum_greater(tree, value) : order_count_greater(tree, value);
+
+    switch (pred) {
+        case PRED_LT: return less;
+        case PRED_LE: return all - greater;
+        case PRED_GT: return greater;
+        case PRED_GE: return all - less;
+        case PRED_NE: return less + greater;
+        default:      return all - less - greater;  // PRED_EQ
+    }
+}
+
+/**
+ * Keeps the order-statistic indexes covering (r, c) in step with a write
+ * Called for every cell write, before dependents are recomputed; a cell
+ * that no index covers has an empty list and costs one load
+ */
+void range_cell_written(int r, int c, int old_value, int new_value) {
+    for (RangeRef *ref = *index_list(r, c); ref != NULL; ref = ref->next) {
+        RangeEntry *entry = ref->range;
+
+        if (old_value == ERROR_VALUE) {
+            entry->errors--;
+        } else {
+            order_erase(entry->order, old_value);
+        }
+        if (new_value == ERROR_VALUE) {
+            entry->errors++;
+        } else {
+            order_insert(entry->order, new_value);
+        }
+        entry->dirty = true;
+    }
+}
+
+/**
+ * Answers an order-statistic function from the sorted index in O(log n)
+ * - MEDIAN averages the two middle values of an even count (truncated)
+ * - PERCENTILE interpolates linearly between ranks, like PERCENTILE.INC
+ * - RANK is 1 + the number of larger values; ERROR_VALUE if absent
+ * - MEDIAN, PERCENTILE and RANK are ERROR_VALUE if any cell is
+ * - COUNTIF/SUMIF count or sum the values matching the condition; error
+ *   cells match no condition and are skipped, and a sum that does not fit
+ *   in an int is ERROR_VALUE
+ */
+static int order_value(RangeEntry *entry) {
+    if (entry->func == FUNC_COUNTIF) {
+        return (int)match_condition(entry->order, entry->pred, entry->arg, false);
+    }
+    if (entry->func == FUNC_SUMIF) {
+        long long sum = match_condition(entry->order, entry->pred, entry->arg, true);
+        return sum < INT_MIN || sum > INT_MAX ? ERROR_VALUE : (int)sum;
+    }
+
+    int n = order_size(entry->order);
+    if (entry->errors > 0 || n == 0) return ERROR_VALUE;
+
+    switch (entry->func) {
+        case FUNC_MEDIAN:
+            if (n % 2 == 1) return order_kth(entry->order, n / 2);
+            return (int)(((long long)order_kth(entry->order, n / 2 - 1) +
+                          order_kth(entry->order, n / 2)) / 2);
+        case FUNC_PERCENTILE: {
+            if (entry->arg < 0 || entry->arg > 100) return ERROR_VALUE;
+            long long position = (long long)entry->arg * (n - 1);
+            int low = order_kth(entry->order, (int)(position / 100));
+            int fraction = (int)(position % 100);
+            if (fraction == 0) return low;
+            int high = order_kth(entry->order, (int)(position / 100) + 1);
+            return (int)(low + ((long long)high - low) * fraction / 100);
+        }
+        case FUNC_RANK:
+            if (!order_contains(entry->order, entry->arg)) return ERROR_VALUE;
+            return order_count_greater(entry->order, entry->arg) + 1;
+        default:
+            return ERROR_VALUE;
+    }
+}
+
+/**
+ * Returns the result of an interned range, recomputing it only when dirty
+ * A dirty entry that belongs to a run of shifted windows recomputes the
+ * whole run, so the other windows are already clean when they are reached
+ */
+int range_value(RangeEntry *entry) {
+    if (!entry->dirty) return entry->value;
+
+    if (entry->order != NULL) {
+        entry->value = order_value(entry);
+        entry->dirty = false;
+        return entry->value;
+    }
+
+    if (is_sliding_function(entry->func)) {
+        RangeEntry **run = NULL;
+        int dr = 1;
+        int n = collect_run(entry, 1, 0, &run);
+        if (n == 0) {
+            dr = 0;
+            n = collect_run(entry, 0, 1, &run);
+        }
+        if (n > 0) {
+            evaluate_run(run, n, dr);
+            free(run);
+            return entry->value;
+        }
+    }
+
+    entry->value = range_aggregate(entry->func, entry->r1, entry->c1, entry->r2, entry->c2);
+    entry->dirty = false;
+    return entry->value;
+}
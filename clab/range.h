@@ -0,0 +1,81 @@
+/**
+ * range.h
+ * Interned range expressions for the spreadsheet
+ * Identical range formulas (same function and rectangle) share one entry,
+ * one set of dependency edges and one cached result, and runs of windows
+ * shifted by one row or column are recomputed with a sliding window
+ * Order-statistic and conditional functions (MEDIAN, PERCENTILE, RANK,
+ * COUNTIF, SUMIF) keep a sorted index of the range that is updated on
+ * every cell write
+ * An error cell makes MEDIAN, PERCENTILE and RANK an error, but matches
+ * no COUNTIF/SUMIF condition and is skipped; a SUMIF whose sum does not
+ * fit in an int is an error
+ */
+
+#ifndef __RANGE__
+#define __RANGE__
+
+#include <stdbool.h>
+#include "io.h"
+#include "order.h"
+
+// Number of hash buckets used to intern range expressions
+#define RANGE_BUCKETS 4096
+
+// Minimum number of shifted windows evaluated together as a sliding run
+#define RANGE_RUN_MIN 3
+
+/**
+ * Subscriber node structure
+ * Represents a cell whose formula is an interned range expression
+ */
+typedef struct Subscriber {
+    int r;                      // Row coordinate
+    int c;                      // Column coordinate
+    struct Subscriber *next;    // Next subscriber of the same range
+} Subscriber;
+
+/**
+ * Node of the per-cell list of the indexed entries covering a cell
+ */
+typedef struct RangeRef {
+    struct RangeEntry *range;   // Indexed entry whose rectangle holds the cell
+    struct RangeRef *next;      // Next indexed entry covering the same cell
+} RangeRef;
+
+/**
+ * Interned range expression
+ * Every cell of the rectangle holds exactly one child edge to the entry,
+ * no matter how many cells subscribe to it; the cells of an indexed entry
+ * also hold one RangeRef to it, so a write finds the indexes to patch
+ * without walking its child edges
+ */
+typedef struct RangeEntry {
+    int func;                   // FUNC_* applied to the rectangle
+    int arg;                    // Extra function argument (0 if unused)
+    int pred;                   // PRED_* condition of COUNTIF/SUMIF (0 if unused)
+    int r1, c1;                 // Top-left corner (0-based)
+    int r2, c2;                 // Bottom-right corner (0-based)
+    int value;                  // Cached result of the aggregate
+    bool dirty;                 // Cached result must be recomputed
+    int refcount;               // Number of subscribers and pins
+    OrderTree *order;           // Sorted values of the range (indexed functions only)
+    int errors;                 // Cells holding ERROR_VALUE (indexed functions only)
+    Subscriber *subs;           // Cells that share this range expression
+    struct RangeEntry *next;    // Next entry in the same hash bucket
+} RangeEntry;
+
+// Table management functions
+void make_range_table();        // Initialize the intern table
+void free_range_table();        // Free all interned ranges
+
+// Interning functions
+RangeEntry *range_lookup(int func, int arg, int pred, int r1, int c1, int r2, int c2);   // Find an interned range
+RangeEntry *range_acquire(int func, int arg, int pred, int r1, int c1, int r2, int c2);  // Intern a range and pin it
+void range_attach(RangeEntry *entry, int r, int c, ParsedCommand formula);  // Turn the pin into a subscription of (r, c)
+void range_unsubscribe(RangeEntry *entry, int r, int c);              // Drop a subscription
+int range_value(RangeEntry *entry);                                   // Cached or freshly computed result
+bool is_order_function(int func);                                     // Check if function uses a sorted index
+void range_cell_written(int r, int c, int old_value, int new_value);  // Update the indexes covering (r, c)
+
+#endif
@@ -0,0 +1,545 @@
+/**
+ * snapshot.c
+ * Binary snapshots of the spreadsheet
+ * - Saving writes the grid, then one record per formula cell, then the
+ *   records in dependency order (Kahn's algorithm over the child lists)
+ * - Loading maps the file, checks every record before touching the sheet,
+ *   then copies the values and re-creates the dependency lists in that
+ *   order; no formula is evaluated and no cycle check is run
+ * - A background save forks; the child sees the sheet as it was at the
+ *   fork, through copy-on-write pages, and saves it while the parent goes
+ *   on taking commands
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "init.h"
+#include "io.h"
+#include "process.h"
+#include "dependent.h"
+#include "range.h"
+#include "formula.h"
+#include "timer.h"
+#include "label.h"
+#include "storage.h"
+#include "snapshot.h"
+
+// Background save
+static pid_t bgsave_pid = 0;                    // Child still writing, or 0
+static BgsaveState bgsave_state = BGSAVE_NONE;  // Outcome of the last one
+
+// Sections start on 8-byte boundaries, record parts on 4-byte boundaries
+#define ALIGN8(n) (((n) + 7) & ~7LL)
+#define ALIGN4(n) (((n) + 3) & ~3LL)
+
+/**
+ * Writes zero bytes up to the next 8-byte boundary
+ * @return The aligned offset
+ */
+static long long pad_section(FILE *file, long long offset) {
+    static const char zeros[8] = {0};
+    long long aligned = ALIGN8(offset);
+    fwrite(zeros, 1, (size_t)(aligned - offset), file);
+    return aligned;
+}
+
+/**
+ * Writes the record of the formula of cell (r, c)
+ * @return Number of bytes written
+ */
+static long long write_formula(FILE *file, int r, int c, const ParsedCommand *formula) {
+    static const char zeros[4] = {0};
+    const Program *program = formula->type == CMD_EXPRESSION ? formula->program : NULL;
+    int text = (int)strlen(formula->expression);
+
+    SnapshotFormula record;
+    memset(&record, 0, sizeof(record));
+    record.row = r;
+    record.col = c;
+    record.type = formula->type;
+    record.func = formula->func;
+    record.op2_row = formula->op2.row;
+    record.op2_col = formula->op2.col;
+    record.op2_value = formula->op2.value;
+    record.op3_row = formula->op3.row;
+    record.op3_col = formula->op3.col;
+    record.op3_value = formula->op3.value;
+    record.func_arg = formula->func_arg;
+    record.predicate = formula->predicate;
+    record.op = formula->operator;
+    record.text_length = (int)ALIGN4(text + 1);
+    record.program_length = program != NULL ? program->length : 0;
+    record.program_depth = program != NULL ? program->depth : 0;
+
+    fwrite(&record, sizeof(record), 1, file);
+    fwrite(formula->expression, 1, (size_t)text, file);
+    fwrite(zeros, 1, (size_t)(record.text_length - text), file);
+    if (program != NULL) {
+        fwrite(program->code, sizeof(Instr), (size_t)program->length, file);
+    }
+    return (long long)sizeof(record) + record.text_length + (long long)record.program_length * sizeof(Instr);
+}
+
+/**
+ * Cell that holds a formula
+ */
+typedef struct {
+    int r, c;                   // Cell coordinates
+} FormulaCell;
+
+/**
+ * State of the topological sort of the formula records
+ */
+typedef struct {
+    const FormulaCell *cells;   // Cell of each record
+    int *slots;                 // Open-addressed table of record numbers (-1 if empty)
+    int mask;                   // Number of slots - 1
+    int *indegree;              // Formulas each record still waits for
+    int *queue;                 // Records whose inputs are all written
+    int tail;                   // Number of records queued so far
+    bool release;               // Releasing dependents instead of counting them
+} SortState;
+
+/**
+ * Returns the table slot of a cell (its own slot or the empty one it belongs in)
+ */
+static int sort_slot(const SortState *sort, int r, int c) {
+    int slot = (int)(((unsigned)r * 2654435761u ^ (unsigned)c * 40503u) & (unsigned)sort->mask);
+    while (sort->slots[slot] != -1) {
+        const FormulaCell *cell = &sort->cells[sort->slots[slot]];
+        if (cell->r == r && cell->c == c) break;
+        slot = (slot + 1) & sort->mask;
+    }
+    return slot;
+}
+
+/**
+ * Counts (or releases) one dependency edge into cell (r, c)
+ */
+static void sort_edge(SortState *sort, int r, int c) {
+    int i = sort->slots[sort_slot(sort, r, c)];
+    if (i < 0) return;
+    if (!sort->release) {
+        sort->indegree[i]++;
+    } else if (--sort->indegree[i] == 0) {
+        sort->queue[sort->tail++] = i;
+    }
+}
+
+/**
+ * Visits the edges from cell (r, c) to the formulas that read it; a range
+ * edge stands for one edge to every subscriber of the range
+ */
+static void sort_dependents(SortState *sort, int r, int c) {
+    for (Child *child = Child_lst[r][c]; child != NULL; child = child->next) {
+        if (child->range == NULL) {
+            sort_edge(sort, child->r, child->c);
+            continue;
+        }
+        for (Subscriber *sub = child->range->subs; sub != NULL; sub = sub->next) {
+            sort_edge(sort, sub->r, sub->c);
+        }
+    }
+}
+
+/**
+ * Writes the sheet to a file
+ * The file is written under a temporary name and renamed into place, so
+ * an existing snapshot is never left half-written
+ * @return true on success
+ */
+bool snapshot_save(const char *path) {
+    // Formula cells, found through the rows that hold dependency lists
+    int count = 0;
+    int capacity = 64;
+    FormulaCell *formula_cells = (FormulaCell *)malloc(capacity * sizeof(FormulaCell));
+    for (int r = 0; r < MAXROW; r++) {
+        if (!row_has_parents(r)) continue;
+        for (int c = 0; c < MAXCOL; c++) {
+            if (Parent_lst[r][c] == NULL) continue;
+            if (count == capacity) {
+                capacity *= 2;
+                formula_cells = (FormulaCell *)realloc(formula_cells, capacity * sizeof(FormulaCell));
+            }
+            formula_cells[count++] = (FormulaCell){.r = r, .c = c};
+        }
+    }
+
+    size_t path_len = strlen(path);
+    char *temp = (char *)malloc(path_len + 5);
+    memcpy(temp, path, path_len);
+    memcpy(temp + path_len, ".tmp", 5);
+    FILE *file = fopen(temp, "wb");
+    if (file == NULL) {
+        free(formula_cells);
+        free(temp);
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.rows = MAXROW;
+    header.cols = MAXCOL;
+    header.formulas = count;
+    fwrite(&header, sizeof(header), 1, file);
+    long long offset = pad_section(file, (long long)sizeof(header));
+
+    // Values, row by row whatever the storage layout
+    header.values_offset = offset;
+    int *line = (int *)malloc(MAXCOL * sizeof(int));
+    for (int r = 0; r < MAXROW; r++) {
+        for (int c = 0; c < MAXCOL; c++) line[c] = CELL(r, c);
+        fwrite(line, sizeof(int), MAXCOL, file);
+    }
+    free(line);
+    offset = pad_section(file, offset + (long long)MAXROW * MAXCOL * sizeof(int));
+
+    // Formulas, in grid order; every parent edge of a cell carries its formula
+    header.formulas_offset = offset;
+    long long *records = (long long *)malloc((count > 0 ? count : 1) * sizeof(long long));
+    for (int i = 0; i < count; i++) {
+        records[i] = offset;
+        offset += write_formula(file, formula_cells[i].r, formula_cells[i].c,
+                                &Parent_lst[formula_cells[i].r][formula_cells[i].c]->formula);
+    }
+    offset = pad_section(file, offset);
+
+    // Order: a formula is written once every formula it reads is
+    header.order_offset = offset;
+    SortState sort;
+    int slots = 2;
+    while (slots < count * 2) slots *= 2;
+    sort.cells = formula_cells;
+    sort.slots = (int *)malloc(slots * sizeof(int));
+    sort.mask = slots - 1;
+    for (int i = 0; i < slots; i++) sort.slots[i] = -1;
+    for (int i = 0; i < count; i++) {
+        sort.slots[sort_slot(&sort, formula_cells[i].r, formula_cells[i].c)] = i;
+    }
+    sort.indegree = (int *)calloc(count > 0 ? count : 1, sizeof(int));
+    sort.queue = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+    sort.tail = 0;
+    sort.release = false;
+    for (int i = 0; i < count; i++) {
+        sort_dependents(&sort, formula_cells[i].r, formula_cells[i].c);
+    }
+    for (int i = 0; i < count; i++) {
+        if (sort.indegree[i] == 0) sort.queue[sort.tail++] = i;
+    }
+    sort.release = true;
+    for (int head = 0; head < sort.tail; head++) {
+        int i = sort.queue[head];
+        fwrite(&records[i], sizeof(long long), 1, file);
+        sort_dependents(&sort, formula_cells[i].r, formula_cells[i].c);
+    }
+    header.size = offset + (long long)sort.tail * sizeof(long long);
+
+    rewind(file);
+    fwrite(&header, sizeof(header), 1, file);
+    bool ok = sort.tail == count && !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) remove(temp);
+
+    free(temp);
+    free(records);
+    free(formula_cells);
+    free(sort.slots);
+    free(sort.indegree);
+    free(sort.queue);
+    return ok;
+}
+
+/**
+ * Checks that an operand is a cell of the sheet (1-based)
+ */
+static bool is_sheet_cell(int row, int col) {
+    return row >= 1 && row <= MAXROW && col >= 1 && col <= MAXCOL;
+}
+
+/**
+ * Checks that a program only reads cells of the sheet and keeps its
+ * evaluation stack within bounds
+ */
+static bool check_program(const Instr *code, int length, int depth) {
+    if (length < 1 || depth < 1 || depth > FORMULA_MAX_DEPTH) return false;
+    int top = 0;
+    for (int i = 0; i < length; i++) {
+        const Instr *ins = &code[i];
+        switch (ins->op) {
+            case OP_CONST:
+                top++;
+                break;
+            case OP_CELL:
+                if (!is_sheet_cell(ins->a + 1, ins->b + 1)) return false;
+                top++;
+                break;
+            case OP_RANGE:
+                if (!is_sheet_cell(ins->a + 1, ins->b + 1) || !is_sheet_cell(ins->c + 1, ins->d + 1) ||
+                    ins->a > ins->c || ins->b > ins->d || !is_range_function(ins->func)) return false;
+                top++;
+                break;
+            case OP_CALL:
+                if (ins->argc < 1 || ins->argc > top) return false;
+                top -= ins->argc - 1;
+                break;
+            case OP_NEG:
+                if (top < 1) return false;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+                if (top < 2) return false;
+                top--;
+                break;
+            default:
+                return false;
+        }
+        if (top > depth) return false;
+    }
+    return top == 1;
+}
+
+/**
+ * Checks one formula record
+ * @param available Bytes between the record and the end of its section
+ */
+static bool check_formula(const SnapshotFormula *record, long long available) {
+    if (!is_sheet_cell(record->row + 1, record->col + 1)) return false;
+    if (record->text_length < 4 || record->text_length % 4 != 0 || record->text_length > ALIGN4(MAX_EXPR_LEN)) {
+        return false;
+    }
+    if (record->program_length < 0 || record->program_length > available) return false;
+    if ((long long)sizeof(*record) + record->text_length +
+        (long long)record->program_length * (long long)sizeof(Instr) > available) return false;
+
+    const char *text = (const char *)(record + 1);
+    if (memchr(text, '\0', (size_t)record->text_length) == NULL) return false;
+
+    bool cell2 = is_sheet_cell(record->op2_row, record->op2_col);
+    bool cell3 = is_sheet_cell(record->op3_row, record->op3_col);
+    bool none2 = record->op2_row == 0 && record->op2_col == 0;
+    bool none3 = record->op3_row == 0 && record->op3_col == 0;
+    switch (record->type) {
+        case CMD_SET_CELL:
+            return cell2 && record->program_length == 0;
+        case CMD_ARITHMETIC:
+            return (cell2 || none2) && (cell3 || none3) && !(none2 && none3) &&
+                   record->op != 0 && strchr("+-*/", record->op) != NULL && record->program_length == 0;
+        case CMD_FUNCTION:
+            if (record->program_length != 0) return false;
+            if (record->func == FUNC_SLEEP) return cell2;
+            return is_range_function(record->func) && cell2 && cell3 &&
+                   record->op2_row <= record->op3_row && record->op2_col <= record->op3_col;
+        case CMD_EXPRESSION: {
+            const Instr *code = (const Instr *)(text + record->text_length);
+            return check_program(code, record->program_length, record->program_depth);
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Checks the header and every section of a mapped snapshot
+ */
+static bool check_snapshot(const char *map, long long size) {
+    const SnapshotHeader *header = (const SnapshotHeader *)map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != SNAPSHOT_VERSION || header->size != size) return false;
+    if (header->rows != MAXROW || header->cols != MAXCOL || header->formulas < 0) return false;
+
+    long long values_end = header->values_offset + (long long)MAXROW * MAXCOL * sizeof(int);
+    if (header->values_offset < (long long)sizeof(*header) || header->values_offset % 8 != 0 ||
+        values_end > header->formulas_offset || header->formulas_offset % 8 != 0 ||
+        header->formulas_offset > header->order_offset || header->order_offset % 8 != 0 ||
+        header->order_offset + (long long)header->formulas * (long long)sizeof(long long) != size) {
+        return false;
+    }
+
+    const long long *order = (const long long *)(map + header->order_offset);
+    for (int i = 0; i < header->formulas; i++) {
+        long long offset = order[i];
+        if (offset < header->formulas_offset || offset % 4 != 0 ||
+            offset + (long long)sizeof(SnapshotFormula) > header->order_offset) {
+            return false;
+        }
+        if (!check_formula((const SnapshotFormula *)(map + offset), header->order_offset - offset)) return false;
+    }
+    return true;
+}
+
+/**
+ * Rebuilds the parsed command of a formula record
+ * A compiled expression gets a fresh copy of its program
+ */
+static void decode_formula(const SnapshotFormula *record, ParsedCommand *cmd) {
+    memset(cmd, 0, sizeof(ParsedCommand));
+    cmd->type = (CommandType)record->type;
+    cmd->func = (FunctionType)record->func;
+    cmd->op1.row = record->row + 1;
+    cmd->op1.col = record->col + 1;
+    cmd->op2.row = record->op2_row;
+    cmd->op2.col = record->op2_col;
+    cmd->op2.value = record->op2_value;
+    cmd->op3.row = record->op3_row;
+    cmd->op3.col = record->op3_col;
+    cmd->op3.value = record->op3_value;
+    cmd->func_arg = record->func_arg;
+    cmd->predicate = (PredicateType)record->predicate;
+    cmd->operator = (char)record->op;
+
+    // At most 3 letters and 7 digits, which fit the cell name
+    char name[16];
+    snprintf(name, sizeof(name), "%s%d", column_label(record->col + 1, NULL), record->row + 1);
+    memcpy(cmd->cell, name, strlen(name) + 1);
+
+    const char *text = (const char *)(record + 1);
+    snprintf(cmd->expression, sizeof(cmd->expression), "%s", text);
+
+    if (record->program_length > 0) {
+        size_t code_size = (size_t)record->program_length * sizeof(Instr);
+        Program *program = (Program *)malloc(sizeof(Program) + code_size);
+        program->length = record->program_length;
+        program->depth = record->program_depth;
+        memcpy(program->code, text + record->text_length, code_size);
+        cmd->program = program;
+    }
+}
+
+/**
+ * Maps a snapshot file read-only
+ * @param size Pointer to store the size of the mapping
+ * @return The mapping, or NULL if the file cannot be read or is too short
+ */
+static const char *map_snapshot(const char *path, long long *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    *size = (long long)st.st_size;
+    return (const char *)map;
+}
+
+/**
+ * Replaces the sheet with a saved one
+ * The current sheet is left untouched if the file is not a valid snapshot
+ * of a sheet with the same dimensions
+ * @return true on success
+ */
+bool snapshot_load(const char *path) {
+    long long size;
+    const char *map = map_snapshot(path, &size);
+    if (map == NULL) return false;
+    if (!check_snapshot(map, size)) {
+        munmap((void *)map, (size_t)size);
+        return false;
+    }
+    const SnapshotHeader *header = (const SnapshotHeader *)map;
+
+    // Drop every formula, interned range, program and pending SLEEP
+    timer_clear();
+    free_parent_list();
+    free_child_list();
+    make_parent_list();
+    make_child_list();
+
+    const int *values = (const int *)(map + header->values_offset);
+    for (int r = 0; r < MAXROW; r++) {
+        for (int c = 0; c < MAXCOL; c++) {
+            CELL(r, c) = values[(size_t)r * MAXCOL + c];
+        }
+    }
+
+    const long long *order = (const long long *)(map + header->order_offset);
+    for (int i = 0; i < header->formulas; i++) {
+        ParsedCommand cmd;
+        decode_formula((const SnapshotFormula *)(map + order[i]), &cmd);
+        restore_formula(&cmd);
+    }
+
+    munmap((void *)map, (size_t)size);
+    return true;
+}
+
+/**
+ * Reads the sheet dimensions recorded in a snapshot
+ * @return true if the file starts with a snapshot header of this version
+ */
+bool snapshot_dimensions(const char *path, int *rows, int *cols) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+    SnapshotHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+              header.version == SNAPSHOT_VERSION;
+    fclose(file);
+    if (!ok) return false;
+    *rows = header.rows;
+    *cols = header.cols;
+    return true;
+}
+
+/**
+ * Starts writing the sheet to a file from a forked child
+ * The child writes the sheet as it is now, whatever the parent does to it
+ * meanwhile, and exits; snapshot_bgsave_poll() reports when it is done.
+ * A grid in a backing file is shared with the child rather than copied,
+ * so it is saved in the foreground instead
+ * @return false if the child cannot be started (or the foreground save fails)
+ */
+bool snapshot_bgsave(const char *path) {
+    if (sheet_backing != NULL) {
+        bgsave_state = snapshot_save(path) ? BGSAVE_DONE : BGSAVE_FAILED;
+        return bgsave_state == BGSAVE_DONE;
+    }
+
+    // Output still buffered would otherwise be written by both processes
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        // No exit handlers or stdio flushes in the child: they belong to the parent
+        _exit(snapshot_save(path) ? 0 : 1);
+    }
+    bgsave_pid = pid;
+    bgsave_state = BGSAVE_RUNNING;
+    return true;
+}
+
+/**
+ * Reports how the last background save went, reaping the child once it
+ * has finished
+ * @param wait Block until the child has finished
+ */
+BgsaveState snapshot_bgsave_poll(bool wait) {
+    if (bgsave_pid == 0) return bgsave_state;
+
+    int child_status;
+    pid_t done;
+    do {
+        done = waitpid(bgsave_pid, &child_status, wait ? 0 : WNOHANG);
+    } while (done < 0 && errno == EINTR);
+    if (done == 0) return BGSAVE_RUNNING;
+
+    bool ok = done == bgsave_pid && WIFEXITED(child_status) && WEXITSTATUS(child_status) == 0;
+    bgsave_state = ok ? BGSAVE_DONE : BGSAVE_FAILED;
+    bgsave_pid = 0;
+    return bgsave_state;
+}
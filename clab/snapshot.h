@@ -0,0 +1,75 @@
+/**
+ * snapshot.h
+ * Binary snapshots of the spreadsheet (save, load, --open)
+ * A snapshot holds the values of every cell, the formulas of the cells
+ * that have one, and the order in which those formulas depend on each
+ * other, so a sheet is reopened without evaluating anything
+ * A background save (bgsave) writes the same file from a forked child
+ */
+
+#ifndef __SNAPSHOT__
+#define __SNAPSHOT__
+
+#include <stdbool.h>
+
+// Identifies a snapshot file and its format revision
+#define SNAPSHOT_MAGIC "CLABSNAP"
+#define SNAPSHOT_VERSION 1
+
+/**
+ * File header, at offset 0
+ * Sections follow in this order, each starting on an 8-byte boundary:
+ * - values: rows x cols ints, row by row
+ * - formulas: one SnapshotFormula per formula cell, each followed by its
+ *   text and, for compiled expressions, its instructions
+ * - order: formula record offsets (long long), every formula after the
+ *   formulas it reads
+ */
+typedef struct SnapshotHeader {
+    char magic[8];              // SNAPSHOT_MAGIC (not NUL-terminated)
+    int version;                // SNAPSHOT_VERSION
+    int rows, cols;             // Sheet dimensions
+    int formulas;               // Number of formula records
+    long long values_offset;    // Offset of the values section
+    long long formulas_offset;  // Offset of the formulas section
+    long long order_offset;     // Offset of the order section
+    long long size;             // Size of the whole file
+} SnapshotHeader;
+
+/**
+ * Formula record
+ * The operands are those of the parsed command; pointers (kernel,
+ * program) are rebound when the snapshot is loaded
+ */
+typedef struct SnapshotFormula {
+    int row, col;               // Target cell (0-based)
+    int type;                   // CommandType
+    int func;                   // FunctionType
+    int op2_row, op2_col, op2_value;  // First operand
+    int op3_row, op3_col, op3_value;  // Second operand
+    int func_arg;               // Extra function argument
+    int predicate;              // PredicateType of COUNTIF/SUMIF
+    int op;                     // Arithmetic operator
+    int text_length;            // Bytes of formula text that follow, padded to 4
+    int program_length;         // Instructions that follow the text (expressions only)
+    int program_depth;          // Stack depth of the program
+} SnapshotFormula;
+
+/**
+ * Progress of the last background save
+ */
+typedef enum {
+    BGSAVE_NONE,                // No background save was started
+    BGSAVE_RUNNING,             // The child is still writing
+    BGSAVE_DONE,                // The snapshot is complete
+    BGSAVE_FAILED               // The child could not write the snapshot
+} BgsaveState;
+
+// Snapshot functions
+bool snapshot_save(const char *path);                          // Write the sheet to a file
+bool snapshot_load(const char *path);                          // Replace the sheet with a saved one
+bool snapshot_dimensions(const char *path, int *rows, int *cols);  // Read the sheet size of a file
+bool snapshot_bgsave(const char *path);                        // Start writing the sheet from a child process
+BgsaveState snapshot_bgsave_poll(bool wait);                   // State of the last background save
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * storage.c
+ * Allocation and layout-aware iteration of the spreadsheet grid
+ * - All cells live in one zeroed block; sheet holds a pointer per line
+ * - Range kernels walk rectangles line by line so that the inner loop
+ *   always reads contiguous memory, whatever the layout
+ * - With a backing file the block is a shared mapping of a sparse file
+ *   that is emptied at start and exit; the per-cell tables follow it in
+ *   the file, or come from lazily populated anonymous mappings, so pages
+ *   no one touches never take memory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "init.h"
+#include "storage.h"
+
+// Backing file configuration
+const char *sheet_backing = NULL;
+bool sheet_backing_index = false;
+
+static int backing_fd = -1;
+static char *backing_map = NULL;
+static size_t backing_size = 0;
+static size_t values_bytes = 0;         // Bytes of the cell block, page aligned
+static size_t table_bytes = 0;          // Bytes reserved for each table, page aligned
+
+/**
+ * Rounds a size up to a whole number of pages
+ */
+static size_t page_align(size_t bytes) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (bytes + page - 1) / page * page;
+}
+
+/**
+ * Maps the backing file, emptied and sized for the grid and its tables
+ * @return The cell block, or NULL on failure
+ */
+static int *map_backing() {
+    size_t cells = (size_t)MAXROW * MAXCOL;
+    values_bytes = page_align(cells * sizeof(int));
+    table_bytes = page_align(cells * TABLE_CELL_BYTES);
+    backing_size = values_bytes + (sheet_backing_index ? TABLE_COUNT * table_bytes : 0);
+
+    // Truncating first discards whatever an earlier run left; the file
+    // then reads as zeros without using any disk blocks
+    backing_fd = open(sheet_backing, O_RDWR | O_CREAT, 0644);
+    if (backing_fd < 0) return NULL;
+    if (ftruncate(backing_fd, 0) < 0 || ftruncate(backing_fd, (off_t)backing_size) < 0) {
+        close(backing_fd);
+        backing_fd = -1;
+        return NULL;
+    }
+    void *map = mmap(NULL, backing_size, PROT_READ | PROT_WRITE, MAP_SHARED, backing_fd, 0);
+    if (map == MAP_FAILED) {
+        close(backing_fd);
+        backing_fd = -1;
+        return NULL;
+    }
+    backing_map = (char *)map;
+    return (int *)map;
+}
+
+/**
+ * Number of lines and cells per line for the compiled layout
+ */
+static void grid_shape(int *lines, int *length) {
+#ifdef SHEET_COLUMN_MAJOR
+    *lines = MAXCOL;
+    *length = MAXROW;
+#else
+    *lines = MAXROW;
+    *length = MAXCOL;
+#endif
+}
+
+/**
+ * Allocates the grid for the current MAXROW and MAXCOL, with every cell 0
+ * @return 1 on success, 0 if memory allocation failed
+ */
+int sheet_alloc() {
+    int lines, length;
+    grid_shape(&lines, &length);
+
+    sheet = (int **)malloc(lines * sizeof(int *));
+    if (sheet == NULL) {
+        return 0;
+    }
+    int *cells = sheet_backing != NULL
+        ? map_backing()
+        : (int *)calloc((size_t)lines * length, sizeof(int));
+    if (cells == NULL) {
+        free(sheet);
+        sheet = NULL;
+        return 0;
+    }
+    for (int i = 0; i < lines; i++) {
+        sheet[i] = cells + (size_t)i * length;
+    }
+    return 1;
+}
+
+/**
+ * Frees the grid allocated by sheet_alloc()
+ */
+void sheet_free() {
+    if (sheet == NULL) return;
+    if (backing_map != NULL) {
+        // The tables in the file must already have been released
+        munmap(backing_map, backing_size);
+        if (ftruncate(backing_fd, 0) < 0) perror(sheet_backing);
+        close(backing_fd);
+        backing_map = NULL;
+        backing_fd = -1;
+    } else {
+        free(sheet[0]);
+    }
+    free(sheet);
+    sheet = NULL;
+}
+
+/**
+ * Allocates a per-cell table of MAXROW x MAXCOL zeroed elements
+ * - On the heap without a backing file
+ * - In its region of the backing file with --backing-index
+ * - Otherwise in an anonymous mapping whose pages appear on first use
+ * @return The table, or NULL on failure
+ */
+void *table_alloc(CellTable table, size_t element_size) {
+    size_t cells = (size_t)MAXROW * MAXCOL;
+    if (sheet_backing == NULL) {
+        return calloc(cells, element_size);
+    }
+    if (sheet_backing_index && backing_map != NULL && element_size <= TABLE_CELL_BYTES) {
+        return backing_map + values_bytes + (size_t)table * table_bytes;
+    }
+    void *map = mmap(NULL, cells * element_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * Releases a table from table_alloc()
+ * A table in the backing file has its pages dropped, so it reads as
+ * zeros when it is allocated again
+ */
+void table_free(CellTable table, void *cells, size_t element_size) {
+    if (cells == NULL) return;
+    size_t bytes = (size_t)MAXROW * MAXCOL * element_size;
+    if (sheet_backing == NULL) {
+        free(cells);
+    } else if (cells == backing_map + values_bytes + (size_t)table * table_bytes) {
+        if (madvise(cells, page_align(bytes), MADV_REMOVE) < 0) memset(cells, 0, bytes);
+    } else {
+        munmap(cells, bytes);
+    }
+}
+
+/**
+ * Creates an iterator over the rectangle (r1, c1)..(r2, c2)
+ */
+CellSpan cell_span(int r1, int c1, int r2, int c2) {
+    CellSpan span;
+#ifdef SHEET_COLUMN_MAJOR
+    span.line = c1;
+    span.last = c2;
+    span.first = r1;
+    span.length = r2 - r1 + 1;
+#else
+    span.line = r1;
+    span.last = r2;
+    span.first = c1;
+    span.length = c2 - c1 + 1;
+#endif
+    return span;
+}
+
+/**
+ * Advances the iterator
+ * @return Pointer to span->length contiguous cells, or NULL at the end
+ */
+int *span_next(CellSpan *span) {
+    if (span->line > span->last) return NULL;
+    return sheet[span->line++] + span->first;
+}
+
+/**
+ * Hints that the rectangle (r1, c1)..(r2, c2) is about to be read
+ * Only backed grids are advised, and only for rectangles whose lines span
+ * whole pages; neighbouring lines are merged into one request, so a
+ * block of full rows costs a single madvise()
+ */
+void sheet_advise(int r1, int c1, int r2, int c2) {
+    if (backing_map == NULL) return;
+    if ((size_t)(r2 - r1 + 1) * (c2 - c1 + 1) * sizeof(int) < ADVISE_MIN_BYTES) return;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    CellSpan span = cell_span(r1, c1, r2, c2);
+    if ((size_t)span.length * sizeof(int) < page) return;
+
+    char *start = NULL, *end = NULL;
+    int *line;
+    while ((line = span_next(&span)) != NULL) {
+        char *first = (char *)((size_t)line / page * page);
+        char *last = (char *)page_align((size_t)(line + span.length));
+        if (start != NULL && first <= end) {
+            end = last;
+            continue;
+        }
+        if (start != NULL) madvise(start, (size_t)(end - start), MADV_WILLNEED);
+        start = first;
+        end = last;
+    }
+    if (start != NULL) madvise(start, (size_t)(end - start), MADV_WILLNEED);
+}
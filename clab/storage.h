@@ -0,0 +1,66 @@
+/**
+ * storage.h
+ * Memory layout of the spreadsheet grid
+ * The grid is stored as an array of lines of contiguous cells; a line is a
+ * row in the default row-major layout and a column when built with
+ * LAYOUT=colmajor (see CELL() in init.h)
+ * With a backing file (--backing) the cells, and optionally the per-cell
+ * dependency tables, live in a shared file mapping, so the page cache
+ * rather than the heap holds them and only the pages in use stay resident
+ */
+
+#ifndef __STORAGE__
+#define __STORAGE__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Most rows a sheet may have when it lives in a backing file
+#define BACKED_MAX_ROWS 1000000
+
+// Rectangles smaller than this many bytes get no paging hint
+#define ADVISE_MIN_BYTES (1 << 20)
+
+// Bytes reserved per cell for each table in the backing file
+#define TABLE_CELL_BYTES 16
+
+/**
+ * Iterator over the cells of a rectangle in storage order
+ * Each step yields one line of the rectangle as a contiguous slice
+ */
+typedef struct {
+    int line;                   // Next line to visit
+    int last;                   // Last line of the rectangle
+    int first;                  // Offset of the rectangle within each line
+    int length;                 // Number of contiguous cells per line
+} CellSpan;
+
+/**
+ * Per-cell tables kept beside the grid (MAXROW x MAXCOL elements, row-major)
+ */
+typedef enum {
+    TABLE_PARENTS,              // Parent list heads
+    TABLE_CHILDREN,             // Child list heads
+    TABLE_VISITS,               // Marks of dependency graph walks
+    TABLE_INDEXES,              // Lists of the indexed ranges covering each cell
+    TABLE_COUNT
+} CellTable;
+
+// Backing file configuration
+extern const char *sheet_backing;   // File holding the grid (--backing), or NULL for the heap
+extern bool sheet_backing_index;    // Tables live in the backing file too (--backing-index)
+
+// Grid management functions
+int sheet_alloc();              // Allocate a zeroed MAXROW x MAXCOL grid (0 on failure)
+void sheet_free();              // Free the grid
+
+// Table management functions
+void *table_alloc(CellTable table, size_t element_size);          // Zeroed table (NULL on failure)
+void table_free(CellTable table, void *cells, size_t element_size);  // Release a table
+
+// Iteration functions
+CellSpan cell_span(int r1, int c1, int r2, int c2);  // Iterator over (r1, c1)..(r2, c2)
+int *span_next(CellSpan *span);                       // Next slice, or NULL when done
+void sheet_advise(int r1, int c1, int r2, int c2);   // Ask for the pages of a rectangle about to be scanned
+
+#endif
@@ -0,0 +1,286 @@
+/**
+ * timer.c
+ * Hashed timer wheel driving non-blocking SLEEP
+ * - A timer lives in the slot of its deadline tick; long delays simply
+ *   wrap around the wheel and are skipped until their deadline is reached
+ * - Expiry walks only the slots between the last and the current tick
+ * - A separate list holds every pending timer, and a hash table keyed
+ *   by cell finds the timer of a cell without walking that list
+ * - The clock is either CLOCK_MONOTONIC or a simulated clock that only
+ *   moves when something sleeps
+ * - Due timers fire in deadline order; timers due together complete as
+ *   one batch through complete_sleeps(), so their dependents are
+ *   recalculated once
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <poll.h>
+#include "process.h"
+#include "timer.h"
+
+bool sleep_async = false;
+bool virtual_clock = false;
+
+// Simulated clock time (ms), only moved by timer_sleep()
+static long long virtual_now = 0;
+
+static Timer *wheel[TIMER_SLOTS];
+static Timer *pending_list = NULL;
+static Timer *cell_table[TIMER_CELL_BUCKETS];
+static int pending = 0;
+static long long current_tick = -1;
+
+/**
+ * Returns the current monotonic clock time in milliseconds
+ * On the virtual clock this is the total time slept so far
+ */
+long long timer_now() {
+    if (virtual_clock) return virtual_now;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the bucket of cell (r, c) in the cell table
+ */
+static unsigned int cell_hash(int r, int c) {
+    return ((unsigned int)r * 2654435761u ^ (unsigned int)c * 40503u) % TIMER_CELL_BUCKETS;
+}
+
+/**
+ * Sleeps for the given number of milliseconds
+ * On the virtual clock the time is added to the clock without blocking
+ */
+void timer_sleep(long long ms) {
+    if (ms <= 0) return;
+    if (virtual_clock) {
+        virtual_now += ms;
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Registers a timer for cell (r, c) that stores value after the delay
+ * A cell has at most one timer; scheduling again replaces it
+ */
+void timer_schedule(int r, int c, int value, int seconds) {
+    if (r >= 0) timer_cancel(r, c);
+
+    long long now = timer_now();
+    if (current_tick < 0) current_tick = now / TIMER_TICK_MS;
+
+    Timer *timer = (Timer *)malloc(sizeof(Timer));
+    timer->r = r;
+    timer->c = c;
+    timer->value = value;
+    timer->deadline = now + (long long)seconds * 1000;
+
+    int slot = (int)((timer->deadline / TIMER_TICK_MS) % TIMER_SLOTS);
+    timer->next = wheel[slot];
+    wheel[slot] = timer;
+
+    timer->prev_pending = NULL;
+    timer->next_pending = pending_list;
+    if (pending_list != NULL) pending_list->prev_pending = timer;
+    pending_list = timer;
+    pending++;
+
+    // Bare sleep commands have no cell and are never looked up
+    timer->next_cell = NULL;
+    if (r >= 0) {
+        unsigned int bucket = cell_hash(r, c);
+        timer->next_cell = cell_table[bucket];
+        cell_table[bucket] = timer;
+    }
+}
+
+/**
+ * Removes a timer from the pending list and the cell table
+ */
+static void unlink_pending(Timer *timer) {
+    if (timer->r >= 0) {
+        Timer **link = &cell_table[cell_hash(timer->r, timer->c)];
+        while (*link != timer) {
+            link = &(*link)->next_cell;
+        }
+        *link = timer->next_cell;
+    }
+
+    if (timer->prev_pending != NULL) {
+        timer->prev_pending->next_pending = timer->next_pending;
+    } else {
+        pending_list = timer->next_pending;
+    }
+    if (timer->next_pending != NULL) {
+        timer->next_pending->prev_pending = timer->prev_pending;
+    }
+    pending--;
+}
+
+/**
+ * Finds the pending timer of cell (r, c)
+ * @return The timer, or NULL if the cell is not pending
+ */
+static Timer *find_timer(int r, int c) {
+    for (Timer *timer = cell_table[cell_hash(r, c)]; timer != NULL; timer = timer->next_cell) {
+        if (timer->r == r && timer->c == c) return timer;
+    }
+    return NULL;
+}
+
+/**
+ * Drops the pending timer of a cell, if any
+ */
+void timer_cancel(int r, int c) {
+    Timer *timer = find_timer(r, c);
+    if (timer == NULL) return;
+
+    Timer **link = &wheel[(timer->deadline / TIMER_TICK_MS) % TIMER_SLOTS];
+    while (*link != timer) {
+        link = &(*link)->next;
+    }
+    *link = timer->next;
+    unlink_pending(timer);
+    free(timer);
+}
+
+/**
+ * Checks whether a cell is still waiting on its SLEEP
+ */
+bool timer_pending(int r, int c) {
+    return find_timer(r, c) != NULL;
+}
+
+/**
+ * Returns the number of pending timers
+ */
+int timer_count() {
+    return pending;
+}
+
+/**
+ * Drops every pending timer
+ */
+void timer_clear() {
+    for (int slot = 0; slot < TIMER_SLOTS; slot++) {
+        while (wheel[slot] != NULL) {
+            Timer *timer = wheel[slot];
+            wheel[slot] = timer->next;
+            free(timer);
+        }
+    }
+    for (int bucket = 0; bucket < TIMER_CELL_BUCKETS; bucket++) {
+        cell_table[bucket] = NULL;
+    }
+    pending_list = NULL;
+    pending = 0;
+    current_tick = -1;
+}
+
+/**
+ * Returns the earliest pending deadline, or -1 if nothing is pending
+ */
+static long long next_deadline() {
+    long long earliest = -1;
+    for (Timer *timer = pending_list; timer != NULL; timer = timer->next_pending) {
+        if (earliest < 0 || timer->deadline < earliest) earliest = timer->deadline;
+    }
+    return earliest;
+}
+
+/**
+ * Fires every timer whose deadline has passed
+ * Due timers are unlinked first and then completed in deadline order,
+ * so completions may safely schedule or cancel other timers
+ * @return Number of timers fired
+ */
+int timer_expire() {
+    if (pending == 0) return 0;
+
+    long long now = timer_now();
+    long long now_tick = now / TIMER_TICK_MS;
+    long long ticks = now_tick - current_tick + 1;
+    if (ticks > TIMER_SLOTS) ticks = TIMER_SLOTS;
+
+    // Collect due timers, sorted by deadline
+    Timer *due = NULL;
+    for (long long t = now_tick - ticks + 1; t <= now_tick; t++) {
+        Timer **link = &wheel[t % TIMER_SLOTS];
+        while (*link != NULL) {
+            Timer *timer = *link;
+            if (timer->deadline > now) {
+                link = &timer->next;
+                continue;
+            }
+            *link = timer->next;
+            unlink_pending(timer);
+
+            Timer **spot = &due;
+            while (*spot != NULL && (*spot)->deadline <= timer->deadline) {
+                spot = &(*spot)->next;
+            }
+            timer->next = *spot;
+            *spot = timer;
+        }
+    }
+    current_tick = now_tick;
+
+    int fired = 0;
+    for (Timer *timer = due; timer != NULL; timer = timer->next) {
+        fired++;
+    }
+    if (fired == 0) return 0;
+
+    // Complete the whole batch at once so the sleeps that ran side by side
+    // share one recalculation of their dependents
+    int *rows = (int *)malloc(fired * sizeof(int));
+    int *cols = (int *)malloc(fired * sizeof(int));
+    int *values = (int *)malloc(fired * sizeof(int));
+    int cells = 0;
+    while (due != NULL) {
+        Timer *timer = due;
+        due = timer->next;
+        if (timer->r >= 0) {
+            rows[cells] = timer->r;
+            cols[cells] = timer->c;
+            values[cells] = timer->value;
+            cells++;
+        }
+        free(timer);
+    }
+    if (cells > 0) {
+        complete_sleeps(cells, rows, cols, values);
+    }
+    free(rows);
+    free(cols);
+    free(values);
+    return fired;
+}
+
+/**
+ * Waits until fd has input or the earliest timer is due
+ * A negative fd is ignored by poll(2), so only the timer is waited for
+ * @return true if input is ready, false if a timer deadline was reached
+ */
+bool timer_wait_input(int fd) {
+    long long deadline = next_deadline();
+    int timeout = -1;
+    if (deadline >= 0) {
+        long long wait = deadline - timer_now();
+        timeout = wait > 0 ? (int)wait : 0;
+    }
+
+    struct pollfd request;
+    request.fd = fd;
+    request.events = POLLIN;
+    request.revents = 0;
+    return poll(&request, 1, timeout) != 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * timer.h
+ * Timer wheel for non-blocking SLEEP
+ * A SLEEP cell registers a deadline here and stays pending until the
+ * event loop in main() fires the timer and stores the result
+ * The clock can be simulated, so that sleeping costs no real time
+ */
+
+#ifndef __TIMER__
+#define __TIMER__
+
+#include <stdbool.h>
+
+// Number of slots in the wheel and duration of one slot (milliseconds)
+#define TIMER_SLOTS 512
+#define TIMER_TICK_MS 10
+
+// Number of buckets of the table that finds the timer of a cell
+#define TIMER_CELL_BUCKETS 1024
+
+/**
+ * Pending SLEEP timer
+ */
+typedef struct Timer {
+    int r;                      // Row of the SLEEP cell (-1 for a bare sleep command)
+    int c;                      // Column of the SLEEP cell
+    int value;                  // Value stored in the cell when the timer fires
+    long long deadline;         // Clock time (ms) at which the timer fires
+    struct Timer *next;         // Next timer in the same slot
+    struct Timer *prev_pending; // Previous timer in the pending list
+    struct Timer *next_pending; // Next timer in the pending list
+    struct Timer *next_cell;    // Next timer in the same cell bucket
+} Timer;
+
+// SLEEP registers timers instead of blocking (enabled by the REPL)
+extern bool sleep_async;
+
+// Sleeping advances a simulated clock instead of blocking (--virtual-clock)
+extern bool virtual_clock;
+
+// Clock
+long long timer_now();                                  // Current clock time in milliseconds
+void timer_sleep(long long ms);                         // Block, or advance the virtual clock
+
+// Timer management functions
+void timer_schedule(int r, int c, int value, int seconds);  // Fire after the given delay
+void timer_cancel(int r, int c);                        // Drop the timer of a cell
+bool timer_pending(int r, int c);                       // Check if a cell is waiting on a timer
+int timer_count();                                      // Number of pending timers
+void timer_clear();                                     // Drop all timers
+
+// Event loop functions
+int timer_expire();                                     // Fire all due timers, return how many fired
+bool timer_wait_input(int fd);                          // Wait for input or the next deadline
+
+#endif
@@ -11,6 +11,7 @@
 #include "../clab/io.h"
 #include "../clab/process.h"
 #include "../clab/dependent.h"
+#include "../clab/range.h"
 
 // Global sheet declaration
 extern int** sheet;
@@ -20,6 +21,8 @@ extern char status[20];
 void test_parent_child_relationships(FILE *output_file);
 void test_cycle_detection(FILE *output_file);
 void test_dependency_updates(FILE *output_file);
+void test_shared_ranges(FILE *output_file);
+void test_sliding_windows(FILE *output_file);
 
 // External function declarations
 void update_dependents(int row, int col);
@@ -35,6 +38,8 @@ void run_dependent_tests(FILE *output_file) {
     test_parent_child_relationships(output_file);
     test_cycle_detection(output_file);
     test_dependency_updates(output_file);
+    test_shared_ranges(output_file);
+    test_sliding_windows(output_file);
     
     // Print completion message to both stdout and output file
     fprintf(output_file, "All dependent tests are passed.\n");
@@ -50,7 +55,7 @@ void test_parent_child_relationships(FILE *output_file) {
     // Reset sheet values
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
         }
     }
     
@@ -140,7 +145,7 @@ void test_cycle_detection(FILE *output_file) {
     // Reset sheet values and dependencies
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
             
             // Clear parent and child lists
             while (Parent_lst[i][j] != NULL) {
@@ -228,7 +233,7 @@ void test_dependency_updates(FILE *output_file) {
     // Reset sheet values and dependencies
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
             
             // Clear parent and child lists
             while (Parent_lst[i][j] != NULL) {
@@ -246,7 +251,7 @@ void test_dependency_updates(FILE *output_file) {
     }
     
     // Set up initial values
-    sheet[0][0] = 10;  // A1 = 10
+    CELL(0, 0) = 10;  // A1 = 10
     
     // Create test formulas
     ParsedCommand cmd1, cmd2, cmd3;
@@ -293,13 +298,13 @@ void test_dependency_updates(FILE *output_file) {
     fprintf(output_file, "Setting B2 = A1\n");
     assign_parent(0, 0, 1, 1, cmd1);
     assign_child(0, 0, 1, 1, cmd1);
-    sheet[1][1] = sheet[0][0];  // B2 = A1 = 10
+    CELL(1, 1) = CELL(0, 0);  // B2 = A1 = 10
     
     // Set up C3 = B2 + 5
     fprintf(output_file, "Setting C3 = B2 + 5\n");
     assign_parent(1, 1, 2, 2, cmd2);
     assign_child(1, 1, 2, 2, cmd2);
-    sheet[2][2] = sheet[1][1] + 5;  // C3 = B2 + 5 = 10 + 5 = 15
+    CELL(2, 2) = CELL(1, 1) + 5;  // C3 = B2 + 5 = 10 + 5 = 15
     
     // Set up D4 = SUM(A1:C3)
     fprintf(output_file, "Setting D4 = SUM(A1:C3)\n");
@@ -310,27 +315,186 @@ void test_dependency_updates(FILE *output_file) {
         }
     }
     // D4 = SUM(A1:C3) = 10 + 10 + 15 + zeros = 35
-    sheet[3][3] = 35;
+    CELL(3, 3) = 35;
     
     // Print initial values
     fprintf(output_file, "Initial values:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B2 = %d\n", sheet[1][1]);
-    fprintf(output_file, "  C3 = %d\n", sheet[2][2]);
-    fprintf(output_file, "  D4 = %d\n", sheet[3][3]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B2 = %d\n", CELL(1, 1));
+    fprintf(output_file, "  C3 = %d\n", CELL(2, 2));
+    fprintf(output_file, "  D4 = %d\n", CELL(3, 3));
     
     // Change A1 and update dependencies
     fprintf(output_file, "Changing A1 to 20 and updating dependencies\n");
-    sheet[0][0] = 20;
+    CELL(0, 0) = 20;
     update_dependents(0, 0);
     
     // Print updated values
     fprintf(output_file, "Updated values:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B2 = %d\n", sheet[1][1]);
-    fprintf(output_file, "  C3 = %d\n", sheet[2][2]);
-    fprintf(output_file, "  D4 = %d\n", sheet[3][3]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B2 = %d\n", CELL(1, 1));
+    fprintf(output_file, "  C3 = %d\n", CELL(2, 2));
+    fprintf(output_file, "  D4 = %d\n", CELL(3, 3));
     
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_DEPENDENCY_UPDATES is passed\n");
-} 
\ No newline at end of file
+}
+
+/**
+ * Test that identical range formulas share one interned range
+ */
+void test_shared_ranges(FILE *output_file) {
+    fprintf(output_file, "Testing shared range deduplication...\n");
+    
+    // Reset sheet values and dependencies
+    for (int i = 0; i < MAXROW; i++) {
+        for (int j = 0; j < MAXCOL; j++) {
+            CELL(i, j) = 0;
+        }
+    }
+    free_parent_list();
+    free_child_list();
+    make_parent_list();
+    make_child_list();
+    
+    CELL(0, 0) = 1;  // A1 = 1
+    CELL(1, 0) = 2;  // A2 = 2
+    CELL(2, 0) = 3;  // A3 = 3
+    
+    // B1 = SUM(A1:A3) and C1 = SUM(A1:A3)
+    ParsedCommand cmd1, cmd2;
+    memset(&cmd1, 0, sizeof(ParsedCommand));
+    cmd1.type = CMD_FUNCTION;
+    cmd1.func = FUNC_SUM;
+    strcpy(cmd1.cell, "B1");
+    strcpy(cmd1.expression, "SUM(A1:A3)");
+    strcpy(cmd1.range, "A1:A3");
+    cmd1.op1.row = 1;
+    cmd1.op1.col = 2;
+    cmd1.op2.row = 1;
+    cmd1.op2.col = 1;
+    cmd1.op3.row = 3;
+    cmd1.op3.col = 1;
+    cmd2 = cmd1;
+    strcpy(cmd2.cell, "C1");
+    cmd2.op1.col = 3;
+    
+    fprintf(output_file, "Setting B1 = SUM(A1:A3) and C1 = SUM(A1:A3)\n");
+    function(&cmd1);
+    function(&cmd2);
+    
+    // A1 should hold a single edge to the shared range
+    int edges = 0;
+    for (Child *child = Child_lst[0][0]; child != NULL; child = child->next) {
+        edges++;
+    }
+    RangeEntry *entry = range_lookup(FUNC_SUM, 0, 0, 0, 0, 2, 0);
+    int subscribers = 0;
+    if (entry != NULL) {
+        for (Subscriber *sub = entry->subs; sub != NULL; sub = sub->next) {
+            subscribers++;
+        }
+    }
+    fprintf(output_file, "Edges from A1: %d (should be 1)\n", edges);
+    fprintf(output_file, "Subscribers of SUM(A1:A3): %d (should be 2)\n", subscribers);
+    fprintf(output_file, "  B1 = %d, C1 = %d (should be 6)\n", CELL(0, 1), CELL(0, 2));
+    
+    // Change A2 and propagate through the shared range
+    fprintf(output_file, "Changing A2 to 10 and updating dependencies\n");
+    CELL(1, 0) = 10;
+    update_dependents(1, 0);
+    fprintf(output_file, "  B1 = %d, C1 = %d (should be 14)\n", CELL(0, 1), CELL(0, 2));
+    
+    // Rebinding the last subscriber releases the range and its edges
+    fprintf(output_file, "Clearing the formulas of B1 and C1\n");
+    clear_parents(0, 1);
+    clear_parents(0, 2);
+    fprintf(output_file, "Range still interned: %s\n",
+            range_lookup(FUNC_SUM, 0, 0, 0, 0, 2, 0) != NULL ? "Yes" : "No");
+    fprintf(output_file, "Edges from A1 after release: %s\n",
+            Child_lst[0][0] == NULL ? "None" : "Some");
+    
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_SHARED_RANGES is passed\n");
+}
+
+/**
+ * Test that runs of shifted window formulas are recomputed correctly
+ */
+void test_sliding_windows(FILE *output_file) {
+    fprintf(output_file, "Testing sliding window recalculation...\n");
+    
+    // Reset sheet values and dependencies
+    for (int i = 0; i < MAXROW; i++) {
+        for (int j = 0; j < MAXCOL; j++) {
+            CELL(i, j) = 0;
+        }
+    }
+    free_parent_list();
+    free_child_list();
+    make_parent_list();
+    make_child_list();
+    
+    // A1..A10 = 3, 1, 4, 1, 5, 9, 2, 6, 5, 3
+    int data[10] = {3, 1, 4, 1, 5, 9, 2, 6, 5, 3};
+    for (int i = 0; i < 10; i++) {
+        CELL(i, 0) = data[i];
+    }
+    
+    // Bk = SUM(Ak:Ak+2), Ck = MIN(Ak:Ak+2), Dk = STDEV(Ak:Ak+2) for k = 1..8
+    const int funcs[3] = {FUNC_SUM, FUNC_MIN, FUNC_STDEV};
+    fprintf(output_file, "Setting rolling SUM, MIN and STDEV windows of height 3\n");
+    for (int f = 0; f < 3; f++) {
+        for (int k = 1; k <= 8; k++) {
+            ParsedCommand cmd;
+            memset(&cmd, 0, sizeof(ParsedCommand));
+            cmd.type = CMD_FUNCTION;
+            cmd.func = funcs[f];
+            cmd.op1.row = k;
+            cmd.op1.col = 2 + f;
+            cmd.op2.row = k;
+            cmd.op2.col = 1;
+            cmd.op3.row = k + 2;
+            cmd.op3.col = 1;
+            function(&cmd);
+        }
+    }
+    
+    // Change A5, which lies in three windows of every column
+    fprintf(output_file, "Changing A5 to -7 and updating dependencies\n");
+    CELL(4, 0) = -7;
+    update_dependents(4, 0);
+    
+    int mismatches = 0;
+    for (int f = 0; f < 3; f++) {
+        for (int k = 0; k < 8; k++) {
+            int expected = range_aggregate(funcs[f], k, 0, k + 2, 0);
+            if (CELL(k, 1 + f) != expected) {
+                mismatches++;
+            }
+        }
+    }
+    fprintf(output_file, "  B3..B5 = %d %d %d (should be -2 3 4)\n",
+            CELL(2, 1), CELL(3, 1), CELL(4, 1));
+    fprintf(output_file, "  C3..C5 = %d %d %d (should be -7 -7 -7)\n",
+            CELL(2, 2), CELL(3, 2), CELL(4, 2));
+    fprintf(output_file, "Windows differing from a full scan: %d (should be 0)\n", mismatches);
+
+    // Values whose squared deviations overflow a long long when added up
+    fprintf(output_file, "Setting A1..A10 to alternating +-2000000000\n");
+    for (int i = 0; i < 10; i++) {
+        CELL(i, 0) = i % 2 == 0 ? 2000000000 : -2000000000;
+        update_dependents(i, 0);
+    }
+    mismatches = 0;
+    for (int f = 0; f < 3; f++) {
+        for (int k = 0; k < 8; k++) {
+            if (CELL(k, 1 + f) != range_aggregate(funcs[f], k, 0, k + 2, 0)) mismatches++;
+        }
+    }
+    fprintf(output_file, "  D1 = STDEV(A1:A3) = %d (should be 1885618083)\n", CELL(0, 3));
+    fprintf(output_file, "Large windows differing from a full scan: %d (should be 0)\n", mismatches);
+    
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_SLIDING_WINDOWS is passed\n");
+}
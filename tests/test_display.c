@@ -7,9 +7,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "../clab/init.h"
 #include "../clab/io.h"
 #include "../clab/display.h"
+#include "../clab/label.h"
 
 // Global sheet declaration
 extern int** sheet;
@@ -27,6 +29,10 @@ extern bool was_disabled;
 void test_scrolling(FILE *output_file);
 void test_output_control(FILE *output_file);
 void test_int_to_alpha(FILE *output_file);
+void test_column_labels(FILE *output_file);
+void test_render_frame(FILE *output_file);
+void test_render_update(FILE *output_file);
+void test_viewport_size(FILE *output_file);
 
 /**
  * Run all display tests
@@ -39,6 +45,10 @@ void run_display_tests(FILE *output_file) {
     test_scrolling(output_file);
     test_output_control(output_file);
     test_int_to_alpha(output_file);
+    test_column_labels(output_file);
+    test_render_frame(output_file);
+    test_render_update(output_file);
+    test_viewport_size(output_file);
     
     // Print completion message to both stdout and output file
     fprintf(output_file, "All display tests are passed.\n");
@@ -143,4 +153,205 @@ void test_int_to_alpha(FILE *output_file) {
     output_enabled = original_output_state;
     
     fprintf(output_file, "int_to_alpha tests completed.\n");
-} 
\ No newline at end of file
+} 
+
+/**
+ * Test the shared column label table in both directions
+ */
+void test_column_labels(FILE *output_file) {
+    fprintf(output_file, "Testing column label table...\n");
+
+    const int columns[] = {1, 26, 27, 702, 703, 18278};
+    for (int i = 0; i < 6; i++) {
+        int length;
+        const char *label = column_label(columns[i], &length);
+        fprintf(output_file, "Column %d = %s (%d letters)\n", columns[i], label, length);
+    }
+    fprintf(output_file, "Column 18279 has a label: %s (should be no)\n",
+            column_label(LABEL_COLUMNS + 1, NULL) ? "yes" : "no");
+
+    // Every label reads back as its own column
+    int mismatches = 0;
+    for (int col = 1; col <= LABEL_COLUMNS; col++) {
+        int length;
+        const char *label = column_label(col, &length);
+        const char *stop;
+        if (column_number(label, label + length, &stop) != col || stop != label + length) mismatches++;
+    }
+    fprintf(output_file, "Round-trip mismatches: %d (should be 0)\n", mismatches);
+
+    const char *text = "zz12";
+    const char *stop;
+    fprintf(output_file, "Column of zz12 = %d (should be 702)\n", column_number(text, text + 4, &stop));
+    fprintf(output_file, "Row digits start at offset %d (should be 2)\n", (int)(stop - text));
+    text = "ABCD1";
+    fprintf(output_file, "Column of ABCD1 = %d (should be 0)\n", column_number(text, text + 5, NULL));
+
+    fprintf(output_file, "TEST_COLUMN_LABELS is passed\n");
+}
+/**
+ * Test the frame buffer against the printf formatting it replaces
+ */
+void test_render_frame(FILE *output_file) {
+    fprintf(output_file, "Testing frame rendering...\n");
+
+    int saved_r = curr_org_r, saved_c = curr_org_c;
+    curr_org_r = 70;
+    curr_org_c = 1;
+
+    // Values narrower and wider than a cell, negative, and errors
+    int values[] = {0, -5, 12345678, 123456789, INT_MAX, -2147483647, ERROR_VALUE, 42, -1000000, 7};
+    for (int j = 0; j < displayr; j++) {
+        for (int i = 0; i < displayc; i++) {
+            CELL(69 + j, i) = values[(i + j) % 10];
+        }
+    }
+
+    // Each column is cellwidth wide, or one more than its widest value
+    int widths[10];
+    for (int i = 0; i < displayc; i++) {
+        widths[i] = cellwidth;
+        for (int j = 0; j < displayr; j++) {
+            int value = CELL(69 + j, i);
+            int len = value == ERROR_VALUE ? 3 : snprintf(NULL, 0, "%d", value);
+            if (len >= widths[i]) widths[i] = len + 1;
+        }
+    }
+
+    // Expected text, built with printf formatting
+    static char expected[8192];
+    int n = snprintf(expected, sizeof(expected), "%*s", cellwidth, "");
+    for (int i = 0; i < displayc; i++) {
+        char temp[MAXCOLWIDTH + 1] = "   ";
+        int_to_alpha(curr_org_c + i, temp);
+        n += snprintf(expected + n, sizeof(expected) - n, "%*s", widths[i], temp);
+    }
+    n += snprintf(expected + n, sizeof(expected) - n, "\n");
+    for (int j = 0; j < displayr; j++) {
+        n += snprintf(expected + n, sizeof(expected) - n, "%-*d", cellwidth, curr_org_r + j);
+        for (int i = 0; i < displayc; i++) {
+            int value = CELL(69 + j, i);
+            if (value == ERROR_VALUE) {
+                n += snprintf(expected + n, sizeof(expected) - n, "%*s", widths[i], "ERR");
+            } else {
+                n += snprintf(expected + n, sizeof(expected) - n, "%*d", widths[i], value);
+            }
+        }
+        n += snprintf(expected + n, sizeof(expected) - n, "\n");
+    }
+
+    size_t length;
+    const char *frame = render_frame(&length);
+    bool same = length == (size_t)n && memcmp(frame, expected, length) == 0;
+    fprintf(output_file, "Frame length: %d (should be %d)\n", (int)length, n);
+    fprintf(output_file, "Frame matches printf formatting: %s (should be Yes)\n", same ? "Yes" : "No");
+    fprintf(output_file, "Width of column C: %d (should be 12)\n", widths[2]);
+
+    curr_org_r = saved_r;
+    curr_org_c = saved_c;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_RENDER_FRAME is passed\n");
+}
+
+/**
+ * Test differential redraws: only changed cells are rewritten
+ */
+void test_render_update(FILE *output_file) {
+    fprintf(output_file, "Testing differential rendering...\n");
+
+    int saved_r = curr_org_r, saved_c = curr_org_c;
+    curr_org_r = 70;
+    curr_org_c = 1;
+    for (int j = 0; j < displayr; j++) {
+        for (int i = 0; i < displayc; i++) {
+            CELL(69 + j, i) = j * 10 + i;
+        }
+    }
+
+    size_t length;
+    display_invalidate();
+    const char *text = render_update(&length);
+    fprintf(output_file, "First update clears the screen: %s (should be Yes)\n",
+            length > 7 && memcmp(text, "\x1b[H\x1b[2J", 7) == 0 ? "Yes" : "No");
+
+    // One changed cell: B71 is on screen row 3, in columns 17-24
+    CELL(70, 1) = -42;
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\x1b[3;17H%*d\x1b[%d;1H\x1b[J", cellwidth, -42, displayr + 2);
+    text = render_update(&length);
+    fprintf(output_file, "Only B71 rewritten: %s (should be Yes)\n",
+            length == strlen(expected) && memcmp(text, expected, length) == 0 ? "Yes" : "No");
+
+    // Nothing changed: only the cursor goes back to the prompt line
+    text = render_update(&length);
+    snprintf(expected, sizeof(expected), "\x1b[%d;1H\x1b[J", displayr + 2);
+    fprintf(output_file, "Unchanged frame: %s (should be Yes)\n",
+            length == strlen(expected) && memcmp(text, expected, length) == 0 ? "Yes" : "No");
+
+    // A value wider than its column and a scroll both redraw everything
+    CELL(70, 1) = 123456789;
+    text = render_update(&length);
+    fprintf(output_file, "Wide value redraws the frame: %s (should be Yes)\n",
+            memcmp(text, "\x1b[H\x1b[2J", 7) == 0 ? "Yes" : "No");
+    CELL(70, 1) = 1;
+    render_update(&length);
+    curr_org_c = 2;
+    text = render_update(&length);
+    fprintf(output_file, "Scroll redraws the frame: %s (should be Yes)\n",
+            memcmp(text, "\x1b[H\x1b[2J", 7) == 0 ? "Yes" : "No");
+
+    curr_org_r = saved_r;
+    curr_org_c = saved_c;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_RENDER_UPDATE is passed\n");
+}
+
+/**
+ * Test the viewport command and frames larger than the default
+ */
+void test_viewport_size(FILE *output_file) {
+    fprintf(output_file, "Testing viewport size...\n");
+
+    char input[32];
+    ParsedCommand cmd;
+    strcpy(input, "viewport 40 20");
+    input_parser(input, &cmd);
+    fprintf(output_file, "viewport 40 20: %d rows, %d columns (should be 40 rows, 20 columns)\n",
+            cmd.type == CMD_VIEWPORT ? cmd.op1.row : -1, cmd.type == CMD_VIEWPORT ? cmd.op1.col : -1);
+    strcpy(input, "viewport auto");
+    input_parser(input, &cmd);
+    fprintf(output_file, "viewport auto accepted: %s (should be Yes)\n",
+            cmd.type == CMD_VIEWPORT && cmd.op1.row == 0 ? "Yes" : "No");
+    strcpy(input, "viewport 0 5");
+    input_parser(input, &cmd);
+    fprintf(output_file, "viewport 0 5 accepted: %s (should be No)\n", cmd.type == CMD_VIEWPORT ? "Yes" : "No");
+
+    // A 40x100 frame of the test sheet: every line holds all 100 columns
+    int saved_r = curr_org_r, saved_c = curr_org_c;
+    int saved_rows = displayr, saved_cols = displayc;
+    curr_org_r = 1;
+    curr_org_c = 1;
+    set_viewport(40, 100);
+    size_t length;
+    const char *frame = render_frame(&length);
+    int lines = 0;
+    const char *line = frame;
+    bool full_lines = true;
+    for (const char *p = frame; p < frame + length; p++) {
+        if (*p != '\n') continue;
+        if (p - line < cellwidth + 100 * cellwidth) full_lines = false;
+        line = p + 1;
+        lines++;
+    }
+    fprintf(output_file, "Frame lines: %d (should be 41)\n", lines);
+    fprintf(output_file, "Every line spans 100 columns: %s (should be Yes)\n", full_lines ? "Yes" : "No");
+
+    set_viewport(saved_rows, saved_cols);
+    curr_org_r = saved_r;
+    curr_org_c = saved_c;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_VIEWPORT_SIZE is passed\n");
+}
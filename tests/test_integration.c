@@ -7,11 +7,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "../clab/init.h"
 #include "../clab/io.h"
 #include "../clab/process.h"
 #include "../clab/dependent.h"
 #include "../clab/display.h"
+#include "../clab/batch.h"
+#include "../clab/snapshot.h"
+#include "../clab/journal.h"
+#include "../clab/storage.h"
 
 // Global sheet declaration
 extern int** sheet;
@@ -22,6 +29,13 @@ extern bool output_enabled;
 void test_complex_dependencies(FILE *output_file);
 void test_command_processing(FILE *output_file);
 void test_error_propagation(FILE *output_file);
+void test_batch_mode(FILE *output_file);
+void test_snapshot(FILE *output_file);
+void test_import(FILE *output_file);
+void test_export(FILE *output_file);
+void test_journal(FILE *output_file);
+void test_backing(FILE *output_file);
+void test_bgsave(FILE *output_file);
 
 /**
  * Run all integration tests
@@ -34,6 +48,13 @@ void run_integration_tests(FILE *output_file) {
     test_complex_dependencies(output_file);
     test_command_processing(output_file);
     test_error_propagation(output_file);
+    test_batch_mode(output_file);
+    test_snapshot(output_file);
+    test_import(output_file);
+    test_export(output_file);
+    test_journal(output_file);
+    test_backing(output_file);
+    test_bgsave(output_file);
     
     // Print completion message to both stdout and output file
     fprintf(output_file, "All integration tests are passed.\n");
@@ -86,7 +107,7 @@ void test_complex_dependencies(FILE *output_file) {
     // Reset sheet values and dependencies
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
             
             // Clear parent and child lists
             while (Parent_lst[i][j] != NULL) {
@@ -113,36 +134,36 @@ void test_complex_dependencies(FILE *output_file) {
     
     // Print initial values
     fprintf(output_file, "Initial values:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B1 = %d\n", sheet[0][1]);
-    fprintf(output_file, "  C1 = %d\n", sheet[0][2]);
-    fprintf(output_file, "  D1 = %d\n", sheet[0][3]);
-    fprintf(output_file, "  E1 = %d\n", sheet[0][4]);
-    fprintf(output_file, "  F1 = %d\n", sheet[0][5]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B1 = %d\n", CELL(0, 1));
+    fprintf(output_file, "  C1 = %d\n", CELL(0, 2));
+    fprintf(output_file, "  D1 = %d\n", CELL(0, 3));
+    fprintf(output_file, "  E1 = %d\n", CELL(0, 4));
+    fprintf(output_file, "  F1 = %d\n", CELL(0, 5));
     
     // Change A1 and see how it propagates
     process_command_string("A1=15", output_file);
     
     // Print updated values
     fprintf(output_file, "Values after changing A1 to 15:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B1 = %d\n", sheet[0][1]);
-    fprintf(output_file, "  C1 = %d\n", sheet[0][2]);
-    fprintf(output_file, "  D1 = %d\n", sheet[0][3]);
-    fprintf(output_file, "  E1 = %d\n", sheet[0][4]);
-    fprintf(output_file, "  F1 = %d\n", sheet[0][5]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B1 = %d\n", CELL(0, 1));
+    fprintf(output_file, "  C1 = %d\n", CELL(0, 2));
+    fprintf(output_file, "  D1 = %d\n", CELL(0, 3));
+    fprintf(output_file, "  E1 = %d\n", CELL(0, 4));
+    fprintf(output_file, "  F1 = %d\n", CELL(0, 5));
     
     // Change B1 and see how it propagates
     process_command_string("B1=25", output_file);
     
     // Print updated values
     fprintf(output_file, "Values after changing B1 to 25:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B1 = %d\n", sheet[0][1]);
-    fprintf(output_file, "  C1 = %d\n", sheet[0][2]);
-    fprintf(output_file, "  D1 = %d\n", sheet[0][3]);
-    fprintf(output_file, "  E1 = %d\n", sheet[0][4]);
-    fprintf(output_file, "  F1 = %d\n", sheet[0][5]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B1 = %d\n", CELL(0, 1));
+    fprintf(output_file, "  C1 = %d\n", CELL(0, 2));
+    fprintf(output_file, "  D1 = %d\n", CELL(0, 3));
+    fprintf(output_file, "  E1 = %d\n", CELL(0, 4));
+    fprintf(output_file, "  F1 = %d\n", CELL(0, 5));
     
     output_enabled = original_output_state;
     fprintf(output_file, "\n");
@@ -164,7 +185,7 @@ void test_command_processing(FILE *output_file) {
     // Reset sheet values and dependencies
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
             
             // Clear parent and child lists
             while (Parent_lst[i][j] != NULL) {
@@ -185,44 +206,44 @@ void test_command_processing(FILE *output_file) {
     
     // Direct value assignment
     process_command_string("A1=42", output_file);
-    fprintf(output_file, "A1 after direct assignment: %d\n", sheet[0][0]);
+    fprintf(output_file, "A1 after direct assignment: %d\n", CELL(0, 0));
     
     // Cell reference assignment
     process_command_string("B1=A1", output_file);
-    fprintf(output_file, "B1 after reference assignment: %d\n", sheet[0][1]);
+    fprintf(output_file, "B1 after reference assignment: %d\n", CELL(0, 1));
     
     // Arithmetic operations
     process_command_string("C1=A1+10", output_file);
-    fprintf(output_file, "C1 after A1+10: %d\n", sheet[0][2]);
+    fprintf(output_file, "C1 after A1+10: %d\n", CELL(0, 2));
     
     process_command_string("D1=A1-10", output_file);
-    fprintf(output_file, "D1 after A1-10: %d\n", sheet[0][3]);
+    fprintf(output_file, "D1 after A1-10: %d\n", CELL(0, 3));
     
     process_command_string("E1=A1*2", output_file);
-    fprintf(output_file, "E1 after A1*2: %d\n", sheet[0][4]);
+    fprintf(output_file, "E1 after A1*2: %d\n", CELL(0, 4));
     
     process_command_string("F1=A1/2", output_file);
-    fprintf(output_file, "F1 after A1/2: %d\n", sheet[0][5]);
+    fprintf(output_file, "F1 after A1/2: %d\n", CELL(0, 5));
     
     // Range functions
     process_command_string("A2=MIN(A1:F1)", output_file);
-    fprintf(output_file, "A2 after MIN(A1:F1): %d\n", sheet[1][0]);
+    fprintf(output_file, "A2 after MIN(A1:F1): %d\n", CELL(1, 0));
     
     process_command_string("B2=MAX(A1:F1)", output_file);
-    fprintf(output_file, "B2 after MAX(A1:F1): %d\n", sheet[1][1]);
+    fprintf(output_file, "B2 after MAX(A1:F1): %d\n", CELL(1, 1));
     
     process_command_string("C2=SUM(A1:F1)", output_file);
-    fprintf(output_file, "C2 after SUM(A1:F1): %d\n", sheet[1][2]);
+    fprintf(output_file, "C2 after SUM(A1:F1): %d\n", CELL(1, 2));
     
     process_command_string("D2=AVG(A1:F1)", output_file);
-    fprintf(output_file, "D2 after AVG(A1:F1): %d\n", sheet[1][3]);
+    fprintf(output_file, "D2 after AVG(A1:F1): %d\n", CELL(1, 3));
     
     process_command_string("E2=STDEV(A1:F1)", output_file);
-    fprintf(output_file, "E2 after STDEV(A1:F1): %d\n", sheet[1][4]);
+    fprintf(output_file, "E2 after STDEV(A1:F1): %d\n", CELL(1, 4));
     
     // Sleep function (with minimal sleep time for testing)
     process_command_string("F2=SLEEP(1)", output_file);
-    fprintf(output_file, "F2 after SLEEP(1): %d\n", sheet[1][5]);
+    fprintf(output_file, "F2 after SLEEP(1): %d\n", CELL(1, 5));
     
     // Control commands
     process_command_string("disable_output", output_file);
@@ -265,7 +286,7 @@ void test_error_propagation(FILE *output_file) {
     // Reset sheet values and dependencies
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
         }
     }
     
@@ -284,22 +305,22 @@ void test_error_propagation(FILE *output_file) {
     
     // Print values
     fprintf(output_file, "Values after setting up error chain:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B1 = %d\n", sheet[0][1]);
-    fprintf(output_file, "  C1 = %d (should be ERROR_VALUE)\n", sheet[0][2]);
-    fprintf(output_file, "  D1 = %d (should be ERROR_VALUE)\n", sheet[0][3]);
-    fprintf(output_file, "  E1 = %d (should be ERROR_VALUE)\n", sheet[0][4]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B1 = %d\n", CELL(0, 1));
+    fprintf(output_file, "  C1 = %d (should be ERROR_VALUE)\n", CELL(0, 2));
+    fprintf(output_file, "  D1 = %d (should be ERROR_VALUE)\n", CELL(0, 3));
+    fprintf(output_file, "  E1 = %d (should be ERROR_VALUE)\n", CELL(0, 4));
     
     // Fix the error source
     process_command_string("B1=2", output_file);
     
     // Print updated values
     fprintf(output_file, "Values after fixing B1:\n");
-    fprintf(output_file, "  A1 = %d\n", sheet[0][0]);
-    fprintf(output_file, "  B1 = %d\n", sheet[0][1]);
-    fprintf(output_file, "  C1 = %d\n", sheet[0][2]);
-    fprintf(output_file, "  D1 = %d\n", sheet[0][3]);
-    fprintf(output_file, "  E1 = %d\n", sheet[0][4]);
+    fprintf(output_file, "  A1 = %d\n", CELL(0, 0));
+    fprintf(output_file, "  B1 = %d\n", CELL(0, 1));
+    fprintf(output_file, "  C1 = %d\n", CELL(0, 2));
+    fprintf(output_file, "  D1 = %d\n", CELL(0, 3));
+    fprintf(output_file, "  E1 = %d\n", CELL(0, 4));
     
     // Test cycle detection
     fprintf(output_file, "Testing cycle detection:\n");
@@ -307,10 +328,385 @@ void test_error_propagation(FILE *output_file) {
     process_command_string("G1=F1", output_file);  // Creates a cycle
     
     fprintf(output_file, "Status after attempting to create cycle: %s\n", status);
-    fprintf(output_file, "F1 value: %d\n", sheet[0][5]);
-    fprintf(output_file, "G1 value: %d\n", sheet[0][6]);
+    fprintf(output_file, "F1 value: %d\n", CELL(0, 5));
+    fprintf(output_file, "G1 value: %d\n", CELL(0, 6));
     
     output_enabled = original_output_state;
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_ERROR_PROPAGATION is passed\n");
-} 
\ No newline at end of file
+} 
+/**
+ * Test a script run headless as one transaction
+ */
+void test_batch_mode(FILE *output_file) {
+    bool original_output_state = output_enabled;
+
+    fprintf(output_file, "Testing batch mode...\n");
+
+    // B60 and C60 are bound before A60 gets its final value, so they are
+    // only correct if the deferred recalculation reaches them
+    char script[] = "/tmp/spreadsheet_batchXXXXXX";
+    int fd = mkstemp(script);
+    FILE *file = fdopen(fd, "w");
+    fputs("A60=1\nB60=A60+1\nC60=(B60+A60)*2\nA60=5\nD60=SUM(A60:C60)\n"
+          "w\nE60=(bad\nq\nE60=7", file);
+    fclose(file);
+
+    FILE *out = tmpfile();
+    int code = run_batch(script, "A60:E60", out);
+    fprintf(output_file, "Exit status: %d (should be 0)\n", code);
+
+    rewind(out);
+    char line[64];
+    while (fgets(line, sizeof(line), out) != NULL) {
+        fprintf(output_file, "  %s", line);
+    }
+    fprintf(output_file, "(should be A60,5 B60,6 C60,22 D60,33 E60,0)\n");
+    fclose(out);
+
+    code = run_batch(script, "A60,ZZZZ1", stdout);
+    fprintf(output_file, "Exit status with an invalid cell list: %d (should be 1)\n", code);
+    remove(script);
+
+    output_enabled = original_output_state;
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_BATCH_MODE is passed\n");
+}
+
+/**
+ * Test saving and loading a binary snapshot
+ */
+void test_snapshot(FILE *output_file) {
+    bool original_output_state = output_enabled;
+
+    fprintf(output_file, "Testing snapshots...\n");
+
+    char path[] = "/tmp/spreadsheet_snapshotXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    process_command_string("A85=4", output_file);
+    process_command_string("B85=A85*3", output_file);
+    process_command_string("C85=SUM(A85:B85)", output_file);
+    process_command_string("D85=(A85+C85)*2-MAX(B85,1)", output_file);
+    process_command_string("E85=C85", output_file);
+
+    char command[64];
+    snprintf(command, sizeof(command), "save %s", path);
+    process_command_string(command, output_file);
+
+    // Change the sheet, then go back to the saved one
+    process_command_string("A85=100", output_file);
+    process_command_string("B85=7", output_file);
+    snprintf(command, sizeof(command), "load %s", path);
+    process_command_string(command, output_file);
+    fprintf(output_file, "After load: A85=%d B85=%d C85=%d D85=%d E85=%d (should be 4 12 16 28 16)\n",
+            CELL(84, 0), CELL(84, 1), CELL(84, 2), CELL(84, 3), CELL(84, 4));
+
+    // The loaded formulas are live
+    process_command_string("A85=1", output_file);
+    fprintf(output_file, "After A85=1: B85=%d C85=%d D85=%d E85=%d (should be 3 4 7 4)\n",
+            CELL(84, 1), CELL(84, 2), CELL(84, 3), CELL(84, 4));
+
+    int rows = 0, cols = 0;
+    snapshot_dimensions(path, &rows, &cols);
+    fprintf(output_file, "Saved dimensions: %dx%d (should be %dx%d)\n", rows, cols, MAXROW, MAXCOL);
+
+    // A file that is not a snapshot leaves the sheet alone
+    FILE *file = fopen(path, "w");
+    fputs("A1=5\n", file);
+    fclose(file);
+    process_command_string(command, output_file);
+    fprintf(output_file, "B85 after a bad load: %d (should be 3)\n", CELL(84, 1));
+    remove(path);
+
+    output_enabled = original_output_state;
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_SNAPSHOT is passed\n");
+}
+
+/**
+ * Test CSV import into the sheet
+ */
+void test_import(FILE *output_file) {
+    bool original_output_state = output_enabled;
+
+    fprintf(output_file, "Testing CSV import...\n");
+
+    char path[] = "/tmp/spreadsheet_importXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    FILE *file = fopen(path, "w");
+    fputs("1,2,3\r\n4, ,x\n\n-7,ERR\n", file);
+    fclose(file);
+
+    process_command_string("B91=5", output_file);
+    process_command_string("A91=B90*10", output_file);
+    process_command_string("C91=A90+1", output_file);
+    process_command_string("D90=SUM(A90:C91)", output_file);
+    process_command_string("E90=MEDIAN(A90:C90)", output_file);
+
+    char command[64];
+    snprintf(command, sizeof(command), "import %s A90", path);
+    process_command_string(command, output_file);
+    fprintf(output_file, "Row 90: %d %d %d (should be 1 2 3)\n",
+            CELL(89, 0), CELL(89, 1), CELL(89, 2));
+    fprintf(output_file, "Row 91: %d %d %d (should be 4 5 2)\n",
+            CELL(90, 0), CELL(90, 1), CELL(90, 2));
+    fprintf(output_file, "Row 93: %d %d (should be -7 %d)\n",
+            CELL(92, 0), CELL(92, 1), ERROR_VALUE);
+    fprintf(output_file, "D90=%d E90=%d (should be 17 2)\n", CELL(89, 3), CELL(89, 4));
+
+    // Imported cells are plain values: A91 no longer follows B90
+    process_command_string("B90=20", output_file);
+    fprintf(output_file, "After B90=20: A91=%d D90=%d E90=%d (should be 4 35 3)\n",
+            CELL(90, 0), CELL(89, 3), CELL(89, 4));
+
+    remove(path);
+    process_command_string(command, output_file);
+    fprintf(output_file, "Missing file leaves A90=%d (should be 1)\n", CELL(89, 0));
+
+    output_enabled = original_output_state;
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_IMPORT is passed\n");
+}
+
+/**
+ * Prints the lines of a file to the test output
+ */
+static void print_file(const char *path, FILE *output_file) {
+    FILE *file = fopen(path, "r");
+    char line[128];
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        fprintf(output_file, "  %s", line);
+    }
+    if (file != NULL) fclose(file);
+}
+
+/**
+ * Test CSV/TSV export of values and formulas
+ */
+void test_export(FILE *output_file) {
+    bool original_output_state = output_enabled;
+
+    fprintf(output_file, "Testing export...\n");
+
+    char path[] = "/tmp/spreadsheet_exportXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    process_command_string("A95=-2147483647", output_file);
+    process_command_string("B95=1/0", output_file);
+    process_command_string("C95=A96*10", output_file);
+    process_command_string("A96=42", output_file);
+    process_command_string("B96=MAX(A96,C95)+1", output_file);
+
+    char command[96];
+    snprintf(command, sizeof(command), "export %s A95:D96", path);
+    process_command_string(command, output_file);
+    print_file(path, output_file);
+    fprintf(output_file, "(should be -2147483647,ERR,420,0 and 42,421,0,0)\n");
+
+    snprintf(command, sizeof(command), "export_formulas %s A95:D96", path);
+    process_command_string(command, output_file);
+    print_file(path, output_file);
+    fprintf(output_file, "(should be -2147483647,ERR,=A96*10,0 and 42,\"=MAX(A96,C95)+1\",0,0)\n");
+    remove(path);
+
+    // A TSV export imports back the same values
+    char tsv[64];
+    snprintf(tsv, sizeof(tsv), "%s.tsv", path);
+    snprintf(command, sizeof(command), "export %s A95:C96", tsv);
+    process_command_string(command, output_file);
+    snprintf(command, sizeof(command), "import %s E95", tsv);
+    process_command_string(command, output_file);
+    fprintf(output_file, "Imported: %d %d %d / %d %d %d (should be -2147483647 %d 420 / 42 421 0)\n",
+            CELL(94, 4), CELL(94, 5), CELL(94, 6), CELL(95, 4), CELL(95, 5), CELL(95, 6), ERROR_VALUE);
+    remove(tsv);
+
+    process_command_string("export /nonexistent/dir/out.csv", output_file);
+
+    output_enabled = original_output_state;
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_EXPORT is passed\n");
+}
+
+/**
+ * Test the command journal: records survive a restart and a torn record
+ * at the end is dropped
+ */
+void test_journal(FILE *output_file) {
+    bool original_output_state = output_enabled;
+
+    fprintf(output_file, "Testing command journal...\n");
+
+    char path[] = "/tmp/spreadsheet_journalXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    bool opened = journal_open(path);
+    fprintf(output_file, "New journal opened: %d (should be 1)\n", opened);
+    const char *commands[] = { "A97=3", "B97=A97*4", "C97=SUM(A97:B97)", "A98=(C97+1)*2" };
+    for (int i = 0; i < 4; i++) {
+        process_command_string(commands[i], output_file);
+        journal_append(commands[i]);
+    }
+    journal_close();
+
+    // Forget the commands, then rebuild the cells from the journal
+    process_command_string("A97=0", output_file);
+    process_command_string("B97=0", output_file);
+    process_command_string("C97=0", output_file);
+    process_command_string("A98=0", output_file);
+    opened = journal_open(path);
+    fprintf(output_file, "After replay: A97=%d B97=%d C97=%d A98=%d (should be 3 12 15 32)\n",
+            CELL(96, 0), CELL(96, 1), CELL(96, 2), CELL(97, 0));
+    journal_append("A97=1");
+    journal_close();
+
+    // Cut the last record short, as a crash during the write would
+    FILE *file = fopen(path, "r+");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    truncate(path, size - 2);
+    opened = journal_open(path);
+    fprintf(output_file, "After a torn record: opened=%d A97=%d A98=%d (should be 1 3 32)\n",
+            opened, CELL(96, 0), CELL(97, 0));
+
+    // A record that is not a cell write ends the replay, with what follows it
+    journal_append("SLEEP(0)");
+    journal_append("A98=9");
+    journal_close();
+    opened = journal_open(path);
+    fprintf(output_file, "After a foreign record: opened=%d A98=%d (should be 1 32)\n",
+            opened, CELL(97, 0));
+
+    // An import is replayed only while its file is unchanged
+    char csv[] = "/tmp/spreadsheet_journal_csvXXXXXX";
+    fd = mkstemp(csv);
+    close(fd);
+    file = fopen(csv, "w");
+    fputs("4,5\n", file);
+    fclose(file);
+    char import[MAX_INPUT_LEN];
+    snprintf(import, sizeof(import), "import %s D98", csv);
+    process_command_string(import, output_file);
+    journal_append_file(import, csv);
+    journal_close();
+    process_command_string("D98=0", output_file);
+    opened = journal_open(path);
+    fprintf(output_file, "After replaying an import: opened=%d D98=%d E98=%d (should be 1 4 5)\n",
+            opened, CELL(97, 3), CELL(97, 4));
+    journal_close();
+    file = fopen(csv, "w");
+    fputs("7,5\n", file);
+    fclose(file);
+    process_command_string("D98=0", output_file);
+    opened = journal_open(path);
+    fprintf(output_file, "After the imported file changed: opened=%d D98=%d (should be 0 0)\n",
+            opened, CELL(97, 3));
+    remove(csv);
+
+    // A file that is not a journal is refused
+    file = fopen(path, "w");
+    fputs("A97=5\n", file);
+    fclose(file);
+    fprintf(output_file, "Text file opened as journal: %d (should be 0)\n", journal_open(path));
+    remove(path);
+
+    output_enabled = original_output_state;
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_JOURNAL is passed\n");
+}
+
+/**
+ * Test the backing file: cells and tables are stored in the file, and the
+ * file is emptied when the grid is freed
+ */
+void test_backing(FILE *output_file) {
+    fprintf(output_file, "Testing backing file...\n");
+
+    char path[] = "/tmp/spreadsheet_backingXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    // Swap in a backed grid of the same size for the duration of the test
+    int **original_sheet = sheet;
+    sheet = NULL;
+    sheet_backing = path;
+    sheet_backing_index = true;
+
+    int allocated = sheet_alloc();
+    fprintf(output_file, "Backed grid allocated: %d (should be 1)\n", allocated);
+    fprintf(output_file, "Backed grid starts empty: %d (should be 0)\n", CELL(MAXROW - 1, MAXCOL - 1));
+
+    CELL(42, 7) = 1234;
+    int stored = 0;
+    fd = open(path, O_RDONLY);
+    pread(fd, &stored, sizeof(stored), (off_t)((&CELL(42, 7) - sheet[0]) * sizeof(int)));
+    close(fd);
+    fprintf(output_file, "Cell read back from the file: %d (should be 1234)\n", stored);
+
+    int *table = (int *)table_alloc(TABLE_VISITS, sizeof(int));
+    fprintf(output_file, "Table in the file starts empty: %d (should be 0)\n",
+            table != NULL ? table[MAXROW * MAXCOL - 1] : -1);
+    table[0] = 5;
+    table_free(TABLE_VISITS, table, sizeof(int));
+    table = (int *)table_alloc(TABLE_VISITS, sizeof(int));
+    fprintf(output_file, "Released table is empty again: %d (should be 0)\n", table[0]);
+    table_free(TABLE_VISITS, table, sizeof(int));
+
+    sheet_advise(0, 0, MAXROW - 1, MAXCOL - 1);
+    sheet_free();
+    struct stat st;
+    stat(path, &st);
+    fprintf(output_file, "File size after free: %lld (should be 0)\n", (long long)st.st_size);
+    remove(path);
+
+    sheet_backing = NULL;
+    sheet_backing_index = false;
+    sheet = original_sheet;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_BACKING is passed\n");
+}
+
+/**
+ * Test background saves: the snapshot holds the sheet as it was when the
+ * save started, even if the sheet changes while the child writes it
+ */
+void test_bgsave(FILE *output_file) {
+    bool original_output_state = output_enabled;
+
+    fprintf(output_file, "Testing background save...\n");
+
+    char path[] = "/tmp/spreadsheet_bgsaveXXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    process_command_string("A99=6", output_file);
+    process_command_string("B99=A99*7", output_file);
+    fprintf(output_file, "Started: %d (should be 1)\n", snapshot_bgsave(path));
+    process_command_string("A99=1", output_file);
+    fprintf(output_file, "Parent after the edit: B99=%d (should be 7)\n", CELL(98, 1));
+
+    BgsaveState state = snapshot_bgsave_poll(true);
+    fprintf(output_file, "Save finished: %d (should be 1)\n", state == BGSAVE_DONE);
+    fprintf(output_file, "Polled again: %d (should be 1)\n", snapshot_bgsave_poll(false) == BGSAVE_DONE);
+
+    snapshot_load(path);
+    fprintf(output_file, "Loaded: A99=%d B99=%d (should be 6 42)\n", CELL(98, 0), CELL(98, 1));
+    process_command_string("A99=2", output_file);
+    fprintf(output_file, "Formula kept: B99=%d (should be 14)\n", CELL(98, 1));
+
+    // A directory that does not exist cannot hold the snapshot
+    snapshot_bgsave("/nonexistent/spreadsheet.snap");
+    state = snapshot_bgsave_poll(true);
+    fprintf(output_file, "Save to a missing directory failed: %d (should be 1)\n", state == BGSAVE_FAILED);
+    remove(path);
+
+    output_enabled = original_output_state;
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_BGSAVE is passed\n");
+}
@@ -7,14 +7,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include "../clab/init.h"
 #include "../clab/io.h"
+#include "../clab/formula.h"
 
 // Test function prototypes
 void test_input_parser(FILE *output_file);
 void test_cell_validation(FILE *output_file);
 void test_range_validation(FILE *output_file);
 void test_cell_to_rc(FILE *output_file);
+void test_function_arguments(FILE *output_file);
+void test_input_lines(FILE *output_file);
+void test_partial_formulas(FILE *output_file);
 
 /**
  * Run all IO tests
@@ -28,6 +33,9 @@ void run_io_tests(FILE *output_file) {
     test_cell_validation(output_file);
     test_range_validation(output_file);
     test_cell_to_rc(output_file);
+    test_function_arguments(output_file);
+    test_input_lines(output_file);
+    test_partial_formulas(output_file);
     
     // Print completion message to both stdout and output file
     fprintf(output_file, "All IO tests are passed.\n");
@@ -48,8 +56,11 @@ void test_input_parser(FILE *output_file) {
         "D4=SUM(A1:B2)",          // Range function
         "E5=MIN(A1:C3)",          // Another range function
         "F6=SLEEP(5)",            // Sleep function
+        "G7=(A1+B2)*2",           // Compiled expression
         "scroll_to A1",           // Scroll command
         "w",                      // Scroll direction
+        "viewport 20 30",         // Viewport size
+        "save sheet.snap",        // File command
         "disable_output",         // Control command
         "q",                      // Quit command
         "invalid command"         // Invalid command
@@ -95,6 +106,19 @@ void test_input_parser(FILE *output_file) {
             case CMD_INVALID:
                 fprintf(output_file, "  Invalid Command\n");
                 break;
+            case CMD_VIEWPORT:
+                fprintf(output_file, "  Viewport: %d rows, %d columns\n",
+                        result.op1.row, result.op1.col);
+                break;
+            case CMD_FILE:
+                fprintf(output_file, "  File Command: %s, Path: %s\n",
+                        result.control_cmd, result.expression);
+                break;
+            case CMD_EXPRESSION:
+                fprintf(output_file, "  Cell: %s, Compiled Expression: %s\n",
+                        result.cell, result.expression);
+                formula_free(result.program);
+                break;
         }
         fprintf(output_file, "\n");
     }
@@ -187,4 +211,115 @@ void test_cell_to_rc(FILE *output_file) {
     }
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_CELL_TO_RC is passed\n");
-} 
\ No newline at end of file
+} 
+
+/**
+ * Test parsing of functions that take an argument after the range
+ */
+void test_function_arguments(FILE *output_file) {
+    fprintf(output_file, "Testing function arguments...\n");
+
+    const char *test_inputs[] = {
+        "B1=PERCENTILE(A1:A9,75)",  // Percentile
+        "B2=RANK(A1:A9,-3)",        // Rank of a negative value
+        "B3=COUNTIF(A1:A9,>=100)",  // Condition with operator
+        "B4=SUMIF(A1:A9,<>0)",      // Not-equal condition
+        "B5=COUNTIF(A1:A9,7)",      // Bare value means equality
+        "B6=MEDIAN(A1:A9)",         // No argument
+        "B7=PERCENTILE(A1:A9)",     // Missing argument
+        "B8=SUMIF(A1:A9,>x)"        // Non-numeric condition
+    };
+
+    int num_tests = sizeof(test_inputs) / sizeof(test_inputs[0]);
+
+    for (int i = 0; i < num_tests; i++) {
+        ParsedCommand result;
+        char input[MAX_INPUT_LEN];
+        strcpy(input, test_inputs[i]);
+
+        input_parser(input, &result);
+
+        fprintf(output_file, "Input: \"%s\"\n", test_inputs[i]);
+        if (result.type == CMD_FUNCTION) {
+            fprintf(output_file, "  Function: %d, Range: %s, Argument: %d, Predicate: %d\n",
+                    result.func, result.range, result.func_arg, result.predicate);
+        } else {
+            fprintf(output_file, "  Invalid Command\n");
+        }
+    }
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_FUNCTION_ARGUMENTS is passed\n");
+}
+
+/**
+ * Test the buffered line reader on a redirected stdin
+ */
+void test_input_lines(FILE *output_file) {
+    fprintf(output_file, "Testing input lines...\n");
+
+    // Three lines: a short one, an over-long one, and one without a newline
+    FILE *file = tmpfile();
+    fputs("A1=5\nB1=", file);
+    for (int i = 0; i < 300; i++) fputc('9', file);
+    fputs("\nC1=7", file);
+    rewind(file);
+
+    int saved_stdin = dup(STDIN_FILENO);
+    dup2(fileno(file), STDIN_FILENO);
+
+    char *line = input_next_line();
+    fprintf(output_file, "Line 1: \"%s\" (should be \"A1=5\")\n", line ? line : "(none)");
+    line = input_next_line();
+    fprintf(output_file, "Line 2 length: %d (should be %d)\n", line ? (int)strlen(line) : -1, MAX_INPUT_LEN - 1);
+    line = input_next_line();
+    fprintf(output_file, "Line 3: \"%s\" (should be \"C1=7\")\n", line ? line : "(none)");
+    line = input_next_line();
+    fprintf(output_file, "End of input: %s (should be Yes)\n", line == NULL ? "Yes" : "No");
+
+    dup2(saved_stdin, STDIN_FILENO);
+    close(saved_stdin);
+    fclose(file);
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_INPUT_LINES is passed\n");
+}
+
+/**
+ * Test formulas beyond the simple forms: text after a simple formula is
+ * not silently dropped, and lists of values are compiled
+ */
+void test_partial_formulas(FILE *output_file) {
+    fprintf(output_file, "Testing partial formulas...\n");
+
+    const struct {
+        const char *input;
+        int invalid;
+    } test_cases[] = {
+        {"C1=MEDIAN(A1:A3)+1", 1},  // Range function followed by an operator
+        {"C1=RANK(A1:A3,5)*10", 1}, // Function with an argument, then an operator
+        {"C1=SLEEP(1)+1", 1},       // SLEEP inside an expression
+        {"C1=SUM(A1:A3)junk", 1},   // Trailing garbage
+        {"C1=1+MEDIAN(A1:A3)", 1},  // Indexed range function after an operator
+        {"C1=(COUNTIF(A1:A3,>1))", 1},  // ... in parentheses
+        {"C1=MAX(SUMIF(A1:A3,>1),2)", 1},  // ... as a function argument
+        {"C1=MAX(A1,A2,3)", 0},     // List of values
+        {"C1=AVG(A1,A2)", 0},       // List of cells
+        {"C1=MAX(A1+1,A2)", 0}      // List of expressions
+    };
+
+    int num_tests = sizeof(test_cases) / sizeof(test_cases[0]);
+
+    for (int i = 0; i < num_tests; i++) {
+        ParsedCommand result;
+        char input[MAX_INPUT_LEN];
+        strcpy(input, test_cases[i].input);
+
+        input_parser(input, &result);
+
+        fprintf(output_file, "Input: \"%s\" invalid: %d (should be %d)\n",
+                test_cases[i].input, result.type == CMD_INVALID, test_cases[i].invalid);
+        if (result.type == CMD_EXPRESSION) formula_free(result.program);
+    }
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_PARTIAL_FORMULAS is passed\n");
+}
@@ -11,6 +11,12 @@
 #include "../clab/init.h"
 #include "../clab/io.h"
 #include "../clab/process.h"
+#include "../clab/pool.h"
+#include "../clab/timer.h"
+#include "../clab/dependent.h"
+#include "../clab/range.h"
+#include "../clab/formula.h"
+#include <time.h>
 
 // Global sheet declaration
 extern int** sheet;
@@ -21,6 +27,18 @@ void test_assign(FILE *output_file);
 void test_arithmetic(FILE *output_file);
 void test_function(FILE *output_file);
 void test_error_handling(FILE *output_file);
+void test_parallel_reduction(FILE *output_file);
+void test_order_statistics(FILE *output_file);
+void test_conditional_aggregates(FILE *output_file);
+void test_async_sleep(FILE *output_file);
+void test_sleep_wave(FILE *output_file);
+void test_expressions(FILE *output_file);
+void test_formula_binding(FILE *output_file);
+void test_bare_sleep(FILE *output_file);
+void test_virtual_sleep(FILE *output_file);
+void test_wrapping_arithmetic(FILE *output_file);
+void test_constant_calls(FILE *output_file);
+void test_range_expressions(FILE *output_file);
 
 // External function declarations
 void update_dependents(int row, int col);
@@ -46,56 +64,59 @@ void create_test_command(ParsedCommand *cmd, CommandType type, int r1, int c1, i
     // Generate cell reference for op1
     if (r1 > 0 && c1 > 0) {
         char col_letter = (c1 <= 26) ? ('A' + c1 - 1) : ('A' + (c1 / 26) - 1);
-        sprintf(cmd->cell, "%c%d", col_letter, r1);
+        if (snprintf(cmd->cell, sizeof(cmd->cell), "%c%d", col_letter, r1) >= (int)sizeof(cmd->cell)) {
+            cmd->cell[0] = '\0';  // Row too long for a cell name
+        }
     }
     
     // Generate expression based on command type
     if (type == CMD_SET_CELL) {
         if (r2 > 0 && c2 > 0) {
             char col_letter = (c2 <= 26) ? ('A' + c2 - 1) : ('A' + (c2 / 26) - 1);
-            sprintf(cmd->expression, "%c%d", col_letter, r2);
+            snprintf(cmd->expression, sizeof(cmd->expression), "%c%d", col_letter, r2);
         } else {
-            sprintf(cmd->expression, "%d", val2);
+            snprintf(cmd->expression, sizeof(cmd->expression), "%d", val2);
         }
     } else if (type == CMD_ARITHMETIC) {
-        char op1[10], op2[10];
+        char op1[16], op2[16];
         
         if (r2 > 0 && c2 > 0) {
             char col_letter = (c2 <= 26) ? ('A' + c2 - 1) : ('A' + (c2 / 26) - 1);
-            sprintf(op1, "%c%d", col_letter, r2);
+            snprintf(op1, sizeof(op1), "%c%d", col_letter, r2);
         } else {
-            sprintf(op1, "%d", val2);
+            snprintf(op1, sizeof(op1), "%d", val2);
         }
         
         if (r3 > 0 && c3 > 0) {
             char col_letter = (c3 <= 26) ? ('A' + c3 - 1) : ('A' + (c3 / 26) - 1);
-            sprintf(op2, "%c%d", col_letter, r3);
+            snprintf(op2, sizeof(op2), "%c%d", col_letter, r3);
         } else {
-            sprintf(op2, "%d", val3);
+            snprintf(op2, sizeof(op2), "%d", val3);
         }
         
-        sprintf(cmd->expression, "%s%c%s", op1, op, op2);
+        snprintf(cmd->expression, sizeof(cmd->expression), "%s%c%s", op1, op, op2);
     } else if (type == CMD_FUNCTION) {
-        const char *func_names[] = {"", "MIN", "MAX", "SUM", "AVG", "STDEV", "SLEEP"};
+        const char *func_names[] = {"", "MIN", "MAX", "SUM", "AVG", "STDEV", "SLEEP",
+                                    "MEDIAN", "PERCENTILE", "RANK", "COUNTIF", "SUMIF"};
         
         if (func == FUNC_SLEEP) {
             if (r2 > 0 && c2 > 0) {
                 char col_letter = (c2 <= 26) ? ('A' + c2 - 1) : ('A' + (c2 / 26) - 1);
-                sprintf(cmd->expression, "%s(%c%d)", func_names[func], col_letter, r2);
+                snprintf(cmd->expression, sizeof(cmd->expression), "%s(%c%d)", func_names[func], col_letter, r2);
             } else {
-                sprintf(cmd->expression, "%s(%d)", func_names[func], val2);
+                snprintf(cmd->expression, sizeof(cmd->expression), "%s(%d)", func_names[func], val2);
             }
         } else {
             char start_cell[10], end_cell[10];
             
             char start_col_letter = (c2 <= 26) ? ('A' + c2 - 1) : ('A' + (c2 / 26) - 1);
-            sprintf(start_cell, "%c%d", start_col_letter, r2);
+            snprintf(start_cell, sizeof(start_cell), "%c%d", start_col_letter, r2);
             
             char end_col_letter = (c3 <= 26) ? ('A' + c3 - 1) : ('A' + (c3 / 26) - 1);
-            sprintf(end_cell, "%c%d", end_col_letter, r3);
+            snprintf(end_cell, sizeof(end_cell), "%c%d", end_col_letter, r3);
             
-            sprintf(cmd->expression, "%s(%s:%s)", func_names[func], start_cell, end_cell);
-            sprintf(cmd->range, "%s:%s", start_cell, end_cell);
+            snprintf(cmd->expression, sizeof(cmd->expression), "%s(%s:%s)", func_names[func], start_cell, end_cell);
+            snprintf(cmd->range, sizeof(cmd->range), "%s:%s", start_cell, end_cell);
         }
     }
 }
@@ -112,6 +133,18 @@ void run_process_tests(FILE *output_file) {
     test_arithmetic(output_file);
     test_function(output_file);
     test_error_handling(output_file);
+    test_parallel_reduction(output_file);
+    test_order_statistics(output_file);
+    test_conditional_aggregates(output_file);
+    test_async_sleep(output_file);
+    test_sleep_wave(output_file);
+    test_expressions(output_file);
+    test_formula_binding(output_file);
+    test_bare_sleep(output_file);
+    test_virtual_sleep(output_file);
+    test_wrapping_arithmetic(output_file);
+    test_constant_calls(output_file);
+    test_range_expressions(output_file);
     
     // Print completion message to both stdout and output file
     fprintf(output_file, "All process tests are passed.\n");
@@ -127,7 +160,7 @@ void test_assign(FILE *output_file) {
     // Reset sheet values
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
         }
     }
     
@@ -137,7 +170,7 @@ void test_assign(FILE *output_file) {
     
     fprintf(output_file, "Assigning value 42 to A1\n");
     assign(&cmd1);
-    fprintf(output_file, "A1 value: %d\n", sheet[0][0]);
+    fprintf(output_file, "A1 value: %d\n", CELL(0, 0));
     
     // Test cell reference assignment
     ParsedCommand cmd2;
@@ -145,7 +178,7 @@ void test_assign(FILE *output_file) {
     
     fprintf(output_file, "Assigning A1 to B2\n");
     assign(&cmd2);
-    fprintf(output_file, "B2 value: %d\n", sheet[1][1]);
+    fprintf(output_file, "B2 value: %d\n", CELL(1, 1));
     
     // Test changing source cell affects dependent cell
     ParsedCommand cmd3;
@@ -153,11 +186,11 @@ void test_assign(FILE *output_file) {
     
     fprintf(output_file, "Changing A1 to 100\n");
     assign(&cmd3);
-    fprintf(output_file, "A1 value: %d\n", sheet[0][0]);
+    fprintf(output_file, "A1 value: %d\n", CELL(0, 0));
     
     // We need to manually update dependents since we're calling assign directly
     update_dependents(0, 0);
-    fprintf(output_file, "B2 value after update: %d\n", sheet[1][1]);
+    fprintf(output_file, "B2 value after update: %d\n", CELL(1, 1));
     
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_ASSIGN is passed\n");
@@ -172,13 +205,13 @@ void test_arithmetic(FILE *output_file) {
     // Reset sheet values
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
         }
     }
     
     // Set up initial values
-    sheet[0][0] = 10;  // A1 = 10
-    sheet[1][1] = 5;   // B2 = 5
+    CELL(0, 0) = 10;  // A1 = 10
+    CELL(1, 1) = 5;   // B2 = 5
     
     // Test addition
     ParsedCommand cmd1;
@@ -186,7 +219,7 @@ void test_arithmetic(FILE *output_file) {
     
     fprintf(output_file, "C3 = A1 + B2 (10 + 5)\n");
     arithmetic(&cmd1);
-    fprintf(output_file, "C3 value: %d\n", sheet[2][2]);
+    fprintf(output_file, "C3 value: %d\n", CELL(2, 2));
     
     // Test subtraction
     ParsedCommand cmd2;
@@ -194,7 +227,7 @@ void test_arithmetic(FILE *output_file) {
     
     fprintf(output_file, "D4 = A1 - B2 (10 - 5)\n");
     arithmetic(&cmd2);
-    fprintf(output_file, "D4 value: %d\n", sheet[3][3]);
+    fprintf(output_file, "D4 value: %d\n", CELL(3, 3));
     
     // Test multiplication
     ParsedCommand cmd3;
@@ -202,7 +235,7 @@ void test_arithmetic(FILE *output_file) {
     
     fprintf(output_file, "E5 = A1 * B2 (10 * 5)\n");
     arithmetic(&cmd3);
-    fprintf(output_file, "E5 value: %d\n", sheet[4][4]);
+    fprintf(output_file, "E5 value: %d\n", CELL(4, 4));
     
     // Test division
     ParsedCommand cmd4;
@@ -210,7 +243,7 @@ void test_arithmetic(FILE *output_file) {
     
     fprintf(output_file, "F6 = A1 / B2 (10 / 5)\n");
     arithmetic(&cmd4);
-    fprintf(output_file, "F6 value: %d\n", sheet[5][5]);
+    fprintf(output_file, "F6 value: %d\n", CELL(5, 5));
     
     // Test with direct values
     ParsedCommand cmd5;
@@ -218,7 +251,7 @@ void test_arithmetic(FILE *output_file) {
     
     fprintf(output_file, "G7 = 20 + 3\n");
     arithmetic(&cmd5);
-    fprintf(output_file, "G7 value: %d\n", sheet[6][6]);
+    fprintf(output_file, "G7 value: %d\n", CELL(6, 6));
     
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_ARITHMETIC is passed\n");
@@ -233,15 +266,15 @@ void test_function(FILE *output_file) {
     // Reset sheet values
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
         }
     }
     
     // Set up test data
-    sheet[0][0] = 10;  // A1 = 10
-    sheet[0][1] = 20;  // B1 = 20
-    sheet[1][0] = 30;  // A2 = 30
-    sheet[1][1] = 40;  // B2 = 40
+    CELL(0, 0) = 10;  // A1 = 10
+    CELL(0, 1) = 20;  // B1 = 20
+    CELL(1, 0) = 30;  // A2 = 30
+    CELL(1, 1) = 40;  // B2 = 40
     
     // Test SUM function
     ParsedCommand cmd1;
@@ -249,7 +282,7 @@ void test_function(FILE *output_file) {
     
     fprintf(output_file, "C3 = SUM(A1:B2) (10+20+30+40)\n");
     function(&cmd1);
-    fprintf(output_file, "C3 value: %d\n", sheet[2][2]);
+    fprintf(output_file, "C3 value: %d\n", CELL(2, 2));
     
     // Test MIN function
     ParsedCommand cmd2;
@@ -257,7 +290,7 @@ void test_function(FILE *output_file) {
     
     fprintf(output_file, "D4 = MIN(A1:B2) (10)\n");
     function(&cmd2);
-    fprintf(output_file, "D4 value: %d\n", sheet[3][3]);
+    fprintf(output_file, "D4 value: %d\n", CELL(3, 3));
     
     // Test MAX function
     ParsedCommand cmd3;
@@ -265,7 +298,7 @@ void test_function(FILE *output_file) {
     
     fprintf(output_file, "E5 = MAX(A1:B2) (40)\n");
     function(&cmd3);
-    fprintf(output_file, "E5 value: %d\n", sheet[4][4]);
+    fprintf(output_file, "E5 value: %d\n", CELL(4, 4));
     
     // Test AVG function
     ParsedCommand cmd4;
@@ -273,7 +306,7 @@ void test_function(FILE *output_file) {
     
     fprintf(output_file, "F6 = AVG(A1:B2) (25)\n");
     function(&cmd4);
-    fprintf(output_file, "F6 value: %d\n", sheet[5][5]);
+    fprintf(output_file, "F6 value: %d\n", CELL(5, 5));
     
     // Test STDEV function
     ParsedCommand cmd5;
@@ -281,15 +314,17 @@ void test_function(FILE *output_file) {
     
     fprintf(output_file, "G7 = STDEV(A1:B2)\n");
     function(&cmd5);
-    fprintf(output_file, "G7 value: %d\n", sheet[6][6]);
+    fprintf(output_file, "G7 value: %d\n", CELL(6, 6));
     
     // Test SLEEP function (with minimal sleep time for testing)
     ParsedCommand cmd6;
     create_test_command(&cmd6, CMD_FUNCTION, 8, 8, 0, 0, 1, 0, 0, 0, 0, FUNC_SLEEP);
     
     fprintf(output_file, "H8 = SLEEP(1)\n");
+    long long before = timer_now();
     function(&cmd6);
-    fprintf(output_file, "H8 value: %d\n", sheet[7][7]);
+    fprintf(output_file, "H8 value: %d\n", CELL(7, 7));
+    fprintf(output_file, "Clock advanced by SLEEP(1): %lld ms (should be 1000)\n", timer_now() - before);
     
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_FUNCTION is passed\n");
@@ -304,20 +339,20 @@ void test_error_handling(FILE *output_file) {
     // Reset sheet values
     for (int i = 0; i < MAXROW; i++) {
         for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
+            CELL(i, j) = 0;
         }
     }
     
     // Test division by zero
-    sheet[0][0] = 10;  // A1 = 10
-    sheet[1][1] = 0;   // B2 = 0
+    CELL(0, 0) = 10;  // A1 = 10
+    CELL(1, 1) = 0;   // B2 = 0
     
     ParsedCommand cmd1;
     create_test_command(&cmd1, CMD_ARITHMETIC, 3, 3, 1, 1, 0, 2, 2, 0, '/', FUNC_NONE);
     
     fprintf(output_file, "C3 = A1 / B2 (10 / 0)\n");
     arithmetic(&cmd1);
-    fprintf(output_file, "C3 value: %d (should be ERROR_VALUE)\n", sheet[2][2]);
+    fprintf(output_file, "C3 value: %d (should be ERROR_VALUE)\n", CELL(2, 2));
     
     // Test error propagation
     ParsedCommand cmd2;
@@ -325,7 +360,7 @@ void test_error_handling(FILE *output_file) {
     
     fprintf(output_file, "D4 = C3 (ERROR_VALUE)\n");
     assign(&cmd2);
-    fprintf(output_file, "D4 value: %d (should be ERROR_VALUE)\n", sheet[3][3]);
+    fprintf(output_file, "D4 value: %d (should be ERROR_VALUE)\n", CELL(3, 3));
     
     // Test invalid range for function
     ParsedCommand cmd3;
@@ -337,9 +372,538 @@ void test_error_handling(FILE *output_file) {
         fprintf(output_file, "Range validation correctly failed\n");
     } else {
         function(&cmd3);
-        fprintf(output_file, "E5 value: %d, Status: %s\n", sheet[4][4], status);
+        fprintf(output_file, "E5 value: %d, Status: %s\n", CELL(4, 4), status);
     }
     
     fprintf(output_file, "\n");
     fprintf(output_file, "TEST_ERROR_HANDLING is passed\n");
-} 
\ No newline at end of file
+} 
+
+/**
+ * Test that ranges reduced on the thread pool match the serial results
+ */
+void test_parallel_reduction(FILE *output_file) {
+    fprintf(output_file, "Testing parallel range reduction...\n");
+
+    // Fill the sheet with deterministic mixed-sign values
+    for (int i = 0; i < MAXROW; i++) {
+        for (int j = 0; j < MAXCOL; j++) {
+            CELL(i, j) = ((i * 131 + j * 71) % 2001) - 1000;
+        }
+    }
+
+    // Tall, wide, single-row and single-cell rectangles
+    int rects[5][4] = {{0, 0, 99, 99}, {3, 5, 97, 41}, {10, 0, 12, 99}, {0, 7, 0, 88}, {4, 4, 4, 4}};
+    int funcs[5] = {FUNC_MIN, FUNC_MAX, FUNC_SUM, FUNC_AVG, FUNC_STDEV};
+    int serial[5][5];
+
+    for (int r = 0; r < 5; r++) {
+        for (int f = 0; f < 5; f++) {
+            serial[r][f] = range_aggregate(funcs[f], rects[r][0], rects[r][1], rects[r][2], rects[r][3]);
+        }
+    }
+
+    // Force every range through the pool
+    long saved_min = parallel_min_cells;
+    parallel_min_cells = 1;
+    pool_init(4);
+
+    int mismatches = 0;
+    for (int r = 0; r < 5; r++) {
+        for (int f = 0; f < 5; f++) {
+            int value = range_aggregate(funcs[f], rects[r][0], rects[r][1], rects[r][2], rects[r][3]);
+            if (value != serial[r][f]) mismatches++;
+        }
+    }
+    fprintf(output_file, "SUM(A1:CV100) on %d threads: %d (serial %d)\n",
+            pool_threads, range_aggregate(FUNC_SUM, 0, 0, 99, 99), serial[0][2]);
+    fprintf(output_file, "Mismatches against serial results: %d (should be 0)\n", mismatches);
+
+    // STDEV of values far apart sums its squared deviations the same way
+    CELL(20, 0) = 2000000000;
+    CELL(20, 1) = -2000000000;
+    CELL(20, 2) = 2000000000;
+    fprintf(output_file, "STDEV(A21:C21) on %d threads: %d (should be 1885618083)\n",
+            pool_threads, range_aggregate(FUNC_STDEV, 20, 0, 20, 2));
+
+    // An error anywhere in the range makes the result ERROR_VALUE
+    CELL(77, 63) = ERROR_VALUE;
+    fprintf(output_file, "SUM with an error cell: %d (should be ERROR_VALUE)\n",
+            range_aggregate(FUNC_SUM, 0, 0, 99, 99));
+    CELL(77, 63) = 0;
+
+    pool_shutdown();
+    parallel_min_cells = saved_min;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_PARALLEL_REDUCTION is passed\n");
+}
+
+/**
+ * Test MEDIAN, PERCENTILE and RANK and the incremental index behind them
+ */
+void test_order_statistics(FILE *output_file) {
+    fprintf(output_file, "Testing order-statistic functions...\n");
+
+    // Reset sheet values
+    for (int i = 0; i < MAXROW; i++) {
+        for (int j = 0; j < MAXCOL; j++) {
+            CELL(i, j) = 0;
+        }
+    }
+
+    // A1..A6 = 7, 3, 9, 3, 12, 1 (sorted: 1 3 3 7 9 12)
+    int values[6] = {7, 3, 9, 3, 12, 1};
+    for (int i = 0; i < 6; i++) {
+        set_cell(i, 0, values[i]);
+    }
+
+    ParsedCommand median, percentile, rank;
+    create_test_command(&median, CMD_FUNCTION, 1, 2, 1, 1, 0, 6, 1, 0, 0, FUNC_MEDIAN);
+    create_test_command(&percentile, CMD_FUNCTION, 2, 2, 1, 1, 0, 6, 1, 0, 0, FUNC_PERCENTILE);
+    percentile.func_arg = 90;
+    create_test_command(&rank, CMD_FUNCTION, 3, 2, 1, 1, 0, 6, 1, 0, 0, FUNC_RANK);
+    rank.func_arg = 3;
+
+    function(&median);
+    function(&percentile);
+    function(&rank);
+    fprintf(output_file, "B1 = MEDIAN(A1:A6): %d (should be 5)\n", CELL(0, 1));
+    fprintf(output_file, "B2 = PERCENTILE(A1:A6,90): %d (should be 10)\n", CELL(1, 1));
+    fprintf(output_file, "B3 = RANK(A1:A6,3): %d (should be 4)\n", CELL(2, 1));
+
+    // Writes patch the index; dependents read the new order statistics
+    set_cell(5, 0, 20);     // A6 = 20 (sorted: 3 3 7 9 12 20)
+    update_dependents(5, 0);
+    fprintf(output_file, "After A6 = 20: MEDIAN %d (should be 8), PERCENTILE %d (should be 16), RANK %d (should be 5)\n",
+            CELL(0, 1), CELL(1, 1), CELL(2, 1));
+
+    set_cell(1, 0, 4);      // A2 = 4, one 3 left
+    set_cell(3, 0, 4);      // A4 = 4, no 3 left
+    update_dependents(1, 0);
+    update_dependents(3, 0);
+    fprintf(output_file, "RANK of a value no longer in range: %d (should be ERROR_VALUE)\n", CELL(2, 1));
+
+    set_cell(2, 0, ERROR_VALUE);
+    update_dependents(2, 0);
+    fprintf(output_file, "MEDIAN with an error cell: %d (should be ERROR_VALUE)\n", CELL(0, 1));
+
+    set_cell(2, 0, 9);
+    update_dependents(2, 0);
+    fprintf(output_file, "MEDIAN after the error is cleared: %d (should be 8)\n", CELL(0, 1));
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_ORDER_STATISTICS is passed\n");
+}
+
+/**
+ * Test COUNTIF and SUMIF over a two-column range
+ */
+void test_conditional_aggregates(FILE *output_file) {
+    fprintf(output_file, "Testing conditional aggregates...\n");
+
+    // Reset sheet values
+    for (int i = 0; i < MAXROW; i++) {
+        for (int j = 0; j < MAXCOL; j++) {
+            CELL(i, j) = 0;
+        }
+    }
+
+    // A11..B14 = 5 150 / 100 -20 / 250 5 / 0 99
+    int values[4][2] = {{5, 150}, {100, -20}, {250, 5}, {0, 99}};
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 2; j++) {
+            set_cell(10 + i, j, values[i][j]);
+        }
+    }
+
+    ParsedCommand count, sum, equal;
+    create_test_command(&count, CMD_FUNCTION, 11, 4, 11, 1, 0, 14, 2, 0, 0, FUNC_COUNTIF);
+    count.predicate = PRED_GT;
+    count.func_arg = 99;
+    create_test_command(&sum, CMD_FUNCTION, 12, 4, 11, 1, 0, 14, 2, 0, 0, FUNC_SUMIF);
+    sum.predicate = PRED_LE;
+    sum.func_arg = 5;
+    create_test_command(&equal, CMD_FUNCTION, 13, 4, 11, 1, 0, 14, 2, 0, 0, FUNC_COUNTIF);
+    equal.predicate = PRED_EQ;
+    equal.func_arg = 5;
+
+    function(&count);
+    function(&sum);
+    function(&equal);
+    fprintf(output_file, "D11 = COUNTIF(A11:B14,>99): %d (should be 3)\n", CELL(10, 3));
+    fprintf(output_file, "D12 = SUMIF(A11:B14,<=5): %d (should be -10)\n", CELL(11, 3));
+    fprintf(output_file, "D13 = COUNTIF(A11:B14,5): %d (should be 2)\n", CELL(12, 3));
+
+    // Writes are reflected through the index
+    set_cell(13, 1, 500);   // B14 = 500
+    update_dependents(13, 1);
+    set_cell(10, 0, -7);    // A11 = -7
+    update_dependents(10, 0);
+    fprintf(output_file, "After B14 = 500, A11 = -7: COUNTIF %d (should be 4), SUMIF %d (should be -22), COUNTIF= %d (should be 1)\n",
+            CELL(10, 3), CELL(11, 3), CELL(12, 3));
+
+    // An error cell matches no condition
+    set_cell(11, 0, ERROR_VALUE);   // A12 = ERR (was 100)
+    update_dependents(11, 0);
+    fprintf(output_file, "After A12 = ERR: COUNTIF %d (should be 3), SUMIF %d (should be -22), COUNTIF= %d (should be 1)\n",
+            CELL(10, 3), CELL(11, 3), CELL(12, 3));
+
+    // Replacing D13 drops its index; the other two still follow writes
+    ParsedCommand clear;
+    create_test_command(&clear, CMD_SET_CELL, 13, 4, 0, 0, 0, 0, 0, 0, 0, FUNC_NONE);
+    handle_dependencies(&clear);
+    set_cell(13, 0, 5);             // A14 = 5 (was 0)
+    update_dependents(13, 0);
+    fprintf(output_file, "After D13 = 0, A14 = 5: COUNTIF %d (should be 3), SUMIF %d (should be -17), D13 %d (should be 0)\n",
+            CELL(10, 3), CELL(11, 3), CELL(12, 3));
+
+    // A sum that does not fit in an int is an error, not a truncated value
+    set_cell(12, 0, INT_MAX);       // A13 = INT_MAX (was 250)
+    update_dependents(12, 0);
+    set_cell(12, 1, INT_MAX);       // B13 = INT_MAX (was 5)
+    update_dependents(12, 1);
+    sum.predicate = PRED_GT;
+    sum.func_arg = 0;
+    function(&sum);
+    fprintf(output_file, "D12 = SUMIF(A11:B14,>0) over INT_MAX + INT_MAX: %d (should be %d)\n",
+            CELL(11, 3), ERROR_VALUE);
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_CONDITIONAL_AGGREGATES is passed\n");
+}
+
+/**
+ * Test non-blocking SLEEP: the cell stays pending until its timer fires
+ */
+void test_async_sleep(FILE *output_file) {
+    fprintf(output_file, "Testing non-blocking SLEEP...\n");
+
+    // Deadlines are reached by advancing the simulated clock, not by waiting
+    bool was_virtual = virtual_clock;
+    virtual_clock = true;
+    sleep_async = true;
+
+    // E20 = SLEEP(1), F20 = E20+5
+    ParsedCommand sleep_cmd, add_cmd;
+    create_test_command(&sleep_cmd, CMD_FUNCTION, 20, 5, 0, 0, 1, 0, 0, 0, 0, FUNC_SLEEP);
+    create_test_command(&add_cmd, CMD_ARITHMETIC, 20, 6, 20, 5, 0, 0, 0, 5, '+', FUNC_NONE);
+    handle_dependencies(&sleep_cmd);
+    handle_dependencies(&add_cmd);
+
+    fprintf(output_file, "E20 pending: %s (should be Yes), F20 value: %d (should be 5)\n",
+            timer_pending(19, 4) ? "Yes" : "No", CELL(19, 5));
+    fprintf(output_file, "Timers fired before the deadline: %d (should be 0)\n", timer_expire());
+
+    timer_sleep(1000);
+    fprintf(output_file, "Timers fired at the deadline: %d (should be 1)\n", timer_expire());
+    fprintf(output_file, "E20 value: %d (should be 1), F20 value: %d (should be 6)\n",
+            CELL(19, 4), CELL(19, 5));
+
+    // Re-assigning a pending cell cancels its timer
+    handle_dependencies(&sleep_cmd);
+    ParsedCommand set_cmd;
+    create_test_command(&set_cmd, CMD_SET_CELL, 20, 5, 0, 0, 9, 0, 0, 0, 0, FUNC_NONE);
+    handle_dependencies(&set_cmd);
+    fprintf(output_file, "Pending timers after overwriting E20: %d (should be 0), F20 value: %d (should be 14)\n",
+            timer_count(), CELL(19, 5));
+
+    sleep_async = false;
+    virtual_clock = was_virtual;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_ASYNC_SLEEP is passed\n");
+}
+
+/**
+ * Test SLEEP cells dirtied by the same change: they wait side by side and
+ * their dependents are recalculated once all of them are done
+ */
+void test_sleep_wave(FILE *output_file) {
+    fprintf(output_file, "Testing concurrent SLEEP wave...\n");
+
+    bool was_virtual = virtual_clock;
+    virtual_clock = true;
+    sleep_async = true;
+
+    // A30 = 0, B30..D30 = SLEEP(A30), E30 = B30+C30, F30 = E30+D30
+    ParsedCommand cmd;
+    create_test_command(&cmd, CMD_SET_CELL, 30, 1, 0, 0, 0, 0, 0, 0, 0, FUNC_NONE);
+    handle_dependencies(&cmd);
+    for (int col = 2; col <= 4; col++) {
+        create_test_command(&cmd, CMD_FUNCTION, 30, col, 30, 1, 0, 0, 0, 0, 0, FUNC_SLEEP);
+        handle_dependencies(&cmd);
+    }
+    create_test_command(&cmd, CMD_ARITHMETIC, 30, 5, 30, 2, 0, 30, 3, 0, '+', FUNC_NONE);
+    handle_dependencies(&cmd);
+    create_test_command(&cmd, CMD_ARITHMETIC, 30, 6, 30, 5, 0, 30, 4, 0, '+', FUNC_NONE);
+    handle_dependencies(&cmd);
+
+    // A30 = 1 makes all three sleeps wait one second at the same time
+    create_test_command(&cmd, CMD_SET_CELL, 30, 1, 0, 0, 1, 0, 0, 0, 0, FUNC_NONE);
+    handle_dependencies(&cmd);
+    fprintf(output_file, "Pending sleeps: %d (should be 3), E30 value: %d (should be 0)\n",
+            timer_count(), CELL(29, 4));
+
+    timer_sleep(999);
+    fprintf(output_file, "Sleeps fired just before the deadline: %d (should be 0)\n", timer_expire());
+    timer_sleep(1);
+    int fired = timer_expire();
+    fprintf(output_file, "Sleeps fired together after one second: %d (should be 3)\n", fired);
+    fprintf(output_file, "B30..D30: %d %d %d (should be 1 1 1), E30: %d (should be 2), F30: %d (should be 3)\n",
+            CELL(29, 1), CELL(29, 2), CELL(29, 3), CELL(29, 4), CELL(29, 5));
+
+    sleep_async = false;
+    virtual_clock = was_virtual;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_SLEEP_WAVE is passed\n");
+}
+
+/**
+ * Parses and applies one command, the way the main loop does
+ */
+static void run_input(const char *text) {
+    char input[MAX_INPUT_LEN];
+    ParsedCommand cmd;
+    strcpy(input, text);
+    input_parser(input, &cmd);
+    handle_dependencies(&cmd);
+}
+
+/**
+ * Test general expressions compiled to bytecode
+ */
+void test_expressions(FILE *output_file) {
+    fprintf(output_file, "Testing compiled expressions...\n");
+
+    char input[MAX_INPUT_LEN];
+    ParsedCommand cmd;
+    strcpy(input, "C40=(A40+B40)*3-SUM(A40:B40)/5");
+    input_parser(input, &cmd);
+    fprintf(output_file, "Parsed as expression: %s (should be Yes)\n",
+            cmd.type == CMD_EXPRESSION ? "Yes" : "No");
+    handle_dependencies(&cmd);
+
+    strcpy(input, "G40=A40+1");
+    input_parser(input, &cmd);
+    fprintf(output_file, "Single operator kept as arithmetic: %s (should be Yes)\n",
+            cmd.type == CMD_ARITHMETIC ? "Yes" : "No");
+
+    run_input("A40=4");
+    run_input("B40=6");
+    run_input("D40=MAX(A40,B40*2,-1)-MIN(A40:B40)");
+    fprintf(output_file, "C40 value: %d (should be 28), D40 value: %d (should be 8)\n",
+            CELL(39, 2), CELL(39, 3));
+
+    // Changing an input reruns the programs of its dependents
+    run_input("A40=9");
+    fprintf(output_file, "After A40=9, C40: %d (should be 42), D40: %d (should be 6)\n",
+            CELL(39, 2), CELL(39, 3));
+
+    // Division by zero inside an expression
+    run_input("E40=C40/(A40-9)");
+    fprintf(output_file, "E40 value: %d (should be %d)\n", CELL(39, 4), ERROR_VALUE);
+
+    // A cycle through an expression is rejected
+    run_input("A41=B41*2+1");
+    run_input("B41=(A41+1)*2");
+    fprintf(output_file, "Cycle status: %s (should be err)\n", status);
+
+    // Rebinding a cell replaces its program and edges
+    run_input("C40=A40-B40*2");
+    run_input("B40=1");
+    fprintf(output_file, "Rebound C40: %d (should be 7)\n", CELL(39, 2));
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_EXPRESSIONS is passed\n");
+}
+
+/**
+ * Test constant folding and the arithmetic kernels chosen when binding
+ */
+void test_formula_binding(FILE *output_file) {
+    fprintf(output_file, "Testing formula binding...\n");
+
+    char input[MAX_INPUT_LEN];
+    ParsedCommand cmd;
+
+    // Constant subexpressions fold down to a plain value
+    strcpy(input, "A42=(2+3)*4");
+    input_parser(input, &cmd);
+    fprintf(output_file, "A42 folded to assignment: %s, value %d (should be Yes, 20)\n",
+            cmd.type == CMD_SET_CELL && cmd.op2.row == 0 ? "Yes" : "No", cmd.op2.value);
+    handle_dependencies(&cmd);
+
+    // A cell and a folded literal become a single-operator formula
+    strcpy(input, "B42=A42*(1+1)");
+    input_parser(input, &cmd);
+    fprintf(output_file, "B42 lowered to arithmetic: %s, literal %d (should be Yes, 2)\n",
+            cmd.type == CMD_ARITHMETIC && cmd.op3.row == 0 ? "Yes" : "No", cmd.op3.value);
+    handle_dependencies(&cmd);
+    fprintf(output_file, "B42 kernel bound: %s (should be Yes)\n", cmd.kernel != NULL ? "Yes" : "No");
+
+    run_input("C42=B42-A42");
+    run_input("D42=100/C42");
+    run_input("E42=C42/0");
+    fprintf(output_file, "B42..E42: %d %d %d %d (should be 40 20 5 %d)\n",
+            CELL(41, 1), CELL(41, 2), CELL(41, 3), CELL(41, 4), ERROR_VALUE);
+
+    // Dependents rerun only their kernels
+    run_input("A42=0");
+    fprintf(output_file, "After A42=0, B42..E42: %d %d %d %d (should be 0 0 %d %d)\n",
+            CELL(41, 1), CELL(41, 2), CELL(41, 3), CELL(41, 4), ERROR_VALUE, ERROR_VALUE);
+    run_input("A42=-3");
+    fprintf(output_file, "After A42=-3, B42..D42: %d %d %d (should be -6 -3 -33)\n",
+            CELL(41, 1), CELL(41, 2), CELL(41, 3));
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_FORMULA_BINDING is passed\n");
+}
+
+/**
+ * Test the sleep command and SLEEP(n) on its own: they write no cell and,
+ * in the REPL, register an anonymous timer
+ */
+void test_bare_sleep(FILE *output_file) {
+    fprintf(output_file, "Testing bare sleep...\n");
+
+    sleep_async = true;
+    int before = timer_count();
+    run_input("sleep 0");
+    run_input("SLEEP(0)");
+    fprintf(output_file, "Anonymous timers added: %d (should be 2)\n", timer_count() - before);
+    fprintf(output_file, "Timers fired: %d (should be 2)\n", timer_expire());
+    sleep_async = false;
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_BARE_SLEEP is passed\n");
+}
+
+/**
+ * Test the sleep command on the virtual clock: it blocks by advancing the
+ * clock, so the time the prompt reports is the simulated duration
+ */
+void test_virtual_sleep(FILE *output_file) {
+    fprintf(output_file, "Testing sleep on the virtual clock...\n");
+
+    // Timed the way the main loop times a command
+    long long start = timer_now();
+    run_input("sleep 2");
+    double execution_time = (timer_now() - start) / 1000.0;
+    fprintf(output_file, "Reported time after sleep 2: [%.1f] (should be [2.0])\n", execution_time);
+
+    start = timer_now();
+    run_input("SLEEP(3)");
+    execution_time = (timer_now() - start) / 1000.0;
+    fprintf(output_file, "Reported time after SLEEP(3): [%.1f] (should be [3.0])\n", execution_time);
+    fprintf(output_file, "Timers left pending: %d (should be 0)\n", timer_count());
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_VIRTUAL_SLEEP is passed\n");
+}
+
+/**
+ * Test arithmetic at the edges of int: results wrap around, whether they
+ * are folded when compiling, interpreted or computed by a kernel, and
+ * INT_MIN / -1 does not trap
+ */
+void test_wrapping_arithmetic(FILE *output_file) {
+    fprintf(output_file, "Testing wrapping arithmetic...\n");
+
+    run_input("A44=(-2147483647-1)/-1");     // Folded while compiling
+    run_input("B44=2147483647+1");           // Folded while binding
+    run_input("C44=2147483647");
+    run_input("D44=(C44+1)*2-(C44*C44)");    // Interpreted
+    run_input("E44=A44/-1");                 // Cell / literal kernel
+    run_input("F44=(A44+0)/-1");             // Interpreted division
+    run_input("G44=-(A44+0)");               // Interpreted negation
+    fprintf(output_file, "A44..C44: %d %d %d (should be -2147483648 -2147483648 2147483647)\n",
+            CELL(43, 0), CELL(43, 1), CELL(43, 2));
+    fprintf(output_file, "D44..G44: %d %d %d %d (should be -1 -2147483648 -2147483648 -2147483648)\n",
+            CELL(43, 3), CELL(43, 4), CELL(43, 5), CELL(43, 6));
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_WRAPPING_ARITHMETIC is passed\n");
+}
+
+/**
+ * Test folding of function calls whose arguments are all literals
+ */
+void test_constant_calls(FILE *output_file) {
+    fprintf(output_file, "Testing constant function calls...\n");
+
+    char input[MAX_INPUT_LEN];
+    ParsedCommand cmd;
+    strcpy(input, "A45=MIN(1,2)");
+    input_parser(input, &cmd);
+    fprintf(output_file, "MIN(1,2) stored as a value: %s (should be Yes), value %d (should be 1)\n",
+            cmd.type == CMD_SET_CELL && cmd.op2.row == 0 ? "Yes" : "No", cmd.op2.value);
+
+    strcpy(input, "B45=MAX(3,4)*2+AVG(2,4,6)");
+    input_parser(input, &cmd);
+    fprintf(output_file, "Nested calls folded: %s (should be Yes), value %d (should be 12)\n",
+            cmd.type == CMD_SET_CELL && cmd.op2.row == 0 ? "Yes" : "No", cmd.op2.value);
+
+    strcpy(input, "C45=MIN(A45,2)+1");
+    input_parser(input, &cmd);
+    fprintf(output_file, "Call reading a cell kept: %s (should be Yes)\n",
+            cmd.type == CMD_EXPRESSION ? "Yes" : "No");
+    handle_dependencies(&cmd);
+
+    // A call that yields the error value still makes the formula an error
+    run_input("D45=MIN(-999999,5)+1");
+    run_input("A45=7");
+    fprintf(output_file, "C45 value: %d (should be 3), D45 value: %d (should be %d)\n",
+            CELL(44, 2), CELL(44, 3), ERROR_VALUE);
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_CONSTANT_CALLS is passed\n");
+}
+
+/**
+ * Counts the dependency edges into and out of a cell
+ */
+static void count_edges(int r, int c, int *parents, int *children) {
+    *parents = 0;
+    *children = 0;
+    for (Parent *parent = Parent_lst[r][c]; parent != NULL; parent = parent->next) (*parents)++;
+    for (Child *child = Child_lst[r][c]; child != NULL; child = child->next) (*children)++;
+}
+
+/**
+ * Test that range arguments of an expression subscribe to interned ranges
+ */
+void test_range_expressions(FILE *output_file) {
+    fprintf(output_file, "Testing range arguments of expressions...\n");
+
+    int parents, children;
+    run_input("B46=1");
+    run_input("C46=2");
+    run_input("D46=3");
+    run_input("G46=SUM(B46:D46)");
+    run_input("A46=SUM(B46:D46)+SUM(B46:D46)+B46+B46");
+    fprintf(output_file, "A46 value: %d (should be 14)\n", CELL(45, 0));
+
+    // One subscription for the repeated range and one edge for the repeated cell
+    count_edges(45, 0, &parents, &children);
+    fprintf(output_file, "A46 parents: %d (should be 2)\n", parents);
+    count_edges(45, 2, &parents, &children);
+    fprintf(output_file, "C46 children: %d (should be 1)\n", children);
+
+    run_input("C46=10");
+    fprintf(output_file, "A46 value: %d (should be 30), G46 value: %d (should be 14)\n",
+            CELL(45, 0), CELL(45, 6));
+
+    // A cycle drops the subscription and the program
+    run_input("E46=SUM(B46:E46)*2");
+    count_edges(45, 4, &parents, &children);
+    fprintf(output_file, "E46 value: %d (should be %d), parents: %d (should be 0)\n",
+            CELL(45, 4), ERROR_VALUE, parents);
+    fprintf(output_file, "E46 program released: %s (should be Yes), range freed: %s (should be Yes)\n",
+            formula_owned(45, 4) == NULL ? "Yes" : "No",
+            range_lookup(FUNC_SUM, 0, 0, 45, 1, 45, 4) == NULL ? "Yes" : "No");
+
+    fprintf(output_file, "\n");
+    fprintf(output_file, "TEST_RANGE_EXPRESSIONS is passed\n");
+}
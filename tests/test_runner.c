@@ -12,6 +12,8 @@
 #include "../clab/process.h"
 #include "../clab/dependent.h"
 #include "../clab/display.h"
+#include "../clab/storage.h"
+#include "../clab/timer.h"
 
 // Define global variables
 int** sheet;
@@ -37,33 +39,11 @@ void run_integration_tests(FILE *output_file);
  * Initialize the sheet for testing
  */
 void init_test_sheet() {
-    // Allocate memory for row pointers
-    sheet = (int **)malloc(MAXROW * sizeof(int *));
-    if (sheet == NULL) {
+    // Allocate the grid with every cell initialized to 0
+    if (!sheet_alloc()) {
         printf("Memory allocation failed!\n");
         exit(1);
     }
-
-    // Allocate memory for each row
-    for (int i = 0; i < MAXROW; i++) {
-        sheet[i] = (int *)malloc(MAXCOL * sizeof(int));
-        if (sheet[i] == NULL) {
-            printf("Memory allocation failed!\n");
-            // Free previously allocated memory
-            for (int j = 0; j < i; j++) {
-                free(sheet[j]);
-            }
-            free(sheet);
-            exit(1);
-        }
-    }
-
-    // Initialize all elements to 0
-    for (int i = 0; i < MAXROW; i++) {
-        for (int j = 0; j < MAXCOL; j++) {
-            sheet[i][j] = 0;
-        }
-    }
     
     // Initialize dependency lists
     make_parent_list();
@@ -79,10 +59,7 @@ void init_test_sheet() {
  */
 void cleanup_test_sheet() {
     // Free allocated memory
-    for (int i = 0; i < MAXROW; i++) {
-        free(sheet[i]); // Free each row
-    }
-    free(sheet); // Free the row pointers
+    sheet_free();
     
     // Free dependency lists
     free_parent_list();
@@ -104,6 +81,9 @@ int main(int argc, char *argv[]) {
     // Enable test mode and disable output
     set_test_mode(true);
     output_enabled = false;
+
+    // SLEEP advances a simulated clock, so the tests never wait
+    virtual_clock = true;
     
     // Open output file
     FILE *output_file = fopen(argv[2], "w");